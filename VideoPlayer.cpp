@@ -1,10 +1,15 @@
 #include "VideoPlayer.h"
+#include "decode_slot.h"
 #include <iostream>
 #include <stdexcept>
 #include <functional>
 #include <chrono>
 #include <cstring>
 #include <memory>
+#include <iomanip>
+#include <algorithm>
+#include <cmath>
+#include <sstream>
 
 
 extern "C"
@@ -17,6 +22,7 @@ extern "C"
 #include <libavutil/channel_layout.h>
 #include <libavutil/opt.h>
 #include <libavutil/time.h>
+#include <libavutil/pixdesc.h>
 }
 
 
@@ -30,9 +36,30 @@ extern "C"
 #define AV_SYNC_THRESHOLD 0.01
 #define AV_NOSYNC_THRESHOLD 1.0
 
+// Packets and frames carry the serial they were read under in their opaque field.
+static inline void *serial_tag(int serial) { return reinterpret_cast<void *>(static_cast<intptr_t>(serial)); }
+static inline int tag_serial(const void *opaque) { return static_cast<int>(reinterpret_cast<intptr_t>(opaque)); }
 
+// Trace flow of a packet and the frame decoded from it: its pts on the playback
+// timeline, keyed by serial so that a frame decoded again after a seek starts anew.
+static inline int64_t trace_flow(int serial, int64_t pts, int64_t rebase)
+{
+    return pts == AV_NOPTS_VALUE ? -1 : ((int64_t)serial << 48) + ((pts + rebase) & 0xffffffffffffLL);
+}
+
+#define TRACE_EVENTS_PER_THREAD (1 << 18)
+
+#define WINDOW_TITLE "OpenGL_播放器"
 
-VideoPlayer::VideoPlayer(const std::string &file) : filename(file) {}
+// Empty packets are markers; their stream_index says what for.
+#define MARKER_END_OF_STREAM 0 // drain the decoder, nothing follows
+#define MARKER_NEXT_INPUT 1    // drain the decoder and switch to the next handed-off input
+#define MARKER_REVIEW 2        // serve frames from the GOP cache while review lasts
+
+
+
+VideoPlayer::VideoPlayer(const std::string &file, const PlayerOptions &opts) : playlist{file}, options(opts) {}
+VideoPlayer::VideoPlayer(const std::vector<std::string> &files, const PlayerOptions &opts) : playlist(files), options(opts) {}
 VideoPlayer::~VideoPlayer() { cleanup(); }
 
 
@@ -45,169 +72,551 @@ void VideoPlayer::render_video_frame()
         return;
     }
 
-    auto frame_deleter = [](AVFrame *f)
-    { av_frame_free(&f); };
+    auto frame_deleter = [this](AVFrame *f)
+    { video_frame_pool.release(f); };
     std::unique_ptr<AVFrame, decltype(frame_deleter)> frame_ptr(frame, frame_deleter);
 
+    int frame_serial = tag_serial(frame->opaque);
+    if (frame_serial != serial.load(std::memory_order_acquire))
+    {
+        // Decoded before the last seek.
+        stats.stale_frames.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    if (!frame->buf[0])
+    {
+        // End-of-stream marker from the decoder. The last frame stays on screen and the
+        // window open until it is closed, so the user can still seek back or step.
+        return;
+    }
+
     double video_pts = (frame->best_effort_timestamp == AV_NOPTS_VALUE) ? 0 : frame->best_effort_timestamp;
-    video_pts *= av_q2d(video_stream->time_base);
+    video_pts *= av_q2d(frame->time_base);
     if (video_pts == 0)
     {
         video_pts = frame_last_pts + frame_last_delay;
     }
 
-    double frame_delay = video_pts - frame_last_pts;
-    if (frame_delay <= 0 || frame_delay > 1.0)
+    // The first frame of a serial is shown at once and restarts the frame timer.
+    if (frame_serial != render_serial)
     {
-        double fps = av_q2d(video_stream->avg_frame_rate);
-        frame_delay = (fps > 0) ? (1.0 / fps) : 0.040;
+        render_serial = frame_serial;
+        frame_last_pts = video_pts;
+        frame_timer = (double)av_gettime_relative() / 1000000.0;
+        display_frame(frame);
+        position = video_pts;
+        if (frame_serial > 0)
+            record_seek_latency(frame_serial);
+        return;
     }
 
+    double frame_delay = video_pts - frame_last_pts;
+    if (frame_delay <= 0 || frame_delay > 1.0)
+        frame_delay = frame->duration > 0 ? frame->duration * av_q2d(frame->time_base) : 0.040;
+
     frame_last_delay = frame_delay;
     frame_last_pts = video_pts;
 
-    double audio_pts = get_audio_clock();
-    double diff = video_pts - audio_pts;
+    double audio_pts;
+    double diff = get_audio_clock(audio_pts) ? video_pts - audio_pts : 0.0;
+    frame_skip.report_lag(diff);
 
+    telemetry.record_av_diff(diff);
     if (diff < -AV_NOSYNC_THRESHOLD)
     {
-        std::cout << "Video is too far behind audio (" << diff << "s). Dropping frame." << std::endl;
-        return; 
+        telemetry.late_frames_dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
     }
 
-    double sync_delay = frame_delay + diff;
+    // Stream time passes speed times faster than the frame timer.
+    double sync_delay = (frame_delay + diff) / speed.load(std::memory_order_relaxed);
     if (sync_delay < AV_SYNC_THRESHOLD)
         sync_delay = AV_SYNC_THRESHOLD;
 
     frame_timer += sync_delay;
-    double actual_delay = frame_timer - (double)av_gettime() / 1000000.0;
-    if (actual_delay < 0.010)
-        actual_delay = 0.010;
+    double actual_delay = frame_timer - (double)av_gettime_relative() / 1000000.0;
+    if (actual_delay > 0 && !wait_for_render(actual_delay, frame_serial))
+        return;
 
-    SDL_Delay(static_cast<Uint32>(actual_delay * 1000 + 0.5));
     display_frame(frame);
+    position = video_pts;
 }
 
-int VideoPlayer::resample_audio_frame()
+// Sleeps the render thread until a frame is due. Returns false if woken for shutdown
+// or because a seek made the frame stale.
+bool VideoPlayer::wait_for_render(double seconds, int frame_serial)
 {
-    AVFrame *frame = audio_frame_q.pop();
-    if (!frame)
-        return -1;
-
-    
-    auto frame_deleter = [](AVFrame *f)
-    { av_frame_free(&f); };
-    std::unique_ptr<AVFrame, decltype(frame_deleter)> frame_ptr(frame, frame_deleter);
+    auto due = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(seconds));
+    std::unique_lock<std::mutex> lock(render_mutex);
+    render_cond.wait_until(lock, due, [this, frame_serial]
+                           { return quit || serial != frame_serial; });
+    return !quit && serial == frame_serial;
+}
 
-    if (frame->best_effort_timestamp != AV_NOPTS_VALUE)
+void VideoPlayer::render_thread_entry()
+{
+    Tracer::set_thread_name("render");
+    SDL_GL_MakeCurrent(window, gl_context);
+    while (!quit)
     {
-        std::lock_guard<std::mutex> lock(audio_clock_mutex);
-        audio_clock = frame->best_effort_timestamp * av_q2d(audio_stream->time_base);
+        if (viewport_dirty.exchange(false))
+            glViewport(0, 0, viewport_w.load(), viewport_h.load());
+        render_video_frame();
     }
+    SDL_GL_MakeCurrent(window, nullptr);
 
-    uint8_t *out_buffer = audio_buf;
-    int out_channels = 2;
-    int max_out_samples = sizeof(audio_buf) / (out_channels * av_get_bytes_per_sample(AV_SAMPLE_FMT_S16));
+    // Wake the event loop in case playback ended on its own.
+    SDL_Event event;
+    SDL_memset(&event, 0, sizeof(event));
+    event.type = SDL_QUIT;
+    SDL_PushEvent(&event);
+}
 
+// Converts one decoded frame to the device format and appends it to the PCM ring.
+// Blocks while the ring is full; returns false once the ring has been aborted.
+bool VideoPlayer::resample_audio_frame(AVFrame *frame)
+{
+    // audio_clock tracks the stream time at the end of the samples resampled so far.
+    if (frame->best_effort_timestamp != AV_NOPTS_VALUE)
+        audio_clock = frame->best_effort_timestamp * av_q2d(frame->time_base);
+    if (frame->sample_rate > 0)
+        audio_clock += (double)frame->nb_samples / frame->sample_rate;
+
+    const int out_channels = 2;
+    const int sample_bytes = out_channels * av_get_bytes_per_sample(AV_SAMPLE_FMT_S16);
+    int max_out_samples = swr_get_out_samples(swr_ctx, frame->nb_samples);
+    if (max_out_samples < 0)
+        return true;
+    if (resample_buf.size() < (size_t)max_out_samples * sample_bytes)
+        resample_buf.resize((size_t)max_out_samples * sample_bytes);
+
+    uint8_t *out_buffer = resample_buf.data();
     int converted_samples = swr_convert(swr_ctx,
                                         &out_buffer, max_out_samples,
-                                        (const uint8_t **)frame->data, frame->nb_samples);
+                                        (const uint8_t **)frame->extended_data, frame->nb_samples);
     if (converted_samples < 0)
     {
         std::cerr << "swr_convert failed" << std::endl;
-        return -1;
+        return true;
     }
-    return converted_samples * out_channels * av_get_bytes_per_sample(AV_SAMPLE_FMT_S16);
+
+    time_stretch.set_tempo(speed.load(std::memory_order_relaxed));
+    int stretched = 0;
+    const int16_t *out = time_stretch.process(reinterpret_cast<const int16_t *>(resample_buf.data()), converted_samples, stretched);
+    // The stretcher holds back input it has not played out yet.
+    return write_pcm(out, stretched, audio_clock - (double)time_stretch.pending() / audio_out_rate, time_stretch.tempo());
+}
+
+// Appends output-format samples ending at stream time end_pts, which pass tempo times
+// faster than they play.
+bool VideoPlayer::write_pcm(const int16_t *samples, int frames, double end_pts, double tempo)
+{
+    if (frames <= 0)
+        return true;
+    uint64_t begin = pcm_ring.write_position();
+    if (!pcm_ring.write(reinterpret_cast<const uint8_t *>(samples), (size_t)frames * 2 * sizeof(int16_t)))
+        return false;
+    pcm_ring.add_span(begin, end_pts - (double)frames / audio_out_rate * tempo, end_pts);
+    return true;
 }
 
 void VideoPlayer::open()
 {
     avformat_network_init();
-    if (avformat_open_input(&format_ctx, filename.c_str(), nullptr, nullptr) != 0)
-    {
-        throw std::runtime_error("Could not open file: " + filename);
-    }
-    if (avformat_find_stream_info(format_ctx, nullptr) < 0)
+    if (options.mosaic)
     {
-        throw std::runtime_error("Could not find stream info.");
+        open_mosaic();
+        return;
     }
 
-    for (unsigned int i = 0; i < format_ctx->nb_streams; i++)
+    // A playlist starts with its first entry that opens.
+    std::string error = "Empty playlist.";
+    for (next_entry = 0; next_entry < playlist.size() && !input; next_entry++)
     {
-        auto stream = format_ctx->streams[i];
-        if (stream->codecpar->codec_type == AVMEDIA_TYPE_VIDEO && video_stream_index == -1)
+        auto in = std::make_shared<MediaInput>();
+        try
         {
-            video_stream_index = i;
-            video_stream = stream;
+            in->open(playlist[next_entry], options, video_buffer_pool);
+            input = in;
         }
-        else if (stream->codecpar->codec_type == AVMEDIA_TYPE_AUDIO && audio_stream_index == -1)
+        catch (const std::runtime_error &e)
         {
-            audio_stream_index = i;
-            audio_stream = stream;
+            error = e.what();
+            if (playlist.size() > 1)
+                std::cerr << "Skipping " << playlist[next_entry] << ": " << error << std::endl;
         }
     }
-    if (video_stream_index == -1)
-        throw std::runtime_error("No video stream found.");
-
-    init_codec_context(video_stream_index, &video_codec_ctx, "video");
-    if (audio_stream_index != -1)
+    if (!input)
+        throw std::runtime_error(error);
+
+    playlist_done = playlist.size() < 2 && !options.loop;
+    has_audio = input->audio_stream_index != -1 || !playlist_done;
+    stats.discarded_stream_packets += input->discarded_stream_packets;
+    stats.discarded_stream_bytes += input->discarded_stream_bytes;
+
+    // Queued packets and frames carry their own time base; these only cover items without one.
+    AVRational video_tb = input->video_stream->time_base;
+    AVRational audio_tb = input->audio_stream ? input->audio_stream->time_base : video_tb;
+    memory_budget.cap = options.memory_cap;
+    video_q.set_budget(&memory_budget, options.packet_queue_bytes, options.packet_queue_seconds, video_tb, false);
+    video_frame_q.set_budget(&memory_budget, options.frame_queue_bytes, 0.0, video_tb, true);
+    if (has_audio)
     {
-        init_codec_context(audio_stream_index, &audio_codec_ctx, "audio");
+        audio_q.set_budget(&memory_budget, options.packet_queue_bytes, options.packet_queue_seconds, audio_tb, false);
     }
+    video_q.set_wait_histogram(&telemetry.video_packet_wait);
+    audio_q.set_wait_histogram(&telemetry.audio_packet_wait);
+    video_frame_q.set_wait_histogram(&telemetry.video_frame_wait);
+}
+
+void VideoPlayer::start_telemetry()
+{
+    if (options.telemetry_target.empty())
+        return;
+
+    TelemetryExporter &e = telemetry_exporter;
+    e.add_histogram("demux_read_seconds", "Time spent in av_read_frame.", telemetry.demux_read);
+    e.add_histogram("video_packet_queue_seconds", "Time video packets wait in the packet queue.", telemetry.video_packet_wait);
+    e.add_histogram("audio_packet_queue_seconds", "Time audio packets wait in the packet queue.", telemetry.audio_packet_wait);
+    e.add_histogram("video_decode_seconds", "Decode time per video packet, including the frames it releases.", telemetry.video_decode);
+    e.add_histogram("video_frame_queue_seconds", "Time decoded frames wait for the renderer.", telemetry.video_frame_wait);
+    e.add_histogram("display_convert_seconds", "Software pixel format conversion before upload.", telemetry.display_convert);
+    e.add_histogram("display_upload_seconds", "PBO staging and texture upload per frame.", telemetry.display_upload);
+    e.add_histogram("display_draw_seconds", "Draw call submission per frame.", telemetry.display_draw);
+    e.add_histogram("display_swap_seconds", "Buffer swap per frame.", telemetry.display_swap);
+    e.add_histogram("audio_callback_seconds", "Duration of the SDL audio callback.", telemetry.audio_callback);
+    e.add_histogram("av_video_behind_seconds", "How far scheduled frames lag behind the audio clock.", telemetry.av_video_behind);
+    e.add_histogram("av_video_ahead_seconds", "How far scheduled frames lead the audio clock.", telemetry.av_video_ahead);
+
+    e.add_counter("late_frames_dropped_total", "Frames dropped by the renderer for being too far behind audio.", telemetry.late_frames_dropped);
+    e.add_counter("packets_read_total", "Packets read by the demuxer.", stats.packets_read);
+    e.add_counter("audio_underruns_total", "Audio callbacks that found too little PCM.", stats.audio_underruns);
+    e.add_counter("stale_frames_total", "Frames dropped because a seek made them stale.", stats.stale_frames);
+    e.add_counter("skip_level_1_frames_total", "Frames decoded without loop filter.", stats.skip_level_frames[1]);
+    e.add_counter("skip_level_2_frames_total", "Frames decoded while skipping non-reference frames.", stats.skip_level_frames[2]);
+    e.add_counter("skip_level_3_frames_total", "Frames decoded while decoding keyframes only.", stats.skip_level_frames[3]);
+
+    e.add_gauge("video_packet_queue_depth", "Packets in the video packet queue.", [this]
+                { return (double)video_q.size(); });
+    e.add_gauge("audio_packet_queue_depth", "Packets in the audio packet queue.", [this]
+                { return (double)audio_q.size(); });
+    e.add_gauge("video_frame_queue_depth", "Frames in the decoded frame queue.", [this]
+                { return (double)video_frame_q.size(); });
+    e.add_gauge("queued_bytes", "Bytes held by all packet and frame queues.", [this]
+                { return (double)memory_budget.bytes.load(std::memory_order_relaxed); });
+    e.add_gauge("pcm_ring_bytes", "Resampled audio waiting for the device.", [this]
+                { return (double)pcm_ring.fill(); });
+    e.add_gauge("position_seconds", "Timestamp of the last displayed frame.", [this]
+                { return position.load(); });
+
+    e.start(options.telemetry_target, options.telemetry_prometheus ? TelemetryExporter::Format::Prometheus : TelemetryExporter::Format::Json,
+            options.telemetry_interval_ms);
 }
 
 void VideoPlayer::start()
 {
+    if (options.mosaic)
+    {
+        run_mosaic();
+        return;
+    }
+    start_telemetry();
+    if (!options.trace_path.empty())
+        Tracer::enable(TRACE_EVENTS_PER_THREAD);
+    if (options.bench)
+    {
+        set_speed(options.speed);
+        run_bench();
+        telemetry_exporter.stop();
+        return;
+    }
+
     if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_TIMER))
     {
         throw std::runtime_error("SDL_Init failed: " + std::string(SDL_GetError()));
     }
 
-    init_sdl_video();
-    if (audio_stream_index != -1)
+    int video_width = input->video_codec_ctx->width;
+    int video_height = input->video_codec_ctx->height;
+    init_sdl_video(video_width, video_height);
+    setup_shaders(video_width, video_height);
+    set_speed(options.speed);
+    // The context moves to the render thread once playback starts.
+    SDL_GL_MakeCurrent(window, nullptr);
+    if (has_audio)
     {
         init_sdl_audio();
     }
 
-    frame_timer = (double)av_gettime() / 1000000.0;
+    frame_timer = (double)av_gettime_relative() / 1000000.0;
     frame_last_delay = 40e-3;
 
+    // Without a cached index, scan for keyframes in the background with a separate demuxer.
+    input->start_index_build();
+
+    start_pipeline();
+    main_loop();
+
+    std::shared_ptr<MediaInput> last;
+    {
+        std::lock_guard<std::mutex> lock(playlist_mutex);
+        last = input;
+    }
+    if (stats.audio_underruns.load() > 0)
+        std::cerr << "Audio underruns: " << stats.audio_underruns.load() << std::endl;
+    if (telemetry.late_frames_dropped.load() > 0)
+        std::cerr << "Frames dropped for being more than " << AV_NOSYNC_THRESHOLD << "s behind audio: "
+                  << telemetry.late_frames_dropped.load() << std::endl;
+    if (last->uses_readahead() && last->readahead_stats().stalls > 0)
+        print_readahead_stats(*last);
+    if (stats.seeks.load() > 0)
+        std::cerr << "Seeks: " << stats.seeks.load() << ", first frame after "
+                  << stats.seek_latency_total_us.load() / 1000.0 / stats.seeks.load() << " ms avg, "
+                  << stats.seek_latency_max_us.load() / 1000.0 << " ms max; dropped as stale: "
+                  << stats.stale_packets.load() << " packets, " << stats.stale_frames.load() << " frames" << std::endl;
+    if (stats.skip_level_entries[1].load() > 0)
+    {
+        static const char *const level_names[FrameSkipController::LEVELS] = {"full", "no loop filter", "no non-ref", "keyframes only"};
+        std::cerr << "Decoder frame skipping:";
+        for (int l = 0; l < FrameSkipController::LEVELS; l++)
+            std::cerr << (l ? "; " : " ") << level_names[l] << " " << stats.skip_level_frames[l].load() << " frames"
+                      << (l ? ", entered " + std::to_string(stats.skip_level_entries[l].load()) + "x" : "");
+        std::cerr << std::endl;
+    }
+}
+
+void VideoPlayer::start_pipeline()
+{
     demux_thread = std::thread(&VideoPlayer::demux_thread_entry, this);
     video_decode_thread = std::thread(&VideoPlayer::video_decode_thread_entry, this);
-    if (audio_stream_index != -1)
+    if (has_audio)
     {
         audio_decode_thread = std::thread(&VideoPlayer::audio_decode_thread_entry, this);
     }
+    render_thread = std::thread(&VideoPlayer::render_thread_entry, this);
+    if (!playlist_done)
+        playlist_thread = std::thread(&VideoPlayer::playlist_thread_entry, this);
+}
 
-    main_loop();
+// Positions the demuxer on the keyframe at or before ts (video time base).
+bool VideoPlayer::seek_container(MediaInput &in, int64_t ts)
+{
+    AVFormatContext *format_ctx = in.format_ctx;
+    AVStream *video_stream = in.video_stream;
+    int video_stream_index = in.video_stream_index;
+    const KeyframeEntry *kf = in.keyframe_index.find(ts);
+    if (kf)
+    {
+        // Containers with their own index land exactly on a known keyframe pts. For the
+        // rest (MPEG-TS, elementary streams) the demuxer would bisect and guess, so jump
+        // straight to the keyframe's byte offset instead.
+        if (avformat_index_get_entries_count(video_stream) > 0 &&
+            avformat_seek_file(format_ctx, video_stream_index, INT64_MIN, kf->pts, kf->pts, 0) >= 0)
+            return true;
+        if (kf->pos >= 0 && !(format_ctx->iformat->flags & AVFMT_NO_BYTE_SEEK) &&
+            av_seek_frame(format_ctx, video_stream_index, kf->pos, AVSEEK_FLAG_BYTE) >= 0)
+            return true;
+    }
+    return av_seek_frame(format_ctx, video_stream_index, ts, AVSEEK_FLAG_BACKWARD) >= 0;
+}
+
+void VideoPlayer::seek(double t)
+{
+    if (quit || options.mosaic)
+        return;
+    std::shared_ptr<MediaInput> in;
+    {
+        std::lock_guard<std::mutex> lock(playlist_mutex);
+        in = input;
+    }
+    double start_time = in->timeline_offset + in->start_time();
+    if (t < start_time)
+        t = start_time;
+    if (in->duration() > 0 && t > start_time + in->duration())
+        t = start_time + in->duration();
+
+    // A seek ends a pause or reverse playback.
+    bool was_reviewing = reviewing.exchange(false);
+    review_pending = false;
+    if (was_reviewing)
+    {
+        std::lock_guard<std::mutex> lock(review_mutex);
+        review = ReviewCommands();
+    }
+
+    // Nothing is torn down: the demuxer repositions itself, decoders flush when the first
+    // packet of the new serial arrives, and everything older is dropped where it is found.
+    int new_serial = bump_serial(t);
+    seek_pending = true;
+    position = t;
+    wake_pipeline(new_serial);
+    if (was_reviewing)
+    {
+        review_cond.notify_all();
+        update_title();
+    }
+}
+
+// Starts a new serial; target is the seek position, or < 0 for none.
+int VideoPlayer::bump_serial(double target)
+{
+    std::lock_guard<std::mutex> lock(seek_mutex);
+    int new_serial = seek_request.serial + 1;
+    seek_request.serial = new_serial;
+    seek_request.target = target;
+    seek_request.requested_at = av_gettime_relative();
+    serial.store(new_serial, std::memory_order_release);
+    return new_serial;
+}
+
+// Wakes whoever may be blocked on stale data: the demuxer on its budget or on the
+// next playlist entry, the audio decoder on a full PCM ring, the renderer on a stale
+// frame's due time.
+void VideoPlayer::wake_pipeline(int new_serial)
+{
+    memory_budget.space.notify_all();
+    {
+        std::lock_guard<std::mutex> lock(playlist_mutex);
+    }
+    playlist_cond.notify_all();
+    pcm_ring.invalidate(new_serial);
+    {
+        std::lock_guard<std::mutex> lock(render_mutex);
+    }
+    render_cond.notify_all();
 }
 
-void VideoPlayer::init_codec_context(int stream_index, AVCodecContext **codec_ctx, const std::string &type)
+void VideoPlayer::set_speed(double s)
 {
-    const AVCodec *codec = avcodec_find_decoder(format_ctx->streams[stream_index]->codecpar->codec_id);
-    if (!codec)
-        throw std::runtime_error("Unsupported " + type + " codec.");
+    if (options.mosaic)
+        return;
+    s = std::min(TimeStretch::MAX_TEMPO, std::max(TimeStretch::MIN_TEMPO, s));
+    speed.store(s, std::memory_order_relaxed);
 
-    *codec_ctx = avcodec_alloc_context3(codec);
-    if (!*codec_ctx)
-        throw std::runtime_error("Could not allocate " + type + " codec context.");
+    // Frames beyond what the display can show are not worth decoding.
+    double fps = 0.0;
+    {
+        std::lock_guard<std::mutex> lock(playlist_mutex);
+        if (input && input->video_stream)
+            fps = av_q2d(input->video_stream->avg_frame_rate);
+    }
+    SDL_DisplayMode mode;
+    int refresh = window && SDL_GetWindowDisplayMode(window, &mode) == 0 && mode.refresh_rate > 0 ? mode.refresh_rate : 60;
+    frame_skip.set_skip_nonref(fps * s > refresh);
+    update_title();
+}
 
-    avcodec_parameters_to_context(*codec_ctx, format_ctx->streams[stream_index]->codecpar);
+void VideoPlayer::update_title()
+{
+    if (!window)
+        return;
+    std::ostringstream title;
+    title << WINDOW_TITLE;
+    double s = speed.load(std::memory_order_relaxed);
+    if (s != 1.0)
+        title << " [" << s << "x]";
+    if (reviewing)
+    {
+        std::lock_guard<std::mutex> lock(review_mutex);
+        title << (review.reverse ? " [倒放]" : " [暂停]");
+    }
+    SDL_SetWindowTitle(window, title.str().c_str());
+}
 
-    if (codec->capabilities & AV_CODEC_CAP_FRAME_THREADS)
+void VideoPlayer::toggle_pause()
+{
+    bool reverse;
     {
-        (*codec_ctx)->thread_type = FF_THREAD_FRAME;
+        std::lock_guard<std::mutex> lock(review_mutex);
+        reverse = review.reverse;
     }
-    else if (codec->capabilities & AV_CODEC_CAP_SLICE_THREADS)
+    if (reviewing && !reverse)
+        seek(position);
+    else
+        enter_review(false, 0);
+}
+
+void VideoPlayer::toggle_reverse()
+{
+    bool reverse;
     {
-        (*codec_ctx)->thread_type = FF_THREAD_SLICE;
+        std::lock_guard<std::mutex> lock(review_mutex);
+        reverse = review.reverse;
     }
-    (*codec_ctx)->thread_count = 0; 
+    if (reviewing && reverse)
+        seek(position);
+    else
+        enter_review(true, 0);
+}
 
-    if (avcodec_open2(*codec_ctx, codec, nullptr) < 0)
+void VideoPlayer::step_frame(int frames)
+{
+    enter_review(false, frames);
+}
+
+// The first command stops the demuxer, which then queues a marker that turns the
+// video decoder to the GOP cache; later ones only reach the decoder's review loop.
+void VideoPlayer::enter_review(bool reverse, int steps)
+{
+    if (quit || options.mosaic)
+        return;
+    bool entering = !reviewing;
+    if (entering)
+    {
+        std::lock_guard<std::mutex> lock(playlist_mutex);
+        if (input && input->keyframe_index.failed())
+        {
+            std::cerr << "No keyframe index for " << input->filename << ": frame stepping and reverse playback are unavailable" << std::endl;
+            return;
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(review_mutex);
+        if (entering || review.reverse != reverse)
+            review.resync = true;
+        review.reverse = reverse;
+        review.steps += steps;
+    }
+    int new_serial = bump_serial(-1.0);
+    if (entering)
     {
-        throw std::runtime_error("Could not open " + type + " codec.");
+        reviewing = true;
+        review_pending = true;
     }
+    wake_pipeline(new_serial);
+    review_cond.notify_all();
+    update_title();
+}
+
+void VideoPlayer::step_speed(int steps)
+{
+    static const double speeds[] = {0.5, 0.75, 1.0, 1.25, 1.5, 2.0, 3.0, 4.0};
+    const int count = sizeof(speeds) / sizeof(speeds[0]);
+    double current = speed.load(std::memory_order_relaxed);
+    int i = 0;
+    while (i < count - 1 && speeds[i] < current)
+        i++;
+    if (steps > 0 && speeds[i] > current)
+        i--; // between two steps: the next one up is i
+    set_speed(speeds[std::min(count - 1, std::max(0, i + steps))]);
+}
+
+SeekRequest VideoPlayer::current_seek()
+{
+    std::lock_guard<std::mutex> lock(seek_mutex);
+    return seek_request;
+}
+
+void VideoPlayer::record_seek_latency(int frame_serial)
+{
+    SeekRequest req = current_seek();
+    if (req.serial != frame_serial || req.target < 0)
+        return;
+    uint64_t us = av_gettime_relative() - req.requested_at;
+    stats.seeks.fetch_add(1, std::memory_order_relaxed);
+    stats.seek_latency_total_us.fetch_add(us, std::memory_order_relaxed);
+    if (us > stats.seek_latency_max_us.load(std::memory_order_relaxed))
+        stats.seek_latency_max_us.store(us, std::memory_order_relaxed);
 }
 
 GLuint VideoPlayer::compile_shader(GLenum type, const char *src)
@@ -247,6 +656,37 @@ GLuint VideoPlayer::link_program(GLuint vs, GLuint fs)
     return p;
 }
 
+// Maps a decoder pixel format onto the plane textures, or returns false if it has to
+// go through sws_scale first.
+static bool describe_upload(int format, UploadFormat &out)
+{
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(static_cast<AVPixelFormat>(format));
+    if (!desc || desc->nb_components != 3 ||
+        (desc->flags & (AV_PIX_FMT_FLAG_HWACCEL | AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_RGB | AV_PIX_FMT_FLAG_BE)))
+        return false;
+
+    const AVComponentDescriptor &y = desc->comp[0], &u = desc->comp[1], &v = desc->comp[2];
+    int bytes = y.depth > 8 ? 2 : 1;
+    if (y.plane != 0 || y.step != bytes || u.depth != y.depth || v.depth != y.depth || y.depth > 16)
+        return false;
+
+    if (u.plane == 1 && v.plane == 2 && u.step == bytes && v.step == bytes)
+        out.semi_planar = false;
+    else if (u.plane == 1 && v.plane == 1 && u.step == 2 * bytes && u.offset == 0 && v.offset == bytes)
+        out.semi_planar = true;
+    else
+        return false;
+
+    out.bytes = bytes;
+    out.chroma_w_shift = desc->log2_chroma_w;
+    out.chroma_h_shift = desc->log2_chroma_h;
+    // Normalized textures read raw / (2^(8*bytes) - 1); rescale so the nominal code
+    // range of the actual bit depth (LSB- or MSB-aligned) maps to [0,1].
+    double stored_max = bytes == 1 ? 255.0 : 65535.0;
+    out.sample_scale = static_cast<float>(stored_max / (double)(((1 << y.depth) - 1) << y.shift));
+    return true;
+}
+
 void VideoPlayer::setup_shaders(int video_w, int video_h)
 {
     const char *vertex_shader_src = R"(
@@ -261,30 +701,52 @@ void VideoPlayer::setup_shaders(int video_w, int video_h)
         }
     )";
 
-    const char *fragment_shader_src = R"(
-        #version 330 core
+    // Shared by both variants: planes are sampled, scaled to nominal [0,1] code values
+    // and converted with the matrix/offset of the frame's colorspace and range.
+    const char *fragment_shader_body = R"(
         in vec2 TexCoord;
         out vec4 FragColor;
         uniform sampler2D tex_y;
         uniform sampler2D tex_u;
         uniform sampler2D tex_v;
+        uniform mat3 yuv_matrix;
+        uniform vec3 yuv_offset;
+        uniform float sample_scale;
         void main()
         {
-            float y = texture(tex_y, TexCoord).r;
-            float u = texture(tex_u, TexCoord).r - 0.5;
-            float v = texture(tex_v, TexCoord).r - 0.5;
-            float r = y + 1.402 * v;
-            float g = y - 0.344136 * u - 0.714136 * v;
-            float b = y + 1.772 * u;
-            FragColor = vec4(r, g, b, 1.0);
+            vec3 yuv;
+            yuv.x = texture(tex_y, TexCoord).r;
+        #ifdef SEMI_PLANAR
+            yuv.yz = texture(tex_u, TexCoord).rg;
+        #else
+            yuv.y = texture(tex_u, TexCoord).r;
+            yuv.z = texture(tex_v, TexCoord).r;
+        #endif
+            vec3 rgb = yuv_matrix * (yuv * sample_scale - yuv_offset);
+            FragColor = vec4(rgb, 1.0);
         }
     )";
 
-    GLuint vs = compile_shader(GL_VERTEX_SHADER, vertex_shader_src);
-    GLuint fs = compile_shader(GL_FRAGMENT_SHADER, fragment_shader_src);
-    shader_program = link_program(vs, fs);
-    glDeleteShader(vs);
-    glDeleteShader(fs);
+    auto build_variant = [&](ShaderVariant &variant, const char *defines)
+    {
+        std::string fragment_src = std::string("#version 330 core\n") + defines + fragment_shader_body;
+        GLuint vs = compile_shader(GL_VERTEX_SHADER, vertex_shader_src);
+        GLuint fs = compile_shader(GL_FRAGMENT_SHADER, fragment_src.c_str());
+        variant.program = link_program(vs, fs);
+        glDeleteShader(vs);
+        glDeleteShader(fs);
+
+        glUseProgram(variant.program);
+        glUniform1i(glGetUniformLocation(variant.program, "tex_y"), 0);
+        glUniform1i(glGetUniformLocation(variant.program, "tex_u"), 1);
+        glUniform1i(glGetUniformLocation(variant.program, "tex_v"), 2);
+        variant.loc_matrix = glGetUniformLocation(variant.program, "yuv_matrix");
+        variant.loc_offset = glGetUniformLocation(variant.program, "yuv_offset");
+        variant.loc_scale = glGetUniformLocation(variant.program, "sample_scale");
+        glUseProgram(0);
+    };
+    build_variant(planar_shader, "");
+    build_variant(semi_planar_shader, "#define SEMI_PLANAR\n");
 
     float vertices[] = {
         -1.0f,
@@ -317,39 +779,70 @@ void VideoPlayer::setup_shaders(int video_w, int video_h)
     glBindBuffer(GL_ARRAY_BUFFER, 0);
     glBindVertexArray(0);
 
-    glGenTextures(1, &tex_y);
-    glGenTextures(1, &tex_u);
-    glGenTextures(1, &tex_v);
+    // Texture storage is allocated once for the stream's format; display_frame only
+    // reallocates if the decoder switches format or size mid-stream.
+    UploadFormat fmt;
+    if (!describe_upload(input->video_codec_ctx->pix_fmt, fmt))
+        describe_upload(AV_PIX_FMT_YUV420P, fmt);
+    allocate_textures(fmt, video_w, video_h);
+
+    for (PixelBuffer &pbo : pbo_ring)
+        glGenBuffers(1, &pbo.id);
+}
+
+static GLenum plane_internal_format(int comps, int bytes)
+{
+    return comps == 1 ? (bytes == 1 ? GL_R8 : GL_R16) : (bytes == 1 ? GL_RG8 : GL_RG16);
+}
+
+void VideoPlayer::allocate_textures(const UploadFormat &fmt, int w, int h)
+{
+    GLuint *textures[3] = {&tex_y, &tex_u, &tex_v};
+    for (GLuint *tex : textures)
+    {
+        if (*tex)
+            glDeleteTextures(1, tex);
+        *tex = 0;
+    }
+
+#ifndef __APPLE__
+    bool immutable = GLEW_VERSION_4_2 || GLEW_ARB_texture_storage;
+#else
+    bool immutable = false;
+#endif
 
-    auto set_tex_params = []()
+    int planes = fmt.semi_planar ? 2 : 3;
+    for (int i = 0; i < planes; i++)
     {
+        int comps = (fmt.semi_planar && i == 1) ? 2 : 1;
+        int pw = i == 0 ? w : AV_CEIL_RSHIFT(w, fmt.chroma_w_shift);
+        int ph = i == 0 ? h : AV_CEIL_RSHIFT(h, fmt.chroma_h_shift);
+
+        glGenTextures(1, textures[i]);
+        glBindTexture(GL_TEXTURE_2D, *textures[i]);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    };
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+        if (immutable)
+            glTexStorage2D(GL_TEXTURE_2D, 1, plane_internal_format(comps, fmt.bytes), pw, ph);
+        else
+            glTexImage2D(GL_TEXTURE_2D, 0, plane_internal_format(comps, fmt.bytes), pw, ph, 0,
+                         comps == 1 ? GL_RED : GL_RG, fmt.bytes == 1 ? GL_UNSIGNED_BYTE : GL_UNSIGNED_SHORT, nullptr);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
 
-    glBindTexture(GL_TEXTURE_2D, tex_y);
-    set_tex_params();
-    glBindTexture(GL_TEXTURE_2D, tex_u);
-    set_tex_params();
-    glBindTexture(GL_TEXTURE_2D, tex_v);
-    set_tex_params();
-
-    glUseProgram(shader_program);
-    glUniform1i(glGetUniformLocation(shader_program, "tex_y"), 0);
-    glUniform1i(glGetUniformLocation(shader_program, "tex_u"), 1);
-    glUniform1i(glGetUniformLocation(shader_program, "tex_v"), 2);
-    glUseProgram(0);
+    tex_format = fmt;
+    tex_width = w;
+    tex_height = h;
 }
 
-void VideoPlayer::init_sdl_video()
+// Creates the window and its GL context, left current on the calling thread.
+void VideoPlayer::init_sdl_video(int width, int height)
 {
-    int video_width = video_codec_ctx->width;
-    int video_height = video_codec_ctx->height;
-
-    window = SDL_CreateWindow("OpenGL_播放器", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
-                              video_width, video_height, SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE | SDL_WINDOW_SHOWN);
+    window = SDL_CreateWindow(WINDOW_TITLE, SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
+                              width, height, SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE | SDL_WINDOW_SHOWN);
     if (!window)
         throw std::runtime_error("SDL_CreateWindow failed: " + std::string(SDL_GetError()));
 
@@ -380,22 +873,14 @@ void VideoPlayer::init_sdl_video()
     {
     }
 #endif
-
-    yuv_frame = av_frame_alloc();
-    if (!yuv_frame)
-        throw std::runtime_error("Could not allocate YUV frame.");
-    int num_bytes = av_image_get_buffer_size(AV_PIX_FMT_YUV420P, video_width, video_height, 1);
-    uint8_t *buffer = (uint8_t *)av_malloc(num_bytes * sizeof(uint8_t));
-    av_image_fill_arrays(yuv_frame->data, yuv_frame->linesize, buffer, AV_PIX_FMT_YUV420P, video_width, video_height, 1);
-
-    setup_shaders(video_width, video_height);
 }
 
 void VideoPlayer::init_sdl_audio()
 {
     SDL_AudioSpec want, have;
     SDL_memset(&want, 0, sizeof(want));
-    want.freq = audio_codec_ctx->sample_rate;
+    // A playlist keeps the device of its first entry; later entries are resampled to it.
+    want.freq = input->audio_codec_ctx ? input->audio_codec_ctx->sample_rate : 48000;
     want.format = AUDIO_S16SYS;
     want.channels = 2;
     want.silence = 0;
@@ -410,311 +895,1629 @@ void VideoPlayer::init_sdl_audio()
     }
     else
     {
-        AVChannelLayout out_ch_layout;
-        av_channel_layout_default(&out_ch_layout, 2);
-        swr_alloc_set_opts2(&swr_ctx,
-                            &out_ch_layout, AV_SAMPLE_FMT_S16, have.freq,
-                            &audio_codec_ctx->ch_layout, audio_codec_ctx->sample_fmt, audio_codec_ctx->sample_rate,
-                            0, nullptr);
-        swr_init(swr_ctx);
+        init_resampler(have.freq);
+        audio_hw_buf_size = have.size;
         SDL_PauseAudioDevice(audio_device, 0);
     }
 }
 
+// S16 stereo at out_rate; also sizes the PCM ring for the configured latency.
+void VideoPlayer::init_resampler(int out_rate)
+{
+    audio_out_rate = out_rate;
+    audio_bytes_per_sec = out_rate * 2 * av_get_bytes_per_sample(AV_SAMPLE_FMT_S16);
+    pcm_ring.reset((size_t)(audio_bytes_per_sec * options.audio_buffer_seconds));
+    time_stretch.reset(out_rate);
+    setup_resampler(*input);
+    // An entry without audio plays to silence, which is not an underrun.
+    if (!input->audio_codec_ctx)
+        pcm_ring.set_eof();
+}
+
+// Converts in's audio to the device format; leaves no resampler if it has no audio.
+void VideoPlayer::setup_resampler(const MediaInput &in)
+{
+    swr_free(&swr_ctx);
+    if (!in.audio_codec_ctx || audio_out_rate <= 0)
+        return;
+
+    AVChannelLayout out_ch_layout;
+    av_channel_layout_default(&out_ch_layout, 2);
+    if (swr_alloc_set_opts2(&swr_ctx,
+                            &out_ch_layout, AV_SAMPLE_FMT_S16, audio_out_rate,
+                            &in.audio_codec_ctx->ch_layout, in.audio_codec_ctx->sample_fmt, in.audio_codec_ctx->sample_rate,
+                            0, nullptr) < 0 ||
+        swr_init(swr_ctx) < 0)
+    {
+        std::cerr << "Failed to initialize audio resampler" << std::endl;
+        swr_free(&swr_ctx);
+    }
+}
+
 void VideoPlayer::demux_thread_entry()
 {
-    while (!quit)
+    Tracer::set_thread_name("demux");
+    AVPacket *packet = av_packet_alloc();
+    if (!packet)
     {
-        if (video_q.size() > video_q.max_size ||
-            (audio_stream_index != -1 && audio_q.size() > audio_q.max_size) ||
-            video_frame_q.queue.size() > video_frame_q.max_size ||
-            (audio_stream_index != -1 && audio_frame_q.queue.size() > audio_frame_q.max_size))
-        {
-            std::this_thread::sleep_for(std::chrono::milliseconds(10));
-            continue;
-        }
+        std::cerr << "Failed to allocate packet in demux thread" << std::endl;
+        return;
+    }
 
-        AVPacket *packet = av_packet_alloc();
-        if (av_read_frame(format_ctx, packet) < 0)
+    auto push_marker = [](PacketQueue &q, PacketPool &pool, int tag, int kind)
+    {
+        if (AVPacket *marker = pool.acquire())
         {
-            av_packet_free(&packet);
-            break;
+            marker->opaque = serial_tag(tag);
+            marker->stream_index = kind;
+            q.push(marker);
         }
+    };
 
-        if (packet->stream_index == video_stream_index)
+    std::shared_ptr<MediaInput> in = input;
+    int demux_serial = serial.load();
+    double timeline_end = in->timeline_offset; // furthest packet end read so far
+    bool eof = false;
+
+    // Queues a packet of the current input under the current serial.
+    auto route = [&](AVPacket *src)
+    {
+        PacketQueue *q = &video_q;
+        PacketPool *pool = &video_pkt_pool;
+        AVStream *stream = in->video_stream;
+        if (src->stream_index == in->audio_stream_index)
         {
-            video_q.push(packet);
+            q = &audio_q;
+            pool = &audio_pkt_pool;
+            stream = in->audio_stream;
         }
-        else if (packet->stream_index == audio_stream_index)
+        else if (src->stream_index != in->video_stream_index)
         {
-            audio_q.push(packet);
+            stats.packets_dropped.fetch_add(1, std::memory_order_relaxed);
+            av_packet_unref(src);
+            return;
         }
-        else
+        if (src->pts != AV_NOPTS_VALUE)
+            timeline_end = std::max(timeline_end, in->timeline_offset + (src->pts + std::max<int64_t>(src->duration, 0)) * av_q2d(stream->time_base));
+
+        AVPacket *pkt = pool->acquire();
+        if (!pkt)
         {
-            av_packet_free(&packet);
+            av_packet_unref(src);
+            return;
         }
-    }
-    video_q.push(nullptr);
-    if (audio_stream_index != -1)
-        audio_q.push(nullptr);
-}
-
-void VideoPlayer::video_decode_thread_entry()
-{
-    AVFrame *frame = av_frame_alloc();
-    if (!frame)
-    {
-        std::cerr << "Failed to allocate frame in video decode thread" << std::endl;
-        return;
-    }
+        av_packet_move_ref(pkt, src);
+        pkt->opaque = serial_tag(demux_serial);
+        pkt->time_base = stream->time_base;
+        q->push(pkt);
+    };
 
     while (!quit)
     {
-        AVPacket *pkt = video_q.pop();
-        if (!pkt)
-            break;
+        if (seek_pending.exchange(false))
+        {
+            SeekRequest req = current_seek();
+            if (!seek_container(*in, std::llrint((req.target - in->timeline_offset) / av_q2d(in->video_stream->time_base))))
+                std::cerr << "Seek to " << req.target << "s failed" << std::endl;
+            demux_serial = req.serial;
+            eof = false;
+        }
+        // Nothing is read while reviewing; the marker only tells the video decoder to
+        // turn to the GOP cache, so it goes out under whatever serial is current.
+        if (review_pending.exchange(false))
+            push_marker(video_q, video_pkt_pool, serial.load(std::memory_order_acquire), MARKER_REVIEW);
+
+        // Every pop releases budget and wakes us, and so does a seek; nothing to poll.
+        uint32_t key = memory_budget.space.prepare();
+        if (!seek_pending && !review_pending && (eof || demux_should_wait()))
+        {
+            memory_budget.space.wait(key);
+            continue;
+        }
+        memory_budget.space.cancel();
+        if (seek_pending || review_pending)
+            continue;
 
-        if (avcodec_send_packet(video_codec_ctx, pkt) != 0)
+        int64_t read_start = telemetry_now_us();
+        int read = av_read_frame(in->format_ctx, packet);
+        int64_t read_end = telemetry_now_us();
+        telemetry.demux_read.record(read_end - read_start);
+        if (read >= 0)
         {
-            av_packet_free(&pkt);
+            if (Tracer::enabled())
+            {
+                bool audio = packet->stream_index == in->audio_stream_index;
+                AVStream *stream = audio ? in->audio_stream : in->video_stream;
+                int64_t rebase = std::llrint(in->timeline_offset / av_q2d(stream->time_base));
+                Tracer::record(audio ? "audio" : "video", "read_packet", read_start, read_end, trace_flow(demux_serial, packet->pts, rebase));
+            }
+            stats.packets_read.fetch_add(1, std::memory_order_relaxed);
+            route(packet);
             continue;
         }
-        av_packet_free(&pkt);
 
-        while (true)
+        std::shared_ptr<MediaInput> next;
+        if (!take_next_input(next))
+            continue; // woken by a seek, pause/step or shutdown
+        if (next)
         {
-            int ret = avcodec_receive_frame(video_codec_ctx, frame);
-            if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
-                break;
-            else if (ret < 0)
+            // The next entry starts where this one's last packet ends.
+            next->timeline_offset = timeline_end - next->start_time();
             {
-                std::cerr << "Video decode error!" << std::endl;
-                break;
+                std::lock_guard<std::mutex> lock(playlist_mutex);
+                video_handoff.push_back(next);
+                if (has_audio)
+                    audio_handoff.push_back(next);
+                input = next;
             }
-            video_frame_q.push(av_frame_clone(frame));
+            push_marker(video_q, video_pkt_pool, demux_serial, MARKER_NEXT_INPUT);
+            if (has_audio)
+                push_marker(audio_q, audio_pkt_pool, demux_serial, MARKER_NEXT_INPUT);
+
+            in = next;
+            stats.discarded_stream_packets += in->discarded_stream_packets;
+            stats.discarded_stream_bytes += in->discarded_stream_bytes;
+            for (AVPacket *&p : in->warm_packets)
+            {
+                route(p);
+                av_packet_free(&p);
+            }
+            in->warm_packets.clear();
+            if (!options.bench)
+                in->start_index_build();
+            continue;
         }
-    }
 
-    avcodec_send_packet(video_codec_ctx, nullptr);
-    while (true)
-    {
-        int ret = avcodec_receive_frame(video_codec_ctx, frame);
-        if (ret != 0)
+        push_marker(video_q, video_pkt_pool, demux_serial, MARKER_END_OF_STREAM);
+        if (has_audio)
+            push_marker(audio_q, audio_pkt_pool, demux_serial, MARKER_END_OF_STREAM);
+        // Keep the thread around for a seek back, except in bench mode which ends here.
+        eof = true;
+        if (options.bench)
             break;
-        video_frame_q.push(av_frame_clone(frame));
     }
+    av_packet_free(&packet);
+    video_q.push(nullptr);
+    if (has_audio)
+        audio_q.push(nullptr);
+}
 
-    av_frame_free(&frame);
-    video_frame_q.push(nullptr);
+bool VideoPlayer::demux_should_wait()
+{
+    if (quit)
+        return false;
+    if (reviewing)
+        return true;
+    // Never hold back while the video pipeline is dry; a stalled display frees nothing.
+    if (video_q.size() == 0 && video_frame_q.size() == 0)
+        return false;
+    if (memory_budget.exceeded())
+        return true;
+    return video_q.over_budget() && (!has_audio || audio_q.over_budget());
 }
 
-void VideoPlayer::audio_decode_thread_entry()
+void VideoPlayer::video_decode_thread_entry()
 {
+    Tracer::set_thread_name("video decode");
     AVFrame *frame = av_frame_alloc();
     if (!frame)
     {
-        std::cerr << "Failed to allocate frame in audio decode thread" << std::endl;
+        std::cerr << "Failed to allocate frame in video decode thread" << std::endl;
         return;
     }
 
-    while (!quit)
-    {
-        AVPacket *pkt = audio_q.pop();
-        if (!pkt)
-            break;
+    std::shared_ptr<MediaInput> in = input;
+    int64_t rebase = 0; // in's timeline offset in its video time base
+    int decoder_serial = -1;
 
-        if (avcodec_send_packet(audio_codec_ctx, pkt) != 0)
+    // Moves a decoded frame onto the timeline and into the frame queue, unless it
+    // precedes the seek target.
+    auto emit = [&](AVFrame *f, int tag)
+    {
+        if (f->best_effort_timestamp != AV_NOPTS_VALUE)
+            f->best_effort_timestamp += rebase;
+        f->time_base = in->video_stream->time_base;
+        if (before_seek_target(f))
         {
-            av_packet_free(&pkt);
-            continue;
+            av_frame_unref(f);
+            return true;
         }
-        av_packet_free(&pkt);
-
+        AVFrame *out = video_frame_pool.acquire();
+        if (!out)
+        {
+            av_frame_unref(f);
+            return false;
+        }
+        av_frame_move_ref(out, f);
+        out->opaque = serial_tag(tag);
+        stats.skip_level_frames[frame_skip.current_level()].fetch_add(1, std::memory_order_relaxed);
+        video_frame_q.push(out);
+        return true;
+    };
+    auto receive_frames = [&]()
+    {
         while (true)
         {
-            int ret = avcodec_receive_frame(audio_codec_ctx, frame);
+            int ret;
+            {
+                TraceScope trace("video", "receive_frame");
+                ret = avcodec_receive_frame(in->video_codec_ctx, frame);
+                if (ret == 0)
+                    trace.set_flow(trace_flow(decoder_serial, frame->best_effort_timestamp, rebase));
+            }
             if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
                 break;
             else if (ret < 0)
             {
-                std::cerr << "Audio decode error!" << std::endl;
+                std::cerr << "Video decode error!" << std::endl;
                 break;
             }
-            audio_frame_q.push(av_frame_clone(frame));
+            if (in->replayed_pts != AV_NOPTS_VALUE)
+            {
+                // Went out as a pre-warmed frame before this decoder replaced the standby one.
+                if (frame->best_effort_timestamp != AV_NOPTS_VALUE && frame->best_effort_timestamp <= in->replayed_pts)
+                {
+                    av_frame_unref(frame);
+                    continue;
+                }
+                in->replayed_pts = AV_NOPTS_VALUE;
+            }
+            if (!emit(frame, decoder_serial))
+                break;
         }
-    }
+    };
 
-    avcodec_send_packet(audio_codec_ctx, nullptr);
-    while (true)
+    while (!quit)
     {
-        int ret = avcodec_receive_frame(audio_codec_ctx, frame);
-        if (ret != 0)
+        AVPacket *pkt = video_q.pop();
+        if (!pkt)
             break;
-        audio_frame_q.push(av_frame_clone(frame));
+
+        int pkt_serial = tag_serial(pkt->opaque);
+        bool current = pkt_serial == serial.load(std::memory_order_acquire);
+        int marker = pkt->data ? -1 : pkt->stream_index;
+        // A switch to the next input is followed even when stale; the demuxer has moved on.
+        if (!current && marker != MARKER_NEXT_INPUT && marker != MARKER_REVIEW)
+        {
+            stats.stale_packets.fetch_add(1, std::memory_order_relaxed);
+            video_pkt_pool.release(pkt);
+            continue;
+        }
+        if (marker == MARKER_REVIEW)
+        {
+            // Not tied to a serial: whether review is still on decides.
+            video_pkt_pool.release(pkt);
+            if (reviewing)
+                review_loop(in, rebase);
+            continue;
+        }
+        if (current && pkt_serial != decoder_serial)
+        {
+            avcodec_flush_buffers(in->video_codec_ctx);
+            in->replayed_pts = AV_NOPTS_VALUE;
+            decoder_serial = pkt_serial;
+            SeekRequest req = current_seek();
+            video_seek_target = req.serial == pkt_serial ? req.target : -1.0;
+            // Decode up to the seek target in full; the lag before the seek says nothing.
+            frame_skip.reset(in->video_codec_ctx, av_gettime_relative());
+        }
+
+        if (marker < 0)
+        {
+            if (frame_skip.update(in->video_codec_ctx, video_frame_q.size(), video_frame_q.max_size, av_gettime_relative()))
+                stats.skip_level_entries[frame_skip.current_level()].fetch_add(1, std::memory_order_relaxed);
+            int64_t decode_start = telemetry_now_us();
+            int sent = avcodec_send_packet(in->video_codec_ctx, pkt);
+            Tracer::record("video", "send_packet", decode_start, telemetry_now_us(), trace_flow(pkt_serial, pkt->pts, rebase));
+            video_pkt_pool.release(pkt);
+            if (sent == 0)
+                receive_frames();
+            telemetry.video_decode.record_since(decode_start);
+            continue;
+        }
+
+        video_pkt_pool.release(pkt);
+        if (current)
+        {
+            avcodec_send_packet(in->video_codec_ctx, nullptr);
+            receive_frames();
+        }
+        if (marker == MARKER_NEXT_INPUT)
+        {
+            // The finished input's frame threads go to the one taking over.
+            in->release_video_decoder();
+            in = take_handoff(video_handoff);
+            in->promote(video_buffer_pool);
+            rebase = std::llrint(in->timeline_offset / av_q2d(in->video_stream->time_base));
+            frame_skip.apply(in->video_codec_ctx);
+            // The pre-warmed head of the GOP goes out first; its decoder continues from there.
+            for (AVFrame *&f : in->warm_frames)
+            {
+                emit(f, pkt_serial);
+                av_frame_free(&f);
+            }
+            in->warm_frames.clear();
+        }
+        else
+        {
+            // An empty frame marks the end of the stream for this serial. The decoder is
+            // flushed so it accepts packets again after a seek back.
+            if (AVFrame *eos = video_frame_pool.acquire())
+            {
+                eos->opaque = serial_tag(decoder_serial);
+                video_frame_q.push(eos);
+            }
+            avcodec_flush_buffers(in->video_codec_ctx);
+        }
     }
 
     av_frame_free(&frame);
-    audio_frame_q.push(nullptr);
+    video_frame_q.push(nullptr);
 }
 
-void VideoPlayer::main_loop()
+// ---- Review ----
+
+// Runs on the video decode thread, in place of decoding packets, while playback is
+// paused or reversed. The cursor is the frame queued last: frame i of GOP g. Frames
+// are queued as references into the GOP cache, under the serial current at the time.
+void VideoPlayer::review_loop(const std::shared_ptr<MediaInput> &in, int64_t rebase)
 {
-    SDL_Event event;
-    while (!quit)
+    gop_cache.attach(in, options);
+    const KeyframeIndex &index = in->keyframe_index;
+    AVRational tb = in->video_stream->time_base;
+    std::shared_ptr<const GopCache::Gop> gop;
+    int g = 0, i = 0;
+
+    auto fetch = [&](int k)
+    {
+        std::shared_ptr<const GopCache::Gop> p;
+        while (reviewing && !quit && !(p = gop_cache.get(k)))
+            gop_cache.wait(20);
+        return p;
+    };
+    // Moves the cursor one frame on (dir > 0) or back; false at either end of the file.
+    auto move = [&](int dir)
     {
-        while (SDL_PollEvent(&event))
+        if (dir < 0 ? i > 0 : i + 1 < (int)gop->frames.size())
         {
-            if (event.type == SDL_QUIT)
-                quit = true;
-            else if (event.type == SDL_WINDOWEVENT && event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED)
+            i += dir;
+            return true;
+        }
+        for (int k = g + dir; k >= 0 && k < (int)index.size(); k += dir)
+        {
+            std::shared_ptr<const GopCache::Gop> p = fetch(k);
+            if (!p)
+                return false;
+            if (p->frames.empty())
+                continue;
+            gop = p;
+            g = k;
+            i = dir < 0 ? (int)p->frames.size() - 1 : 0;
+            // The next GOP in the direction of travel decodes while this one is shown.
+            gop_cache.prefetch(g + dir);
+            return true;
+        }
+        return false;
+    };
+    auto show = [&]()
+    {
+        AVFrame *out = video_frame_pool.acquire();
+        if (!out)
+            return;
+        if (av_frame_ref(out, gop->frames[i]) < 0)
+        {
+            av_frame_free(&out);
+            return;
+        }
+        if (out->best_effort_timestamp != AV_NOPTS_VALUE)
+            out->best_effort_timestamp += rebase;
+        out->time_base = tb;
+        out->opaque = serial_tag(serial.load(std::memory_order_acquire));
+        video_frame_q.push(out);
+    };
+
+    while (reviewing && !quit)
+    {
+        ReviewCommands cmd;
+        {
+            std::unique_lock<std::mutex> lock(review_mutex);
+            // GOP boundaries come from the keyframe scan, which may still be running.
+            if (index.failed())
             {
-                glViewport(0, 0, event.window.data1, event.window.data2);
+                std::cerr << "No keyframe index for " << in->filename << ": frame stepping and reverse playback are unavailable" << std::endl;
+                review_abandoned = true;
+                return;
             }
+            if (!index.ready())
+            {
+                review_cond.wait_for(lock, std::chrono::milliseconds(20));
+                continue;
+            }
+            cmd = review;
+            review.steps = 0;
+            review.resync = false;
+        }
+
+        if (cmd.resync || !gop)
+        {
+            // Frames still queued were dropped; go on from the one on screen.
+            int64_t pts = std::llrint((position - in->timeline_offset) / av_q2d(tb));
+            const KeyframeEntry *kf = index.find(pts);
+            int k = kf ? (int)(kf - index.keyframes().data()) : 0;
+            std::shared_ptr<const GopCache::Gop> p = fetch(k);
+            if (!p)
+                continue;
+            gop = p;
+            g = k;
+            i = 0;
+            for (int f = 0; f < (int)gop->frames.size(); f++)
+                if (gop->frames[f]->best_effort_timestamp <= pts)
+                    i = f;
+            gop_cache.prefetch(g - 1);
+        }
+
+        if (cmd.reverse && move(-1))
+        {
+            // Paced by the frame queue, which the renderer drains at the frames' durations.
+            show();
+            continue;
         }
-        if (quit)
+        if (!cmd.reverse && cmd.steps != 0)
+        {
+            int dir = cmd.steps > 0 ? 1 : -1;
+            bool moved = false;
+            for (int n = 0; n != cmd.steps && move(dir); n += dir)
+                moved = true;
+            if (moved)
+                show();
+            continue;
+        }
+
+        // Paused, or reversed up to the first frame: wait for the next command.
+        std::unique_lock<std::mutex> lock(review_mutex);
+        review_cond.wait_for(lock, std::chrono::milliseconds(50), [this]
+                             { return !reviewing || quit || review.resync || review.steps != 0; });
+    }
+}
+
+// Frames decoded on the way from the keyframe to the seek target are not shown.
+bool VideoPlayer::before_seek_target(const AVFrame *frame)
+{
+    if (video_seek_target < 0)
+        return false;
+    int64_t pts = frame->best_effort_timestamp;
+    if (pts != AV_NOPTS_VALUE &&
+        pts + std::max<int64_t>(frame->duration, 1) <= std::llrint(video_seek_target / av_q2d(frame->time_base)))
+        return true;
+    video_seek_target = -1.0;
+    return false;
+}
+
+void VideoPlayer::audio_decode_thread_entry()
+{
+    Tracer::set_thread_name("audio decode");
+    AVFrame *frame = av_frame_alloc();
+    if (!frame)
+    {
+        std::cerr << "Failed to allocate frame in audio decode thread" << std::endl;
+        return;
+    }
+
+    std::shared_ptr<MediaInput> in = input;
+    int64_t rebase = 0; // in's timeline offset in its audio time base
+
+    // Without an output (no device, or the resampler failed) frames are decoded and dropped
+    // so the packet queue keeps draining.
+    auto consume = [&](AVFrame *f)
+    {
+        stats.audio_samples.fetch_add(f->nb_samples, std::memory_order_relaxed);
+        if (f->best_effort_timestamp != AV_NOPTS_VALUE)
+            f->best_effort_timestamp += rebase;
+        f->time_base = in->audio_stream->time_base;
+        if (audio_seek_target >= 0 && f->best_effort_timestamp != AV_NOPTS_VALUE && f->sample_rate > 0)
+        {
+            double end = f->best_effort_timestamp * av_q2d(f->time_base) + (double)f->nb_samples / f->sample_rate;
+            if (end <= audio_seek_target)
+            {
+                av_frame_unref(f);
+                return true;
+            }
+        }
+        audio_seek_target = -1.0;
+        bool ok = !swr_ctx || resample_audio_frame(f);
+        av_frame_unref(f);
+        return ok;
+    };
+
+    int decoder_serial = -1;
+    bool running = true;
+    auto receive_frames = [&]()
+    {
+        while (running)
+        {
+            int ret;
+            {
+                TraceScope trace("audio", "receive_frame");
+                ret = avcodec_receive_frame(in->audio_codec_ctx, frame);
+                if (ret == 0)
+                    trace.set_flow(trace_flow(decoder_serial, frame->best_effort_timestamp, rebase));
+            }
+            if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
+                break;
+            else if (ret < 0)
+            {
+                std::cerr << "Audio decode error!" << std::endl;
+                break;
+            }
+            running = consume(frame);
+        }
+    };
+
+    while (running && !quit)
+    {
+        AVPacket *pkt = audio_q.pop();
+        if (!pkt)
             break;
-        render_video_frame();
+
+        int pkt_serial = tag_serial(pkt->opaque);
+        bool current = pkt_serial == serial.load(std::memory_order_acquire);
+        int marker = pkt->data ? -1 : pkt->stream_index;
+        if (!current && marker != MARKER_NEXT_INPUT)
+        {
+            stats.stale_packets.fetch_add(1, std::memory_order_relaxed);
+            audio_pkt_pool.release(pkt);
+            continue;
+        }
+        if (current && pkt_serial != decoder_serial)
+        {
+            if (in->audio_codec_ctx)
+                avcodec_flush_buffers(in->audio_codec_ctx);
+            if (swr_ctx)
+                swr_init(swr_ctx);
+            time_stretch.reset(audio_out_rate);
+            decoder_serial = pkt_serial;
+            SeekRequest req = current_seek();
+            audio_seek_target = req.serial == pkt_serial ? req.target : -1.0;
+            pcm_ring.begin_serial(pkt_serial);
+            if (!in->audio_codec_ctx)
+                pcm_ring.set_eof();
+        }
+
+        // Only inputs with audio send audio packets.
+        if (marker < 0)
+        {
+            int sent;
+            {
+                TraceScope trace("audio", "send_packet", trace_flow(pkt_serial, pkt->pts, rebase));
+                sent = avcodec_send_packet(in->audio_codec_ctx, pkt);
+            }
+            audio_pkt_pool.release(pkt);
+            if (sent == 0)
+                receive_frames();
+            continue;
+        }
+
+        audio_pkt_pool.release(pkt);
+        if (current && in->audio_codec_ctx)
+        {
+            avcodec_send_packet(in->audio_codec_ctx, nullptr);
+            receive_frames();
+        }
+        if (marker == MARKER_NEXT_INPUT)
+        {
+            in = take_handoff(audio_handoff);
+            rebase = in->audio_stream ? std::llrint(in->timeline_offset / av_q2d(in->audio_stream->time_base)) : 0;
+            setup_resampler(*in);
+            if (in->audio_codec_ctx)
+                pcm_ring.eof = false;
+            else
+                pcm_ring.set_eof();
+        }
+        else
+        {
+            // The stretcher's last few milliseconds go out unstretched.
+            int rest = 0;
+            const int16_t *tail = time_stretch.drain(rest);
+            if (current && !write_pcm(tail, rest, audio_clock, 1.0))
+                running = false;
+            pcm_ring.set_eof();
+            if (in->audio_codec_ctx)
+                avcodec_flush_buffers(in->audio_codec_ctx);
+        }
     }
+
+    av_frame_free(&frame);
+    audio_decode_done = true;
+    pcm_ring.set_eof();
 }
 
-void VideoPlayer::display_frame(AVFrame *frame)
+// ---- Playlist ----
+
+// Opens and pre-warms one entry ahead of the demuxer. Entries that fail to open are
+// skipped; the thread ends after the last entry unless the playlist loops.
+void VideoPlayer::playlist_thread_entry()
 {
-    if (!sws_ctx)
+    size_t failures = 0;
+    while (failures < playlist.size())
     {
-        sws_ctx = sws_getContext(video_codec_ctx->width, video_codec_ctx->height, video_codec_ctx->pix_fmt,
-                                 video_codec_ctx->width, video_codec_ctx->height, AV_PIX_FMT_YUV420P,
-                                 SWS_BILINEAR, nullptr, nullptr, nullptr);
+        {
+            std::unique_lock<std::mutex> lock(playlist_mutex);
+            playlist_cond.wait(lock, [this]
+                               { return quit || !next_input; });
+            if (quit)
+                return;
+        }
+        if (next_entry >= playlist.size())
+        {
+            if (!options.loop)
+                break;
+            next_entry = 0;
+        }
+
+        const std::string &file = playlist[next_entry++];
+        auto next = std::make_shared<MediaInput>();
+        try
+        {
+            next->open(file, options, video_buffer_pool, MediaInput::Role::Standby);
+            next->prewarm(options.prewarm_frames);
+        }
+        catch (const std::runtime_error &e)
+        {
+            std::cerr << "Skipping " << file << ": " << e.what() << std::endl;
+            failures++;
+            continue;
+        }
+        failures = 0;
+
+        std::lock_guard<std::mutex> lock(playlist_mutex);
+        next_input = std::move(next);
+        playlist_cond.notify_all();
     }
-    sws_scale(sws_ctx, (const uint8_t *const *)frame->data, frame->linesize, 0, video_codec_ctx->height,
-              yuv_frame->data, yuv_frame->linesize);
 
-    int w = video_codec_ctx->width, h = video_codec_ctx->height;
+    std::lock_guard<std::mutex> lock(playlist_mutex);
+    playlist_done = true;
+    playlist_cond.notify_all();
+}
 
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, tex_y);
-    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, w, h, 0, GL_RED, GL_UNSIGNED_BYTE, yuv_frame->data[0]);
+// Demux thread, at the end of an input: waits for the next entry to be ready. Returns
+// false if a seek or shutdown came first; next stays empty once the playlist is over.
+bool VideoPlayer::take_next_input(std::shared_ptr<MediaInput> &next)
+{
+    std::unique_lock<std::mutex> lock(playlist_mutex);
+    playlist_cond.wait(lock, [this]
+                       { return quit || seek_pending || review_pending || next_input || playlist_done; });
+    if (quit || seek_pending || review_pending)
+        return false;
+    next = std::move(next_input);
+    next_input.reset();
+    playlist_cond.notify_all();
+    return true;
+}
 
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, tex_u);
-    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, w / 2, h / 2, 0, GL_RED, GL_UNSIGNED_BYTE, yuv_frame->data[1]);
+std::shared_ptr<MediaInput> VideoPlayer::take_handoff(std::deque<std::shared_ptr<MediaInput>> &handoff)
+{
+    std::lock_guard<std::mutex> lock(playlist_mutex);
+    std::shared_ptr<MediaInput> next = std::move(handoff.front());
+    handoff.pop_front();
+    return next;
+}
 
-    glActiveTexture(GL_TEXTURE2);
-    glBindTexture(GL_TEXTURE_2D, tex_v);
-    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, w / 2, h / 2, 0, GL_RED, GL_UNSIGNED_BYTE, yuv_frame->data[2]);
+// ---- Mosaic ----
 
-    glClear(GL_COLOR_BUFFER_BIT);
-    glUseProgram(shader_program);
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, tex_y);
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, tex_u);
-    glActiveTexture(GL_TEXTURE2);
-    glBindTexture(GL_TEXTURE_2D, tex_v);
+MosaicTile::~MosaicTile()
+{
+    frame_pool.release(pending);
+    frames.flush();
+    av_packet_free(&packet);
+    av_frame_free(&decoded_frame);
+    if (sws_ctx)
+        sws_freeContext(sws_ctx);
+    // Buffers still referenced by frames are freed once those are released.
+    av_buffer_pool_uninit(&rgba_buffers);
+}
+
+// Largest window the grid is scaled down to fit.
+#define MOSAIC_MAX_WIDTH 1920
+#define MOSAIC_MAX_HEIGHT 1080
+
+void VideoPlayer::open_mosaic()
+{
+    for (const std::string &file : playlist)
+    {
+        auto tile = std::make_unique<MosaicTile>();
+        tile->input = std::make_shared<MediaInput>();
+        try
+        {
+            tile->input->open(file, options, video_buffer_pool);
+        }
+        catch (const std::runtime_error &e)
+        {
+            throw std::runtime_error(file + ": " + e.what());
+        }
+        tile->packet = av_packet_alloc();
+        tile->decoded_frame = av_frame_alloc();
+        if (!tile->packet || !tile->decoded_frame)
+            throw std::runtime_error("Could not allocate mosaic decode state.");
+        tiles.push_back(std::move(tile));
+    }
+    input = tiles[0]->input;
+
+    // As square a grid as possible; cells take the first input's shape, scaled down
+    // until the whole grid fits the largest window.
+    grid_cols = (int)std::ceil(std::sqrt((double)tiles.size()));
+    grid_rows = (int)((tiles.size() + grid_cols - 1) / grid_cols);
+    double w = input->video_codec_ctx->width, h = input->video_codec_ctx->height;
+    double scale = std::min(1.0, std::min(MOSAIC_MAX_WIDTH / (w * grid_cols), MOSAIC_MAX_HEIGHT / (h * grid_rows)));
+    cell_w = std::max(2, (int)(w * scale) & ~1);
+    cell_h = std::max(2, (int)(h * scale) & ~1);
+
+    int buffer_size = av_image_get_buffer_size(AV_PIX_FMT_RGBA, cell_w, cell_h, 1);
+    for (auto &tile : tiles)
+    {
+        tile->rgba_buffers = av_buffer_pool_init(buffer_size, nullptr);
+        if (!tile->rgba_buffers)
+            throw std::runtime_error("Could not allocate mosaic frame buffers.");
+    }
+}
+
+void VideoPlayer::run_mosaic()
+{
+    for (auto &tile : tiles)
+    {
+        MosaicTile *t = tile.get();
+        scheduler.add([this, t]
+                      { return mosaic_step(*t); });
+    }
+
+    if (!options.bench)
+    {
+        if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_TIMER))
+            throw std::runtime_error("SDL_Init failed: " + std::string(SDL_GetError()));
+        init_sdl_video(grid_cols * cell_w, grid_rows * cell_h);
+        setup_mosaic_gl();
+        SDL_GL_MakeCurrent(window, nullptr);
+    }
+
+    auto wall_start = std::chrono::steady_clock::now();
+    scheduler.start();
+    if (options.bench)
+        mosaic_bench_sink();
+    else
+    {
+        render_thread = std::thread(&VideoPlayer::mosaic_render_thread_entry, this);
+        main_loop();
+    }
+    quit = true;
+    mosaic_frames.notify_all();
+    scheduler.stop();
+    if (render_thread.joinable())
+        render_thread.join();
+
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+    print_mosaic_report(wall);
+}
+
+// One scheduling quantum of a tile: feeds the decoder until a frame comes out and
+// queues it scaled to the cell. Returns false to park the tile while its frame queue
+// is full (the renderer wakes it) or once its input has ended.
+bool VideoPlayer::mosaic_step(MosaicTile &tile)
+{
+    if (quit || tile.eof || tile.frames.size() >= tile.frames.max_size)
+        return false;
+
+    MediaInput &in = *tile.input;
+    AVFrame *frame = tile.decoded_frame;
+    while (true)
+    {
+        int ret = avcodec_receive_frame(in.video_codec_ctx, frame);
+        if (ret == 0)
+            break;
+        if (ret == AVERROR_EOF)
+        {
+            if (options.loop && !options.bench &&
+                av_seek_frame(in.format_ctx, in.video_stream_index, in.video_stream->start_time != AV_NOPTS_VALUE ? in.video_stream->start_time : 0, AVSEEK_FLAG_BACKWARD) >= 0)
+            {
+                avcodec_flush_buffers(in.video_codec_ctx);
+                tile.loop++;
+                continue;
+            }
+            // An empty frame tells the renderer this tile is finished.
+            tile.eof = true;
+            if (AVFrame *marker = tile.frame_pool.acquire())
+            {
+                tile.frames.push(marker);
+                mosaic_frames.notify();
+            }
+            return false;
+        }
+        if (ret != AVERROR(EAGAIN))
+            std::cerr << "Video decode error in " << in.filename << std::endl;
+
+        if (av_read_frame(in.format_ctx, tile.packet) < 0)
+        {
+            avcodec_send_packet(in.video_codec_ctx, nullptr);
+            continue;
+        }
+        if (tile.packet->stream_index == in.video_stream_index)
+            avcodec_send_packet(in.video_codec_ctx, tile.packet);
+        av_packet_unref(tile.packet);
+    }
+    tile.decoded.fetch_add(1, std::memory_order_relaxed);
+
+    AVFrame *out = tile.frame_pool.acquire();
+    if (!out)
+    {
+        av_frame_unref(frame);
+        return true;
+    }
+    out->buf[0] = av_buffer_pool_get(tile.rgba_buffers);
+    SwsContext *prev = tile.sws_ctx;
+    tile.sws_ctx = sws_getCachedContext(tile.sws_ctx, frame->width, frame->height, static_cast<AVPixelFormat>(frame->format),
+                                        cell_w, cell_h, AV_PIX_FMT_RGBA, SWS_BILINEAR, nullptr, nullptr, nullptr);
+    if (!out->buf[0] || !tile.sws_ctx)
+    {
+        // Only the renderer returns frames to the pool.
+        av_frame_free(&out);
+        av_frame_unref(frame);
+        return true;
+    }
+
+    if (tile.sws_ctx != prev)
+        tile.sws_colorspace = tile.sws_range = -1;
+    set_sws_source_colorspace(tile.sws_ctx, frame, tile.sws_colorspace, tile.sws_range);
+
+    av_image_fill_arrays(out->data, out->linesize, out->buf[0]->data, AV_PIX_FMT_RGBA, cell_w, cell_h, 1);
+    sws_scale(tile.sws_ctx, (const uint8_t *const *)frame->data, frame->linesize, 0, frame->height,
+              out->data, out->linesize);
+    out->width = cell_w;
+    out->height = cell_h;
+    out->format = AV_PIX_FMT_RGBA;
+    out->best_effort_timestamp = frame->best_effort_timestamp;
+    out->duration = frame->duration;
+    out->time_base = in.video_stream->time_base;
+    out->opaque = serial_tag(tile.loop);
+    av_frame_unref(frame);
+    tile.frames.push(out);
+    mosaic_frames.notify();
+    return true;
+}
+
+void VideoPlayer::setup_mosaic_gl()
+{
+    // A unit quad drawn once per tile; the instance picks the cell and the layer.
+    const char *vertex_shader_src = R"(
+        #version 330 core
+        layout(location = 0) in vec2 aPos;
+        uniform ivec2 grid;
+        out vec3 TexCoord;
+        void main()
+        {
+            vec2 cell = vec2(gl_InstanceID % grid.x, gl_InstanceID / grid.x);
+            vec2 p = (cell + aPos) / vec2(grid);
+            gl_Position = vec4(p.x * 2.0 - 1.0, 1.0 - p.y * 2.0, 0.0, 1.0);
+            TexCoord = vec3(aPos, float(gl_InstanceID));
+        }
+    )";
+    const char *fragment_shader_src = R"(
+        #version 330 core
+        in vec3 TexCoord;
+        out vec4 FragColor;
+        uniform sampler2DArray tiles;
+        void main()
+        {
+            FragColor = vec4(texture(tiles, TexCoord).rgb, 1.0);
+        }
+    )";
+
+    GLuint vs = compile_shader(GL_VERTEX_SHADER, vertex_shader_src);
+    GLuint fs = compile_shader(GL_FRAGMENT_SHADER, fragment_shader_src);
+    mosaic_program = link_program(vs, fs);
+    glDeleteShader(vs);
+    glDeleteShader(fs);
+    glUseProgram(mosaic_program);
+    glUniform1i(glGetUniformLocation(mosaic_program, "tiles"), 0);
+    mosaic_loc_grid = glGetUniformLocation(mosaic_program, "grid");
+    glUseProgram(0);
+
+    float quad[] = {0.0f, 0.0f, 0.0f, 1.0f, 1.0f, 0.0f, 1.0f, 1.0f};
+    glGenVertexArrays(1, &vao);
+    glGenBuffers(1, &vbo);
     glBindVertexArray(vao);
-    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(quad), quad, GL_STATIC_DRAW);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void *)0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
     glBindVertexArray(0);
-    glUseProgram(0);
-    SDL_GL_SwapWindow(window);
+
+    // Cells stay black until their input's first frame arrives.
+    std::vector<uint8_t> black((size_t)cell_w * cell_h * 4, 0);
+    glGenTextures(1, &mosaic_textures);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, mosaic_textures);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, 0);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, cell_w, cell_h, (GLsizei)tiles.size(), 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    for (size_t i = 0; i < tiles.size(); i++)
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, (GLint)i, cell_w, cell_h, 1, GL_RGBA, GL_UNSIGNED_BYTE, black.data());
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
 }
 
-void VideoPlayer::audio_callback(void *userdata, Uint8 *stream, int len)
+void VideoPlayer::mosaic_render_thread_entry()
 {
-    VideoPlayer *player = static_cast<VideoPlayer *>(userdata);
-    SDL_memset(stream, 0, len);
-
-    while (len > 0)
+    SDL_GL_MakeCurrent(window, gl_context);
+    size_t finished = 0;
+    bool redraw = true;
+    while (!quit && finished < tiles.size())
     {
-        if (player->quit)
-            return;
+        if (viewport_dirty.exchange(false))
+        {
+            glViewport(0, 0, viewport_w.load(), viewport_h.load());
+            redraw = true;
+        }
 
-        if (player->audio_buf_index >= player->audio_buf_size)
+        double now = (double)av_gettime_relative() / 1000000.0;
+        double next_due = -1.0; // earliest due time of a frame held back, -1: none
+        glBindTexture(GL_TEXTURE_2D_ARRAY, mosaic_textures);
+        for (size_t i = 0; i < tiles.size(); i++)
         {
-            int audio_size = player->resample_audio_frame();
-            if (audio_size < 0)
+            MosaicTile &tile = *tiles[i];
+            AVFrame *show = nullptr;
+            bool popped = false;
+            while (!tile.done && (tile.pending || tile.frames.try_pop(tile.pending)))
+            {
+                popped = true;
+                AVFrame *f = tile.pending;
+                if (!f->buf[0])
+                {
+                    // The last frame stays up.
+                    tile.done = true;
+                    finished++;
+                    tile.frame_pool.release(f);
+                    tile.pending = nullptr;
+                    break;
+                }
+                double pts = f->best_effort_timestamp != AV_NOPTS_VALUE ? f->best_effort_timestamp * av_q2d(f->time_base) : 0.0;
+                int loop = tag_serial(f->opaque);
+                if (loop != tile.shown_loop || f->best_effort_timestamp == AV_NOPTS_VALUE)
+                {
+                    tile.shown_loop = loop;
+                    tile.clock_base = now;
+                    tile.pts_base = pts;
+                }
+                double due = tile.clock_base + (pts - tile.pts_base);
+                if (due > now)
+                {
+                    if (next_due < 0 || due < next_due)
+                        next_due = due;
+                    break;
+                }
+                if (show)
+                {
+                    tile.frame_pool.release(show);
+                    tile.late++;
+                }
+                show = f;
+                tile.pending = nullptr;
+            }
+            if (show)
             {
-                player->audio_buf_size = 1024;
-                memset(player->audio_buf, 0, player->audio_buf_size);
+                glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, (GLint)i, show->width, show->height, 1,
+                                GL_RGBA, GL_UNSIGNED_BYTE, show->data[0]);
+                tile.frame_pool.release(show);
+                tile.shown++;
+                redraw = true;
             }
+            if (popped)
+                scheduler.wake(i);
+        }
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+        if (!redraw)
+        {
+            // Nothing new to show: sleep until the next held-back frame is due or a
+            // decoder queues one for a tile that has none waiting.
+            uint32_t key = mosaic_frames.prepare();
+            bool queued = false;
+            for (const auto &t : tiles)
+                queued |= !t->done && !t->pending && t->frames.size() > 0;
+            if (queued || quit || viewport_dirty)
+                mosaic_frames.cancel();
+            else if (next_due >= 0)
+                mosaic_frames.wait_for(key, std::max<int64_t>(0, std::llrint((next_due - now) * 1000000.0)));
             else
+                mosaic_frames.wait(key);
+            continue;
+        }
+        redraw = false;
+        glClear(GL_COLOR_BUFFER_BIT);
+        glUseProgram(mosaic_program);
+        glUniform2i(mosaic_loc_grid, grid_cols, grid_rows);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, mosaic_textures);
+        glBindVertexArray(vao);
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, (GLsizei)tiles.size());
+        glBindVertexArray(0);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+        glUseProgram(0);
+        SDL_GL_SwapWindow(window);
+    }
+    SDL_GL_MakeCurrent(window, nullptr);
+
+    // Wake the event loop in case every input ended on its own.
+    SDL_Event event;
+    SDL_memset(&event, 0, sizeof(event));
+    event.type = SDL_QUIT;
+    SDL_PushEvent(&event);
+}
+
+// Bench mode: takes every frame as soon as it is queued.
+void VideoPlayer::mosaic_bench_sink()
+{
+    size_t finished = 0;
+    while (!quit && finished < tiles.size())
+    {
+        bool any = false;
+        for (size_t i = 0; i < tiles.size(); i++)
+        {
+            MosaicTile &tile = *tiles[i];
+            bool popped = false;
+            AVFrame *f;
+            while (!tile.done && tile.frames.try_pop(f))
             {
-                player->audio_buf_size = audio_size;
+                popped = true;
+                if (!f->buf[0])
+                {
+                    tile.done = true;
+                    finished++;
+                }
+                else
+                    tile.shown++;
+                tile.frame_pool.release(f);
             }
-            player->audio_buf_index = 0;
+            if (popped)
+                scheduler.wake(i);
+            any |= popped;
         }
+        if (any)
+            continue;
+        uint32_t key = mosaic_frames.prepare();
+        bool queued = false;
+        for (const auto &t : tiles)
+            queued |= !t->done && t->frames.size() > 0;
+        if (queued || quit)
+            mosaic_frames.cancel();
+        else
+            mosaic_frames.wait(key);
+    }
+}
+
+void VideoPlayer::print_mosaic_report(double wall_seconds)
+{
+    auto fps = [wall_seconds](uint64_t n)
+    { return wall_seconds > 0 ? n / wall_seconds : 0.0; };
+
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "Mosaic: " << tiles.size() << " inputs in a " << grid_cols << "x" << grid_rows << " grid of "
+              << cell_w << "x" << cell_h << " cells, " << scheduler.worker_count() << " decode workers, "
+              << wall_seconds << " s" << std::endl;
+    uint64_t total = 0;
+    for (size_t i = 0; i < tiles.size(); i++)
+    {
+        const MosaicTile &tile = *tiles[i];
+        uint64_t decoded = tile.decoded.load();
+        total += decoded;
+        std::cout << "  [" << i << "] " << tile.input->filename << ": " << decoded << " frames decoded ("
+                  << fps(decoded) << " fps), " << tile.shown << " shown, " << tile.late << " skipped late" << std::endl;
+    }
+    std::cout << "  total " << total << " frames decoded (" << fps(total) << " fps)" << std::endl;
+}
+
+void VideoPlayer::run_bench()
+{
+    auto wall_start = std::chrono::steady_clock::now();
+
+    demux_thread = std::thread([this]
+                               { ScopedStageTimer t(stats.demux); demux_thread_entry(); });
+    video_decode_thread = std::thread([this]
+                                      { ScopedStageTimer t(stats.video_decode); video_decode_thread_entry(); });
+    if (has_audio)
+    {
+        // Resample at the source rate so the conversion cost is part of the measurement.
+        init_resampler(input->audio_codec_ctx ? input->audio_codec_ctx->sample_rate : 48000);
+        audio_decode_thread = std::thread([this]
+                                          { ScopedStageTimer t(stats.audio_decode); audio_decode_thread_entry(); });
+        audio_sink_thread = std::thread(&VideoPlayer::bench_audio_sink, this);
+    }
+    if (!playlist_done)
+        playlist_thread = std::thread(&VideoPlayer::playlist_thread_entry, this);
+
+    {
+        ScopedStageTimer t(stats.video_sink);
+        while (AVFrame *frame = video_frame_q.pop())
+        {
+            if (frame->buf[0])
+                stats.video_frames.fetch_add(1, std::memory_order_relaxed);
+            video_frame_pool.release(frame);
+        }
+    }
+
+    if (demux_thread.joinable())
+        demux_thread.join();
+    if (video_decode_thread.joinable())
+        video_decode_thread.join();
+    if (audio_decode_thread.joinable())
+        audio_decode_thread.join();
+    if (audio_sink_thread.joinable())
+        audio_sink_thread.join();
+    if (playlist_thread.joinable())
+        playlist_thread.join();
+
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+    print_bench_report(wall);
+}
+
+void VideoPlayer::bench_audio_sink()
+{
+    ScopedStageTimer t(stats.audio_sink);
+    uint8_t buf[4096];
+    while (!quit)
+    {
+        if (pcm_ring.read(buf, sizeof(buf)) > 0)
+            continue;
+        if (pcm_ring.eof && pcm_ring.fill() == 0)
+        {
+            if (audio_decode_done)
+                break;
+            // A playlist entry without audio; more may follow.
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            continue;
+        }
+        pcm_ring.wait_readable();
+    }
+}
 
-        int len_to_copy = player->audio_buf_size - player->audio_buf_index;
-        if (len_to_copy > len)
-            len_to_copy = len;
+void VideoPlayer::print_bench_report(double wall_seconds)
+{
+    auto rate = [wall_seconds](uint64_t n)
+    { return wall_seconds > 0 ? n / wall_seconds : 0.0; };
+    auto stage = [](const char *name, const StageStats &s)
+    {
+        double cpu_pct = s.wall_seconds > 0 ? 100.0 * s.cpu_seconds / s.wall_seconds : 0.0;
+        std::cout << "  " << std::left << std::setw(14) << name << std::right
+                  << std::setw(10) << s.wall_seconds
+                  << std::setw(10) << s.cpu_seconds
+                  << std::setw(9) << cpu_pct << "%" << std::endl;
+    };
+
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout << "Benchmark: " << (playlist.size() > 1 ? std::to_string(playlist.size()) + " playlist entries" : input->filename) << std::endl;
+    std::cout << "  wall time      " << wall_seconds << " s" << std::endl;
+    std::cout << "  packets read   " << stats.packets_read.load() << " (" << stats.packets_dropped.load() << " from unused streams)" << std::endl;
+    if (input->format_ctx->pb)
+        std::cout << "  io bytes read  " << input->format_ctx->pb->bytes_read << std::endl;
+    if (input->uses_readahead())
+        print_readahead_stats(*input);
+    std::cout << "  discarded      " << input->format_ctx->nb_streams - 1 - (input->audio_stream_index != -1) << " streams, ~"
+              << stats.discarded_stream_packets << " packets / " << stats.discarded_stream_bytes << " bytes not read" << std::endl;
+    std::cout << "  packet structs video " << video_pkt_pool.allocated.load() << " allocated, "
+              << video_pkt_pool.reused.load() << " reused";
+    if (has_audio)
+        std::cout << "; audio " << audio_pkt_pool.allocated.load() << " allocated, "
+                  << audio_pkt_pool.reused.load() << " reused";
+    std::cout << std::endl;
+    std::cout << "  video frames   " << stats.video_frames.load() << " (" << rate(stats.video_frames.load()) << " frames/s)" << std::endl;
+    if (has_audio)
+        std::cout << "  audio samples  " << stats.audio_samples.load() << " (" << rate(stats.audio_samples.load()) << " samples/s)" << std::endl;
+
+    std::cout << "  stage            wall(s)    cpu(s)     cpu%" << std::endl;
+    stage("demux", stats.demux);
+    stage("video decode", stats.video_decode);
+    stage("video sink", stats.video_sink);
+    if (has_audio)
+    {
+        stage("audio decode", stats.audio_decode);
+        stage("audio sink", stats.audio_sink);
+    }
+
+    std::cout << "  frame structs  video " << video_frame_pool.allocated.load() << " allocated, "
+              << video_frame_pool.reused.load() << " reused" << std::endl;
+
+    auto depth = [](const char *name, size_t peak, size_t max_size, int64_t peak_bytes)
+    {
+        std::cout << "    " << std::left << std::setw(15) << name << std::right
+                  << peak << "/" << max_size << " items, " << peak_bytes / 1048576.0 << " MB" << std::endl;
+    };
+    std::cout << "  peak queue depth" << std::endl;
+    depth("video_q", video_q.peak, video_q.max_size, video_q.peak_bytes);
+    depth("video_frame_q", video_frame_q.peak, video_frame_q.max_size, video_frame_q.peak_bytes);
+    if (has_audio)
+    {
+        depth("audio_q", audio_q.peak, audio_q.max_size, audio_q.peak_bytes);
+        std::cout << "    " << std::left << std::setw(15) << "pcm ring" << std::right
+                  << pcm_ring.capacity() / 1024.0 << " KB" << std::endl;
+    }
+}
+
+void VideoPlayer::print_readahead_stats(MediaInput &in)
+{
+    ReadAheadStats io = in.readahead_stats();
+    double mb = 1048576.0;
+    std::cout << "  read-ahead     " << io.fill / mb << "/" << io.capacity / mb << " MB buffered, "
+              << io.bytes_fetched / mb << " MB fetched at "
+              << (io.fetch_seconds > 0 ? io.bytes_fetched / mb / io.fetch_seconds : 0.0) << " MB/s, "
+              << io.stalls << " stalls (" << io.stall_seconds << " s), seeks "
+              << io.seeks_in_buffer << " in buffer / " << io.seeks_refetch << " refetched" << std::endl;
+}
+
+void VideoPlayer::main_loop()
+{
+    // The event thread never touches the frame queue or GL; it only blocks in SDL.
+    SDL_Event event;
+    while (!quit)
+    {
+        // Review mode the decoder had to give up ends here, on the thread that owns the window.
+        if (review_abandoned.exchange(false) && reviewing)
+            seek(position);
+        if (!SDL_WaitEventTimeout(&event, 100))
+            continue;
+        do
+        {
+            if (event.type == SDL_QUIT)
+                quit = true;
+            else if (event.type == SDL_WINDOWEVENT && event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED)
+            {
+                viewport_w = event.window.data1;
+                viewport_h = event.window.data2;
+                viewport_dirty = true;
+                mosaic_frames.notify_all();
+            }
+            else if (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_LEFT)
+                seek(position - 5.0);
+            else if (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_RIGHT)
+                seek(position + 5.0);
+            else if (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_LEFTBRACKET)
+                step_speed(-1);
+            else if (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_RIGHTBRACKET)
+                step_speed(1);
+            else if (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_SPACE)
+                toggle_pause();
+            else if (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_r)
+                toggle_reverse();
+            else if (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_COMMA)
+                step_frame(-1);
+            else if (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_PERIOD)
+                step_frame(1);
+        } while (SDL_PollEvent(&event));
+    }
+}
+
+// Row-major YUV->RGB matrix and offset for the frame's colorspace and range.
+static void yuv_to_rgb(AVColorSpace colorspace, bool full_range, int height, float matrix[9], float offset[3])
+{
+    double kr, kb;
+    switch (colorspace)
+    {
+    case AVCOL_SPC_BT709:
+        kr = 0.2126, kb = 0.0722;
+        break;
+    case AVCOL_SPC_BT2020_NCL:
+    case AVCOL_SPC_BT2020_CL:
+        kr = 0.2627, kb = 0.0593;
+        break;
+    case AVCOL_SPC_SMPTE240M:
+        kr = 0.212, kb = 0.087;
+        break;
+    case AVCOL_SPC_BT470BG:
+    case AVCOL_SPC_SMPTE170M:
+    case AVCOL_SPC_FCC:
+        kr = 0.299, kb = 0.114;
+        break;
+    default:
+        // Untagged: HD and larger is almost always BT.709, SD is BT.601.
+        if (height >= 720)
+            kr = 0.2126, kb = 0.0722;
+        else
+            kr = 0.299, kb = 0.114;
+        break;
+    }
+    double kg = 1.0 - kr - kb;
+    double ys = full_range ? 1.0 : 255.0 / 219.0;
+    double cs = full_range ? 1.0 : 255.0 / 224.0;
+
+    const double m[9] = {
+        ys, 0.0, cs * 2.0 * (1.0 - kr),
+        ys, -cs * 2.0 * (1.0 - kb) * kb / kg, -cs * 2.0 * (1.0 - kr) * kr / kg,
+        ys, cs * 2.0 * (1.0 - kb), 0.0};
+    for (int i = 0; i < 9; i++)
+        matrix[i] = static_cast<float>(m[i]);
+    offset[0] = full_range ? 0.0f : 16.0f / 255.0f;
+    offset[1] = offset[2] = 128.0f / 255.0f;
+}
+
+static void upload_plane(GLenum unit, GLuint tex, size_t pbo_offset, int linesize, int w, int h, int comps, int bytes)
+{
+    glActiveTexture(unit);
+    glBindTexture(GL_TEXTURE_2D, tex);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, linesize / (comps * bytes));
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, w, h, comps == 1 ? GL_RED : GL_RG,
+                    bytes == 1 ? GL_UNSIGNED_BYTE : GL_UNSIGNED_SHORT, reinterpret_cast<const void *>(pbo_offset));
+}
+
+AVFrame *VideoPlayer::convert_frame(AVFrame *frame)
+{
+    if (!yuv_frame)
+        yuv_frame = av_frame_alloc();
+    if (!yuv_frame)
+        return nullptr;
+    if (yuv_frame->width != frame->width || yuv_frame->height != frame->height)
+    {
+        av_freep(&yuv_frame->data[0]);
+        if (av_image_alloc(yuv_frame->data, yuv_frame->linesize, frame->width, frame->height, AV_PIX_FMT_YUV420P, 32) < 0)
+            return nullptr;
+        yuv_frame->width = frame->width;
+        yuv_frame->height = frame->height;
+        yuv_frame->format = AV_PIX_FMT_YUV420P;
+    }
+
+    sws_ctx = sws_getCachedContext(sws_ctx, frame->width, frame->height, static_cast<AVPixelFormat>(frame->format),
+                                   frame->width, frame->height, AV_PIX_FMT_YUV420P,
+                                   SWS_BILINEAR, nullptr, nullptr, nullptr);
+    if (!sws_ctx)
+        return nullptr;
+    sws_scale(sws_ctx, (const uint8_t *const *)frame->data, frame->linesize, 0, frame->height,
+              yuv_frame->data, yuv_frame->linesize);
+
+    // swscale keeps the YUV coefficients of YUV sources and writes BT.601 for RGB ones,
+    // always in limited range.
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(static_cast<AVPixelFormat>(frame->format));
+    yuv_frame->colorspace = (desc && (desc->flags & AV_PIX_FMT_FLAG_RGB)) ? AVCOL_SPC_SMPTE170M : frame->colorspace;
+    yuv_frame->color_range = AVCOL_RANGE_MPEG;
+    return yuv_frame;
+}
 
-        SDL_MixAudioFormat(stream, player->audio_buf + player->audio_buf_index, AUDIO_S16SYS, len_to_copy, SDL_MIX_MAXVOLUME);
+void VideoPlayer::display_frame(AVFrame *frame)
+{
+    int64_t flow = trace_flow(tag_serial(frame->opaque), frame->best_effort_timestamp, 0);
+    UploadFormat fmt;
+    if (!describe_upload(frame->format, fmt) || frame->linesize[0] < 0 || frame->linesize[1] < 0)
+    {
+        int64_t convert_start = telemetry_now_us();
+        frame = convert_frame(frame);
+        int64_t convert_end = telemetry_now_us();
+        telemetry.display_convert.record(convert_end - convert_start);
+        Tracer::record("video", "convert", convert_start, convert_end, flow);
+        if (!frame || !describe_upload(frame->format, fmt))
+            return;
+    }
+    int64_t upload_start = telemetry_now_us();
+
+    int w = frame->width, h = frame->height;
+    int cw = AV_CEIL_RSHIFT(w, fmt.chroma_w_shift), ch = AV_CEIL_RSHIFT(h, fmt.chroma_h_shift);
+    if (w != tex_width || h != tex_height || fmt.semi_planar != tex_format.semi_planar ||
+        fmt.bytes != tex_format.bytes || fmt.chroma_w_shift != tex_format.chroma_w_shift ||
+        fmt.chroma_h_shift != tex_format.chroma_h_shift)
+        allocate_textures(fmt, w, h);
+
+    // Stage the planes in the next buffer of the PBO ring; the GPU may still be
+    // pulling the previous frames out of the other buffers.
+    int planes = fmt.semi_planar ? 2 : 3;
+    int rows[3] = {h, ch, ch};
+    size_t offsets[3] = {0, 0, 0};
+    size_t total = 0;
+    for (int i = 0; i < planes; i++)
+    {
+        offsets[i] = total;
+        total += (size_t)frame->linesize[i] * rows[i];
+    }
+
+    PixelBuffer &pbo = pbo_ring[pbo_index];
+    pbo_index = (pbo_index + 1) % PBO_COUNT;
+    // If the GPU has not finished reading this buffer yet, orphan its storage so
+    // the unsynchronized map below cannot write over data still being uploaded.
+    bool orphan = false;
+    if (pbo.fence)
+    {
+        GLenum waited = glClientWaitSync(pbo.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 100000000);
+        orphan = waited == GL_TIMEOUT_EXPIRED || waited == GL_WAIT_FAILED;
+        glDeleteSync(pbo.fence);
+        pbo.fence = nullptr;
+    }
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo.id);
+    if (pbo.size < total || orphan)
+    {
+        pbo.size = std::max(pbo.size, total);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, pbo.size, nullptr, GL_STREAM_DRAW);
+    }
+    uint8_t *dst = static_cast<uint8_t *>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, total,
+                                                           GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT));
+    if (!dst)
+    {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        return;
+    }
+    for (int i = 0; i < planes; i++)
+        memcpy(dst + offsets[i], frame->data[i], (size_t)frame->linesize[i] * rows[i]);
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
 
-        len -= len_to_copy;
-        stream += len_to_copy;
-        player->audio_buf_index += len_to_copy;
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    upload_plane(GL_TEXTURE0, tex_y, offsets[0], frame->linesize[0], w, h, 1, fmt.bytes);
+    if (fmt.semi_planar)
+    {
+        upload_plane(GL_TEXTURE1, tex_u, offsets[1], frame->linesize[1], cw, ch, 2, fmt.bytes);
     }
+    else
+    {
+        upload_plane(GL_TEXTURE1, tex_u, offsets[1], frame->linesize[1], cw, ch, 1, fmt.bytes);
+        upload_plane(GL_TEXTURE2, tex_v, offsets[2], frame->linesize[2], cw, ch, 1, fmt.bytes);
+    }
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    pbo.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    int64_t upload_end = telemetry_now_us();
+    telemetry.display_upload.record(upload_end - upload_start);
+    Tracer::record("video", "upload", upload_start, upload_end, flow);
+
+    bool full_range = frame->color_range == AVCOL_RANGE_JPEG ||
+                      frame->format == AV_PIX_FMT_YUVJ420P || frame->format == AV_PIX_FMT_YUVJ422P ||
+                      frame->format == AV_PIX_FMT_YUVJ444P;
+    float matrix[9], offset[3];
+    yuv_to_rgb(frame->colorspace, full_range, h, matrix, offset);
+
+    int64_t draw_start = telemetry_now_us();
+    const ShaderVariant &shader = fmt.semi_planar ? semi_planar_shader : planar_shader;
+    glClear(GL_COLOR_BUFFER_BIT);
+    glUseProgram(shader.program);
+    glUniformMatrix3fv(shader.loc_matrix, 1, GL_TRUE, matrix);
+    glUniform3fv(shader.loc_offset, 1, offset);
+    glUniform1f(shader.loc_scale, fmt.sample_scale);
+    glBindVertexArray(vao);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    glBindVertexArray(0);
+    glUseProgram(0);
+    int64_t swap_start = telemetry_now_us();
+    telemetry.display_draw.record(swap_start - draw_start);
+    Tracer::record("video", "draw", draw_start, swap_start, flow);
+    SDL_GL_SwapWindow(window);
+    int64_t swap_end = telemetry_now_us();
+    telemetry.display_swap.record(swap_end - swap_start);
+    Tracer::record("video", "swap", swap_start, swap_end, flow);
 }
 
-double VideoPlayer::get_audio_clock()
+void VideoPlayer::audio_callback(void *userdata, Uint8 *stream, int len)
 {
-    if (audio_stream_index == -1)
-        return (double)av_gettime() / 1000000.0;
+    // Runs on SDL's audio thread: no locks, no allocation, no decoding. Only copy what
+    // the decode thread has already resampled and pad with silence if it fell behind.
+    VideoPlayer *player = static_cast<VideoPlayer *>(userdata);
+    PcmRing &ring = player->pcm_ring;
+    int64_t callback_time = av_gettime_relative();
+    int64_t callback_start = telemetry_now_us();
+    auto done = [player, callback_start]()
+    {
+        int64_t end = telemetry_now_us();
+        player->telemetry.audio_callback.record(end - callback_start);
+        Tracer::record("audio", "audio_callback", callback_start, end);
+    };
+    if (Tracer::enabled())
+        Tracer::set_thread_name("audio callback");
 
-    std::lock_guard<std::mutex> lock(audio_clock_mutex);
-    double pts = audio_clock;
-    int hw_buf_size = audio_buf_size - audio_buf_index;
-    int bytes_per_sec = 0;
-    if (audio_stream)
+    size_t got = player->quit ? 0 : ring.read(stream, len);
+    if (got < (size_t)len)
     {
-        bytes_per_sec = audio_codec_ctx->sample_rate * 2 * av_get_bytes_per_sample(AV_SAMPLE_FMT_S16);
+        SDL_memset(stream + got, 0, len - got);
+        if (!ring.eof && !ring.stale() && !player->quit && ring.write_position() > 0)
+            player->stats.audio_underruns.fetch_add(1, std::memory_order_relaxed);
     }
-    if (bytes_per_sec > 0)
+
+    // Until audio of the current serial arrives, or while none is coming, there is no
+    // master clock and video runs on its own timer.
+    if (ring.stale() || (ring.eof && got == 0))
     {
-        pts -= (double)hw_buf_size / bytes_per_sec;
+        player->master_clock.reset();
+        done();
+        return;
     }
-    return pts;
+
+    // What is audible right now: the stream time of the byte behind the ring's read
+    // position by the buffer just filled and the one the device is playing. Queued
+    // bytes may belong to different playback speeds; the ring knows each one's.
+    double heard_pts, rate;
+    int64_t heard = (int64_t)ring.read_position() - (int64_t)got - player->audio_hw_buf_size;
+    if (player->audio_bytes_per_sec > 0 && ring.pts_at(heard, player->audio_bytes_per_sec, heard_pts, rate))
+        player->master_clock.publish(heard_pts, callback_time, rate);
+    done();
+}
+
+bool VideoPlayer::get_audio_clock(double &pts)
+{
+    if (!audio_device)
+        return false;
+    return master_clock.read(av_gettime_relative(), pts);
 }
 
 void VideoPlayer::cleanup()
 {
     quit = true;
 
+    memory_budget.space.notify_all();
+    {
+        std::lock_guard<std::mutex> lock(render_mutex);
+    }
+    render_cond.notify_all();
+    {
+        std::lock_guard<std::mutex> lock(playlist_mutex);
+    }
+    playlist_cond.notify_all();
+    {
+        std::lock_guard<std::mutex> lock(review_mutex);
+    }
+    review_cond.notify_all();
     audio_q.abort();
     video_q.abort();
     video_frame_q.abort();
-    if (audio_stream_index != -1)
-        audio_frame_q.abort();
+    pcm_ring.abort();
 
+    if (render_thread.joinable())
+        render_thread.join();
     if (demux_thread.joinable())
         demux_thread.join();
     if (video_decode_thread.joinable())
         video_decode_thread.join();
     if (audio_decode_thread.joinable())
         audio_decode_thread.join();
+    if (audio_sink_thread.joinable())
+        audio_sink_thread.join();
+    if (playlist_thread.joinable())
+        playlist_thread.join();
+    scheduler.stop();
+    gop_cache.stop();
+    telemetry_exporter.stop();
 
     audio_q.flush();
     video_q.flush();
     video_frame_q.flush();
-    if (audio_stream_index != -1)
-        audio_frame_q.flush();
 
     if (audio_device)
         SDL_CloseAudioDevice(audio_device);
 
+    if (Tracer::enabled())
+    {
+        if (Tracer::write_chrome_json(options.trace_path))
+            std::cerr << "Trace written to " << options.trace_path << std::endl;
+        else
+            std::cerr << "Could not write trace to " << options.trace_path << std::endl;
+    }
+
     if (yuv_frame)
     {
         av_freep(&yuv_frame->data[0]);
         av_frame_free(&yuv_frame);
     }
 
-    if (shader_program)
-        glDeleteProgram(shader_program);
+    if (gl_context)
+        SDL_GL_MakeCurrent(window, gl_context);
+    if (planar_shader.program)
+        glDeleteProgram(planar_shader.program);
+    if (semi_planar_shader.program)
+        glDeleteProgram(semi_planar_shader.program);
     if (vao)
         glDeleteVertexArrays(1, &vao);
     if (vbo)
         glDeleteBuffers(1, &vbo);
+    if (mosaic_program)
+        glDeleteProgram(mosaic_program);
+    if (mosaic_textures)
+        glDeleteTextures(1, &mosaic_textures);
+    for (PixelBuffer &pbo : pbo_ring)
+    {
+        if (pbo.fence)
+            glDeleteSync(pbo.fence);
+        if (pbo.id)
+            glDeleteBuffers(1, &pbo.id);
+    }
     if (tex_y)
         glDeleteTextures(1, &tex_y);
     if (tex_u)
@@ -732,10 +2535,9 @@ void VideoPlayer::cleanup()
         sws_freeContext(sws_ctx);
     if (swr_ctx)
         swr_free(&swr_ctx);
-    if (video_codec_ctx)
-        avcodec_free_context(&video_codec_ctx);
-    if (audio_codec_ctx)
-        avcodec_free_context(&audio_codec_ctx);
-    if (format_ctx)
-        avformat_close_input(&format_ctx);
+    tiles.clear();
+    video_handoff.clear();
+    audio_handoff.clear();
+    next_input.reset();
+    input.reset();
 }
\ No newline at end of file
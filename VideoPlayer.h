@@ -2,69 +2,208 @@
 #pragma once
 
 #include <string>
+#include <vector>
 #include <thread>
 #include <atomic>
 #include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include "player_options.h"
 #include "queue.h"
+#include "pool.h"
+#include "buffer_pool.h"
+#include "stats.h"
+#include "frame_skip.h"
+#include "time_stretch.h"
+#include "telemetry.h"
+#include "trace.h"
+#include "clock.h"
+#include "pcm_ring.h"
+#include "media_input.h"
+#include "decode_scheduler.h"
+#include "gop_cache.h"
 
 // --- FIX: Include SDL header directly to avoid type conflicts ---
 #include <SDL2/SDL.h>
 
 // Forward declarations for FFmpeg and OpenGL types
-struct AVFormatContext;
-struct AVCodecContext;
-struct AVStream;
 struct SwsContext;
 struct SwrContext;
 struct AVFrame;
+struct AVPacket;
+struct AVBufferPool;
 typedef unsigned int GLuint;
+typedef struct __GLsync *GLsync;
+
+// Pixel buffer objects in the upload ring: frame N+1 is copied into one buffer while
+// the GPU is still transferring frame N out of another.
+#define PBO_COUNT 3
+
+// How a decoded pixel format maps onto the plane textures.
+struct UploadFormat
+{
+    bool semi_planar = false; // NV12/P010 style interleaved chroma plane
+    int bytes = 1;            // bytes per component
+    int chroma_w_shift = 1;
+    int chroma_h_shift = 1;
+    float sample_scale = 1.0f; // maps stored samples to nominal [0,1] code values
+};
+
+struct SeekRequest
+{
+    int serial = 0;
+    double target = -1.0;     // seconds of playback timeline
+    int64_t requested_at = 0; // av_gettime_relative()
+};
+
+struct PixelBuffer
+{
+    GLuint id = 0;
+    size_t size = 0;
+    GLsync fence = nullptr;
+};
+
+struct ShaderVariant
+{
+    GLuint program = 0;
+    int loc_matrix = -1;
+    int loc_offset = -1;
+    int loc_scale = -1;
+};
+
+// One input of the mosaic. The decode side belongs to whichever scheduler worker runs
+// the tile's job; the render side to the render thread.
+struct MosaicTile
+{
+    MosaicTile() = default;
+    ~MosaicTile();
+
+    std::shared_ptr<MediaInput> input;
+    FrameQueue frames;                    // RGBA frames scaled to the cell size
+    FramePool frame_pool{frames.max_size + 4};
+
+    // Decode side
+    AVPacket *packet = nullptr;
+    AVFrame *decoded_frame = nullptr;
+    SwsContext *sws_ctx = nullptr;
+    int sws_colorspace = -1;
+    int sws_range = -1;
+    AVBufferPool *rgba_buffers = nullptr;
+    int loop = 0;                         // bumped on every restart from the beginning
+    bool eof = false;
+    std::atomic<uint64_t> decoded{0};
+
+    // Render side: each tile runs on its own clock, started by its first frame.
+    AVFrame *pending = nullptr;           // next frame, not due yet
+    int shown_loop = -1;
+    double clock_base = 0.0;
+    double pts_base = 0.0;
+    bool done = false;
+    uint64_t shown = 0;
+    uint64_t late = 0;                    // replaced by a newer due frame before display
+};
 
 class VideoPlayer
 {
 public:
-    VideoPlayer(const std::string &file);
+    VideoPlayer(const std::string &file, const PlayerOptions &opts = PlayerOptions());
+    // Plays the files back to back without a gap, as one continuous timeline.
+    VideoPlayer(const std::vector<std::string> &files, const PlayerOptions &opts = PlayerOptions());
     ~VideoPlayer();
 
     void open();
     void start();
 
+    // Jumps to t seconds of playback time within the current file (not in mosaic
+    // mode): the demuxer lands on the preceding keyframe and frames before t are
+    // decoded but not shown. Returns immediately; the pipeline threads pick the
+    // request up. Called from the event thread.
+    void seek(double t);
+
+    // Playback speed, clamped to 0.5-4x: audio is time-stretched at constant pitch
+    // and the clock runs that much faster. Called from the event thread.
+    void set_speed(double s);
+    void step_speed(int steps);
+
+    // Pause, frame stepping and reverse playback (not in mosaic mode). Meanwhile the
+    // demuxer stands still and frames come from decoded GOPs; resuming, or any seek,
+    // plays on forward from the frame on screen. Called from the event thread.
+    void toggle_pause();
+    void toggle_reverse();
+    void step_frame(int frames);
+
 private:
     void cleanup();
+    void start_pipeline();
+    bool seek_container(MediaInput &in, int64_t ts);
+    SeekRequest current_seek();
+    void record_seek_latency(int frame_serial);
+    int bump_serial(double target);
+    void wake_pipeline(int new_serial);
+    void enter_review(bool reverse, int steps);
+    void review_loop(const std::shared_ptr<MediaInput> &in, int64_t rebase);
+    void update_title();
 
     // Initialization
-    void init_codec_context(int stream_index, AVCodecContext **codec_ctx, const std::string &type);
-    void init_sdl_video();
+    void init_sdl_video(int width, int height);
     void init_sdl_audio();
+    void init_resampler(int out_rate);
+    void setup_resampler(const MediaInput &in);
     void setup_shaders(int video_w, int video_h);
+    void allocate_textures(const UploadFormat &fmt, int w, int h);
 
     // Threading
     void demux_thread_entry();
+    bool demux_should_wait();
     void video_decode_thread_entry();
     void audio_decode_thread_entry();
+    bool before_seek_target(const AVFrame *frame);
+
+    // Playlist
+    void playlist_thread_entry();
+    bool take_next_input(std::shared_ptr<MediaInput> &next);
+    std::shared_ptr<MediaInput> take_handoff(std::deque<std::shared_ptr<MediaInput>> &handoff);
+
+    // Mosaic
+    void open_mosaic();
+    void run_mosaic();
+    bool mosaic_step(MosaicTile &tile);
+    void mosaic_render_thread_entry();
+    void mosaic_bench_sink();
+    void setup_mosaic_gl();
+    void print_mosaic_report(double wall_seconds);
+
+    // Benchmark
+    void run_bench();
+    void bench_audio_sink();
+    void print_bench_report(double wall_seconds);
+    void print_readahead_stats(MediaInput &in);
+    void start_telemetry();
 
     // Main Loop & Rendering
     void main_loop();
+    void render_thread_entry();
     void render_video_frame();
+    bool wait_for_render(double seconds, int frame_serial);
     void display_frame(AVFrame *frame);
+    AVFrame *convert_frame(AVFrame *frame);
 
     // Audio
     static void audio_callback(void *userdata, Uint8 *stream, int len);
-    int resample_audio_frame();
+    bool resample_audio_frame(AVFrame *frame);
+    bool write_pcm(const int16_t *samples, int frames, double end_pts, double tempo);
 
     // Sync
-    double get_audio_clock();
+    bool get_audio_clock(double &pts);
 
     // Helper for shaders
     static GLuint compile_shader(unsigned int type, const char *src);
     static GLuint link_program(GLuint vs, GLuint fs);
 
     // --- Member Variables ---
-    std::string filename;
-    AVFormatContext *format_ctx = nullptr;
-    AVCodecContext *video_codec_ctx = nullptr;
-    AVCodecContext *audio_codec_ctx = nullptr;
-    AVStream *video_stream = nullptr;
-    AVStream *audio_stream = nullptr;
+    std::vector<std::string> playlist;
+    PlayerOptions options;
     SwsContext *sws_ctx = nullptr;
     SwrContext *swr_ctx = nullptr;
     AVFrame *yuv_frame = nullptr;
@@ -74,31 +213,110 @@ private:
     SDL_AudioDeviceID audio_device = 0;
 
     GLuint tex_y = 0, tex_u = 0, tex_v = 0;
-    GLuint shader_program = 0;
+    UploadFormat tex_format;
+    int tex_width = 0, tex_height = 0;
+    PixelBuffer pbo_ring[PBO_COUNT];
+    int pbo_index = 0;
+    ShaderVariant planar_shader;
+    ShaderVariant semi_planar_shader;
     GLuint vao = 0, vbo = 0;
-
-    int video_stream_index = -1;
-    int audio_stream_index = -1;
+    GLuint mosaic_program = 0;
+    GLuint mosaic_textures = 0; // RGBA8 texture array, one layer per tile
+    int mosaic_loc_grid = -1;
 
     std::thread demux_thread;
     std::thread video_decode_thread;
     std::thread audio_decode_thread;
+    std::thread audio_sink_thread;
+    std::thread render_thread;
+    std::thread playlist_thread;
+
+    // Presentation scheduler
+    std::mutex render_mutex;
+    std::condition_variable render_cond;
+    std::atomic<int> viewport_w{0}, viewport_h{0};
+    std::atomic<bool> viewport_dirty{false};
 
+    MemoryBudget memory_budget;
     PacketQueue video_q;
     PacketQueue audio_q;
     FrameQueue video_frame_q;
-    FrameQueue audio_frame_q;
+    PacketPool video_pkt_pool{video_q.max_size + 4};
+    PacketPool audio_pkt_pool{audio_q.max_size + 4};
+    FramePool video_frame_pool{video_frame_q.max_size + 4};
+    FrameBufferPool video_buffer_pool;
     std::atomic<bool> quit{false};
+    PipelineStats stats;
+    Telemetry telemetry;
+    TelemetryExporter telemetry_exporter;
+
+    // Inputs. Each pipeline thread holds its own reference to the input it is working
+    // on. At the end of an entry the demuxer hands the next one to each decoder through
+    // its handoff deque, then queues a marker telling the decoder to switch.
+    std::shared_ptr<MediaInput> input;      // being demuxed; guarded by playlist_mutex once playing
+    std::shared_ptr<MediaInput> next_input; // opened and pre-warmed, waiting for the demuxer
+    std::deque<std::shared_ptr<MediaInput>> video_handoff;
+    std::deque<std::shared_ptr<MediaInput>> audio_handoff;
+    size_t next_entry = 0;                  // playlist thread only
+    bool playlist_done = true;              // no entry will follow next_input
+    std::mutex playlist_mutex;
+    std::condition_variable playlist_cond;
+    // Audio pipeline and device exist. Always on for playlists, whose later entries
+    // may have audio even if the first has none.
+    bool has_audio = false;
+    std::atomic<bool> audio_decode_done{false};
+
+    // Mosaic: tile i is scheduler job i. mosaic_frames is notified after every frame
+    // a decoder queues, for the renderer or bench sink parked with nothing to take.
+    std::vector<std::unique_ptr<MosaicTile>> tiles;
+    WaitEvent mosaic_frames;
+    DecodeScheduler scheduler;
+    int grid_cols = 1, grid_rows = 1;
+    int cell_w = 0, cell_h = 0;
+
+    // Seeking. Packets and frames carry the serial they were read under; a seek bumps
+    // the serial and every consumer drops older items as it meets them.
+    std::atomic<int> serial{0};
+    std::atomic<bool> seek_pending{false}; // demux thread has not repositioned yet
+    std::mutex seek_mutex;
+    SeekRequest seek_request;              // latest request, guarded by seek_mutex
+    std::atomic<double> position{0.0};     // pts of the last displayed frame
+    int render_serial = -1;                // render thread only
+    double video_seek_target = -1.0;       // drop video frames ending before this time (< 0: none)
+    double audio_seek_target = -1.0;       // drop audio frames ending before this time (< 0: none)
+
+    // Review (paused or reverse): the demuxer waits and the video decoder fills the
+    // frame queue from gop_cache instead of from packets. Every command bumps the
+    // serial, so queued frames of the previous one are dropped and the next is shown
+    // at once.
+    struct ReviewCommands
+    {
+        bool reverse = false;
+        int steps = 0;       // frames to step, forward if positive
+        bool resync = false; // start over from the frame on screen
+    };
+    std::atomic<bool> reviewing{false};
+    std::atomic<bool> review_pending{false}; // demuxer has not queued the review marker yet
+    std::atomic<bool> review_abandoned{false}; // no keyframe index: the event loop resumes playback
+    std::mutex review_mutex;
+    std::condition_variable review_cond;
+    ReviewCommands review; // guarded by review_mutex
+    GopCache gop_cache;
 
     // Sync
-    double audio_clock = 0.0;
-    std::mutex audio_clock_mutex;
+    AudioClock master_clock;
+    FrameSkipController frame_skip;
+    std::atomic<double> speed{1.0};
+    double audio_clock = 0.0; // audio decode thread only
+    int audio_out_rate = 0;
+    int audio_bytes_per_sec = 0;
+    int audio_hw_buf_size = 0;
     double frame_timer = 0.0;
     double frame_last_pts = 0.0;
     double frame_last_delay = 0.0;
 
-    // Audio Buffer
-    uint8_t audio_buf[(192000 * 3) / 2];
-    unsigned int audio_buf_size = 0;
-    unsigned int audio_buf_index = 0;
+    // Audio output: S16 stereo, resampled by the decode thread
+    PcmRing pcm_ring;
+    std::vector<uint8_t> resample_buf;
+    TimeStretch time_stretch; // audio decode thread only
 };
\ No newline at end of file
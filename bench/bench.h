@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+
+// ---- player_bench harness ----
+// A benchmark runs `iterations` operations per call. The harness grows the count
+// until one call takes at least the minimum time, repeats the measurement and keeps
+// the median nanoseconds per operation. A benchmark may instead report its own
+// per-operation figure (e.g. a latency percentile) through BenchRun::report(), and
+// fails the whole run through BenchRun::fail().
+struct BenchRun
+{
+    int64_t iterations = 0;
+
+    // Overrides the measured ns/op of this call.
+    void report(double ns_per_op) { reported_ns = ns_per_op; }
+
+    // Marks the benchmark failed; it is not measured any further.
+    void fail(const std::string &reason) { failure = reason; }
+
+    // Excludes setup done inside the call from the measurement.
+    void pause_timing();
+    void resume_timing();
+
+    double reported_ns = -1.0;
+    std::string failure;
+    int64_t excluded_ns = 0;
+    int64_t paused_at = 0;
+};
+
+using BenchFn = std::function<void(BenchRun &)>;
+
+// Names are "group/case"; --filter matches by prefix. max_iterations caps the
+// calibration for benchmarks whose single operation is already long (macro runs).
+void bench_register(const std::string &name, BenchFn fn, int64_t max_iterations = INT64_MAX);
+
+// Skips a benchmark with a reason, e.g. no input clip or no GL.
+void bench_skip(const std::string &name, const std::string &reason);
+
+// Path of a clip generated at build time (in BENCH_CLIP_DIR, or --clips), or an
+// empty string if it is missing.
+std::string bench_clip(const std::string &file);
+
+// The synthetic test clip: lavfi testsrc2 1920x1080 at 30 fps with a sine tone.
+#define BENCH_CLIP_1080P "testsrc_1080p30.mp4"
+
+// Keeps the optimizer from dropping a computed value.
+template <typename T>
+inline void bench_keep(const T &value)
+{
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// Registration functions of the benchmark files, called from main().
+void register_queue_benchmarks();
+void register_convert_benchmarks();
+void register_upload_benchmarks();
+void register_player_benchmarks();
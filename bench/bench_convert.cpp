@@ -0,0 +1,304 @@
+#include "bench.h"
+#include "time_stretch.h"
+#include <cmath>
+#include <memory>
+#include <sstream>
+#include <vector>
+
+extern "C"
+{
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/channel_layout.h>
+#include <libswscale/swscale.h>
+#include <libswresample/swresample.h>
+}
+
+// Decodes the first video frame of path into video and up to max_audio audio frames.
+static bool bench_decode_clip(const std::string &path, AVFrame *video, std::vector<AVFrame *> *audio, int max_audio)
+{
+    AVFormatContext *fmt = nullptr;
+    if (avformat_open_input(&fmt, path.c_str(), nullptr, nullptr) != 0)
+        return false;
+    avformat_find_stream_info(fmt, nullptr);
+
+    AVCodecContext *ctx[2] = {nullptr, nullptr};
+    int index[2] = {av_find_best_stream(fmt, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0),
+                    audio ? av_find_best_stream(fmt, AVMEDIA_TYPE_AUDIO, -1, -1, nullptr, 0) : -1};
+    for (int k = 0; k < 2; k++)
+    {
+        if (index[k] < 0)
+            continue;
+        const AVCodec *codec = avcodec_find_decoder(fmt->streams[index[k]]->codecpar->codec_id);
+        ctx[k] = codec ? avcodec_alloc_context3(codec) : nullptr;
+        if (!ctx[k] || avcodec_parameters_to_context(ctx[k], fmt->streams[index[k]]->codecpar) < 0 ||
+            avcodec_open2(ctx[k], codec, nullptr) < 0)
+            avcodec_free_context(&ctx[k]);
+    }
+
+    bool have_video = false;
+    AVPacket *pkt = av_packet_alloc();
+    AVFrame *frame = av_frame_alloc();
+    while (ctx[0] && (!have_video || (ctx[1] && (int)audio->size() < max_audio)) && av_read_frame(fmt, pkt) >= 0)
+    {
+        int k = pkt->stream_index == index[0] ? 0 : pkt->stream_index == index[1] ? 1
+                                                                                  : -1;
+        if (k < 0 || !ctx[k] || avcodec_send_packet(ctx[k], pkt) < 0)
+        {
+            av_packet_unref(pkt);
+            continue;
+        }
+        av_packet_unref(pkt);
+        while (avcodec_receive_frame(ctx[k], frame) == 0)
+        {
+            if (k == 0 && !have_video)
+            {
+                av_frame_move_ref(video, frame);
+                have_video = true;
+            }
+            else if (k == 1 && (int)audio->size() < max_audio)
+            {
+                AVFrame *copy = av_frame_alloc();
+                av_frame_move_ref(copy, frame);
+                audio->push_back(copy);
+            }
+            else
+                av_frame_unref(frame);
+        }
+    }
+    av_frame_free(&frame);
+    av_packet_free(&pkt);
+    avcodec_free_context(&ctx[0]);
+    avcodec_free_context(&ctx[1]);
+    avformat_close_input(&fmt);
+    return have_video;
+}
+
+// ---- Video: sws_scale vs. direct plane copy ----
+// The renderer uploads planar and semi-planar YUV as is and runs everything else
+// through sws_scale to yuv420p first (VideoPlayer::convert_frame). These measure
+// both paths per frame at common resolutions, from the decoded test clip scaled to
+// each size and format once up front.
+
+struct Resolution
+{
+    const char *name;
+    int w, h;
+};
+
+static const Resolution resolutions[] = {{"360p", 640, 360}, {"720p", 1280, 720}, {"1080p", 1920, 1080}, {"2160p", 3840, 2160}};
+
+struct SourceFormat
+{
+    const char *name;
+    AVPixelFormat fmt;
+    bool direct; // uploaded without conversion
+};
+
+static const SourceFormat formats[] = {
+    {"yuv420p", AV_PIX_FMT_YUV420P, true},
+    {"nv12", AV_PIX_FMT_NV12, true},
+    {"yuv420p10le", AV_PIX_FMT_YUV420P10LE, true},
+    {"yuv422p", AV_PIX_FMT_YUV422P, true},
+    {"rgb24", AV_PIX_FMT_RGB24, false},
+    {"bgra", AV_PIX_FMT_BGRA, false},
+};
+
+using FramePtr = std::shared_ptr<AVFrame>;
+
+static FramePtr make_frame(AVPixelFormat fmt, int w, int h)
+{
+    FramePtr f(av_frame_alloc(), [](AVFrame *p)
+               { av_frame_free(&p); });
+    f->format = fmt;
+    f->width = w;
+    f->height = h;
+    if (av_frame_get_buffer(f.get(), 32) < 0)
+        return nullptr;
+    return f;
+}
+
+static FramePtr scaled(const AVFrame *src, AVPixelFormat fmt, int w, int h)
+{
+    FramePtr out = make_frame(fmt, w, h);
+    SwsContext *sws = sws_getContext(src->width, src->height, (AVPixelFormat)src->format, w, h, fmt, SWS_BICUBIC, nullptr, nullptr, nullptr);
+    if (!out || !sws)
+        return nullptr;
+    sws_scale(sws, src->data, src->linesize, 0, src->height, out->data, out->linesize);
+    sws_freeContext(sws);
+    return out;
+}
+
+static void register_video(const AVFrame *clip_frame)
+{
+    for (const Resolution &res : resolutions)
+    {
+        for (const SourceFormat &format : formats)
+        {
+            FramePtr src = scaled(clip_frame, format.fmt, res.w, res.h);
+            std::string suffix = std::string(format.name) + "/" + res.name;
+            if (!src)
+            {
+                bench_skip("sws/" + suffix, "could not prepare the source frame");
+                continue;
+            }
+
+            if (format.direct)
+            {
+                FramePtr dst = make_frame(format.fmt, res.w, res.h);
+                bench_register("copy/" + suffix, [src, dst](BenchRun &run)
+                               {
+                                   for (int64_t i = 0; i < run.iterations; i++)
+                                       av_image_copy(dst->data, dst->linesize, (const uint8_t **)src->data, src->linesize,
+                                                     (AVPixelFormat)src->format, src->width, src->height); });
+            }
+
+            FramePtr yuv = make_frame(AV_PIX_FMT_YUV420P, res.w, res.h);
+            std::shared_ptr<SwsContext> sws(sws_getContext(res.w, res.h, format.fmt, res.w, res.h, AV_PIX_FMT_YUV420P,
+                                                           SWS_BILINEAR, nullptr, nullptr, nullptr),
+                                            sws_freeContext);
+            if (!yuv || !sws)
+            {
+                bench_skip("sws/" + suffix, "no swscale conversion to yuv420p");
+                continue;
+            }
+            bench_register("sws/" + suffix, [src, yuv, sws](BenchRun &run)
+                           {
+                               for (int64_t i = 0; i < run.iterations; i++)
+                                   sws_scale(sws.get(), src->data, src->linesize, 0, src->height, yuv->data, yuv->linesize); });
+        }
+    }
+}
+
+// ---- Audio: swr_convert per sample format ----
+// The device always takes interleaved s16 stereo (VideoPlayer::setup_resampler).
+// Each case converts one decoded frame of the clip's tone, first turned into the
+// given sample format, at the same rate and with a 48 kHz -> 44.1 kHz resample.
+
+struct SampleFormat
+{
+    const char *name;
+    AVSampleFormat fmt;
+};
+
+static const SampleFormat sample_formats[] = {
+    {"s16", AV_SAMPLE_FMT_S16},
+    {"s16p", AV_SAMPLE_FMT_S16P},
+    {"s32", AV_SAMPLE_FMT_S32},
+    {"flt", AV_SAMPLE_FMT_FLT},
+    {"fltp", AV_SAMPLE_FMT_FLTP},
+    {"dbl", AV_SAMPLE_FMT_DBL},
+};
+
+using SwrPtr = std::shared_ptr<SwrContext>;
+
+static SwrPtr make_swr(const AVChannelLayout &in_layout, AVSampleFormat in_fmt, int in_rate, AVSampleFormat out_fmt, int out_rate)
+{
+    SwrContext *swr = nullptr;
+    AVChannelLayout stereo;
+    av_channel_layout_default(&stereo, 2);
+    if (swr_alloc_set_opts2(&swr, &stereo, out_fmt, out_rate, &in_layout, in_fmt, in_rate, 0, nullptr) < 0 || swr_init(swr) < 0)
+    {
+        swr_free(&swr);
+        return nullptr;
+    }
+    return SwrPtr(swr, [](SwrContext *s)
+                  { swr_free(&s); });
+}
+
+static void register_audio(const AVFrame *clip_audio)
+{
+    const int rate = 48000;
+    for (const SampleFormat &format : sample_formats)
+    {
+        // One frame of the tone in this sample format, stereo at 48 kHz.
+        auto src = std::make_shared<std::vector<uint8_t>>();
+        auto planes = std::make_shared<std::vector<uint8_t *>>(2, nullptr);
+        int nb_samples = clip_audio->nb_samples;
+        SwrPtr prepare = make_swr(clip_audio->ch_layout, (AVSampleFormat)clip_audio->format, clip_audio->sample_rate, format.fmt, rate);
+        int linesize = 0;
+        int size = av_samples_get_buffer_size(&linesize, 2, nb_samples, format.fmt, 0);
+        if (!prepare || size < 0)
+        {
+            bench_skip(std::string("swr/") + format.name, "could not prepare the source samples");
+            continue;
+        }
+        src->resize(size);
+        av_samples_fill_arrays(planes->data(), &linesize, src->data(), 2, nb_samples, format.fmt, 0);
+        int got = swr_convert(prepare.get(), planes->data(), nb_samples, (const uint8_t **)clip_audio->extended_data, clip_audio->nb_samples);
+        if (got <= 0)
+        {
+            bench_skip(std::string("swr/") + format.name, "could not prepare the source samples");
+            continue;
+        }
+
+        AVChannelLayout stereo;
+        av_channel_layout_default(&stereo, 2);
+        for (int out_rate : {48000, 44100})
+        {
+            SwrPtr swr = make_swr(stereo, format.fmt, rate, AV_SAMPLE_FMT_S16, out_rate);
+            std::string name = std::string("swr/") + format.name + "_to_s16/" + std::to_string(out_rate);
+            if (!swr)
+            {
+                bench_skip(name, "no resampler");
+                continue;
+            }
+            auto out = std::make_shared<std::vector<uint8_t>>((size_t)(got + 256) * 4);
+            bench_register(name, [swr, planes, out, got](BenchRun &run)
+                           {
+                               uint8_t *dst = out->data();
+                               for (int64_t i = 0; i < run.iterations; i++)
+                                   bench_keep(swr_convert(swr.get(), &dst, got + 256, (const uint8_t **)planes->data(), got)); });
+        }
+    }
+}
+
+// ---- Audio: time stretch ----
+// WSOLA at each playback speed on a 440 Hz tone, one device-sized chunk of s16
+// stereo per operation. Needs no clip.
+
+static void register_stretch()
+{
+    for (double tempo : {0.5, 1.0, 1.5, 2.0, 4.0})
+    {
+        auto chunk = std::make_shared<std::vector<int16_t>>(1024 * 2);
+        for (size_t i = 0; i < 1024; i++)
+            (*chunk)[2 * i] = (*chunk)[2 * i + 1] = (int16_t)(8000.0 * std::sin(2.0 * M_PI * 440.0 * i / 48000.0));
+        auto stretch = std::make_shared<TimeStretch>();
+        stretch->reset(48000);
+        stretch->set_tempo(tempo);
+        std::ostringstream name;
+        name << "stretch/s16/" << tempo << "x";
+        bench_register(name.str(), [chunk, stretch](BenchRun &run)
+                       {
+                           int frames = 0;
+                           for (int64_t i = 0; i < run.iterations; i++)
+                               bench_keep(stretch->process(chunk->data(), 1024, frames)); });
+    }
+}
+
+void register_convert_benchmarks()
+{
+    register_stretch();
+
+    std::string clip = bench_clip(BENCH_CLIP_1080P);
+    std::shared_ptr<AVFrame> video(av_frame_alloc(), [](AVFrame *f)
+                                   { av_frame_free(&f); });
+    std::vector<AVFrame *> audio;
+    if (clip.empty() || !bench_decode_clip(clip, video.get(), &audio, 1))
+    {
+        bench_skip("copy", "test clip " BENCH_CLIP_1080P " not found or not decodable");
+        bench_skip("sws", "test clip " BENCH_CLIP_1080P " not found or not decodable");
+        bench_skip("swr", "test clip " BENCH_CLIP_1080P " not found or not decodable");
+        return;
+    }
+
+    register_video(video.get());
+    if (audio.empty())
+        bench_skip("swr", "test clip has no audio");
+    else
+        register_audio(audio[0]);
+    for (AVFrame *&f : audio)
+        av_frame_free(&f);
+}
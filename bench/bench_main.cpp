@@ -0,0 +1,250 @@
+#include "bench.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <vector>
+
+#ifndef BENCH_CLIP_DIR
+#define BENCH_CLIP_DIR "."
+#endif
+
+struct Benchmark
+{
+    std::string name;
+    BenchFn fn;
+    int64_t max_iterations;
+    std::string skip_reason;
+};
+
+static std::vector<Benchmark> &benchmarks()
+{
+    static std::vector<Benchmark> list;
+    return list;
+}
+
+static std::string clip_dir = BENCH_CLIP_DIR;
+
+static int64_t now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void BenchRun::pause_timing()
+{
+    paused_at = now_ns();
+}
+
+void BenchRun::resume_timing()
+{
+    excluded_ns += now_ns() - paused_at;
+}
+
+void bench_register(const std::string &name, BenchFn fn, int64_t max_iterations)
+{
+    benchmarks().push_back(Benchmark{name, std::move(fn), max_iterations, ""});
+}
+
+void bench_skip(const std::string &name, const std::string &reason)
+{
+    benchmarks().push_back(Benchmark{name, nullptr, 0, reason});
+}
+
+std::string bench_clip(const std::string &file)
+{
+    std::string path = clip_dir + "/" + file;
+    return std::ifstream(path).good() ? path : std::string();
+}
+
+// One call of fn with the given count; returns ns/op. Sets failure if the call failed.
+static double run_once(const Benchmark &b, int64_t iterations, int64_t &elapsed_ns, std::string &failure)
+{
+    BenchRun run;
+    run.iterations = iterations;
+    int64_t start = now_ns();
+    b.fn(run);
+    elapsed_ns = now_ns() - start - run.excluded_ns;
+    failure = run.failure;
+    if (run.reported_ns >= 0)
+        return run.reported_ns;
+    return (double)elapsed_ns / iterations;
+}
+
+// Median ns/op, or -1 with the reason in failure once any call fails.
+static double measure(const Benchmark &b, int64_t min_time_ns, int repetitions, std::string &failure)
+{
+    int64_t iterations = 1;
+    int64_t elapsed = 0;
+    run_once(b, iterations, elapsed, failure); // warm-up and first estimate
+    while (failure.empty() && elapsed < min_time_ns && iterations < b.max_iterations)
+    {
+        int64_t next = elapsed > 0 ? (int64_t)(iterations * 1.4 * min_time_ns / elapsed) : iterations * 10;
+        iterations = std::min(std::max(next, iterations + 1), b.max_iterations);
+        run_once(b, iterations, elapsed, failure);
+    }
+
+    std::vector<double> samples;
+    for (int i = 0; i < repetitions && failure.empty(); i++)
+        samples.push_back(run_once(b, iterations, elapsed, failure));
+    if (!failure.empty())
+        return -1.0;
+    std::sort(samples.begin(), samples.end());
+    return samples[samples.size() / 2];
+}
+
+static std::map<std::string, double> read_baseline(const std::string &path)
+{
+    std::map<std::string, double> out;
+    std::ifstream in(path);
+    std::string line;
+    while (std::getline(in, line))
+    {
+        if (line.empty() || line[0] == '#')
+            continue;
+        std::istringstream fields(line);
+        std::string name;
+        double ns;
+        if (fields >> name >> ns)
+            out[name] = ns;
+    }
+    return out;
+}
+
+static void usage(const char *prog)
+{
+    std::cerr << "Usage: " << prog << " [options]\n"
+              << "Options:\n"
+              << "  --list                 list the benchmarks and exit\n"
+              << "  --filter PREFIX        only run benchmarks whose name starts with PREFIX\n"
+              << "  --baseline FILE        fail if a benchmark is slower than its entry in FILE\n"
+              << "                         or has none\n"
+              << "  --tolerance F          allowed slowdown over the baseline (default 0.25)\n"
+              << "  --write-baseline FILE  store the results as a new baseline\n"
+              << "  --min-time-ms N        minimum duration of one measurement (default 200)\n"
+              << "  --repetitions N        measurements per benchmark, median kept (default 5)\n"
+              << "  --clips DIR            directory of the generated input clips\n";
+}
+
+int main(int argc, char *argv[])
+{
+    std::string filter, baseline_path, write_path;
+    double tolerance = 0.25;
+    int64_t min_time_ms = 200;
+    int repetitions = 5;
+    bool list = false;
+
+    for (int i = 1; i < argc; i++)
+    {
+        bool has_value = i + 1 < argc;
+        if (std::strcmp(argv[i], "--list") == 0)
+            list = true;
+        else if (std::strcmp(argv[i], "--filter") == 0 && has_value)
+            filter = argv[++i];
+        else if (std::strcmp(argv[i], "--baseline") == 0 && has_value)
+            baseline_path = argv[++i];
+        else if (std::strcmp(argv[i], "--tolerance") == 0 && has_value)
+            tolerance = std::atof(argv[++i]);
+        else if (std::strcmp(argv[i], "--write-baseline") == 0 && has_value)
+            write_path = argv[++i];
+        else if (std::strcmp(argv[i], "--min-time-ms") == 0 && has_value)
+            min_time_ms = std::atoll(argv[++i]);
+        else if (std::strcmp(argv[i], "--repetitions") == 0 && has_value)
+            repetitions = std::max(1, std::atoi(argv[++i]));
+        else if (std::strcmp(argv[i], "--clips") == 0 && has_value)
+            clip_dir = argv[++i];
+        else
+        {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    register_queue_benchmarks();
+    register_convert_benchmarks();
+    register_upload_benchmarks();
+    register_player_benchmarks();
+
+    std::map<std::string, double> baseline;
+    if (!baseline_path.empty())
+        baseline = read_baseline(baseline_path);
+
+    std::map<std::string, double> results;
+    int regressions = 0;
+    int failures = 0;
+    for (const Benchmark &b : benchmarks())
+    {
+        if (b.name.compare(0, filter.size(), filter) != 0)
+            continue;
+        if (list)
+        {
+            std::cout << b.name << (b.fn ? "" : "  (skipped: " + b.skip_reason + ")") << std::endl;
+            continue;
+        }
+        std::cout << std::left << std::setw(44) << b.name << std::right;
+        if (!b.fn)
+        {
+            std::cout << "skipped: " << b.skip_reason << std::endl;
+            continue;
+        }
+        std::cout.flush();
+
+        std::string failure;
+        double ns = measure(b, min_time_ms * 1000000, repetitions, failure);
+        if (!failure.empty())
+        {
+            std::cout << "FAILED: " << failure << std::endl;
+            failures++;
+            continue;
+        }
+        results[b.name] = ns;
+        std::cout << std::fixed << std::setprecision(1) << std::setw(14) << ns << " ns/op";
+        auto it = baseline.find(b.name);
+        if (it != baseline.end() && it->second > 0)
+        {
+            double change = ns / it->second - 1.0;
+            std::cout << " " << std::showpos << std::setprecision(1) << std::setw(8) << change * 100.0 << "%" << std::noshowpos;
+            if (change > tolerance)
+            {
+                std::cout << "  REGRESSION (baseline " << it->second << " ns/op)";
+                regressions++;
+            }
+        }
+        else if (!baseline_path.empty())
+        {
+            // A gate that silently passes new or renamed benchmarks gates nothing.
+            std::cout << "  MISSING BASELINE";
+            failures++;
+        }
+        std::cout << std::endl;
+    }
+
+    if (!write_path.empty() && !list)
+    {
+        // Entries of benchmarks that did not run this time are kept.
+        std::map<std::string, double> merged = read_baseline(write_path);
+        for (const auto &r : results)
+            merged[r.first] = r.second;
+        std::ofstream out(write_path);
+        out << "# player_bench baseline: benchmark ns/op. Regenerate on the reference machine with\n"
+            << "#   player_bench --write-baseline " << write_path << "\n"
+            << "# Figures are machine-specific; with --baseline, a benchmark without an entry fails.\n";
+        for (const auto &r : merged)
+            out << r.first << " " << std::setprecision(6) << r.second << "\n";
+        if (!out)
+        {
+            std::cerr << "Could not write " << write_path << std::endl;
+            return 2;
+        }
+    }
+
+    if (failures > 0)
+        std::cerr << failures << " benchmark(s) failed or have no baseline entry" << std::endl;
+    if (regressions > 0)
+        std::cerr << regressions << " benchmark(s) more than " << tolerance * 100.0 << "% slower than the baseline" << std::endl;
+    return failures > 0 || regressions > 0 ? 1 : 0;
+}
@@ -0,0 +1,85 @@
+#include "bench.h"
+#include "VideoPlayer.h"
+#include "frame_export.h"
+#include <iostream>
+#include <sstream>
+
+// ---- Whole pipeline ----
+// One operation is a complete --bench run over the test clip: demux, decode,
+// resample and the frame sinks, without window or audio device. The mosaic case
+// plays four copies of the clip at once on the shared decode pool; the export case
+// decodes the clip GOP-parallel to raw frames in /dev/null. The player's own report
+// is swallowed; a run that throws fails the benchmark.
+
+static bool run_player(BenchRun &run, const std::vector<std::string> &files, const PlayerOptions &opts)
+{
+    std::ostringstream sink;
+    std::streambuf *saved = std::cout.rdbuf(sink.rdbuf());
+    try
+    {
+        VideoPlayer player(files, opts);
+        player.open();
+        player.start();
+    }
+    catch (const std::exception &e)
+    {
+        run.fail(std::string("player: ") + e.what());
+    }
+    std::cout.rdbuf(saved);
+    return run.failure.empty();
+}
+
+static bool run_export(BenchRun &run, const std::string &clip, const PlayerOptions &opts)
+{
+    std::ostringstream sink;
+    std::streambuf *saved = std::cerr.rdbuf(sink.rdbuf());
+    try
+    {
+        FrameExporter exporter(clip, opts);
+        exporter.run();
+    }
+    catch (const std::exception &e)
+    {
+        run.fail(std::string("export: ") + e.what());
+    }
+    std::cerr.rdbuf(saved);
+    return run.failure.empty();
+}
+
+void register_player_benchmarks()
+{
+    std::string clip = bench_clip(BENCH_CLIP_1080P);
+    if (clip.empty())
+    {
+        bench_skip("player", "test clip " BENCH_CLIP_1080P " not found");
+        return;
+    }
+
+    PlayerOptions opts;
+    opts.bench = true;
+    bench_register("player/decode/1080p30", [clip, opts](BenchRun &run)
+                   {
+                       for (int64_t i = 0; i < run.iterations; i++)
+                           if (!run_player(run, {clip}, opts))
+                               break; },
+                   3);
+
+    PlayerOptions mosaic = opts;
+    mosaic.mosaic = true;
+    bench_register("player/mosaic_4/1080p30", [clip, mosaic](BenchRun &run)
+                   {
+                       for (int64_t i = 0; i < run.iterations; i++)
+                           if (!run_player(run, {clip, clip, clip, clip}, mosaic))
+                               break; },
+                   3);
+
+    PlayerOptions exporting = opts;
+    exporting.bench = false;
+    exporting.export_path = "/dev/null";
+    bench_register("player/export/1080p30", [clip, exporting](BenchRun &run)
+                   {
+                       for (int64_t i = 0; i < run.iterations; i++)
+                           if (!run_export(run, clip, exporting))
+                               break; },
+                   3);
+}
@@ -0,0 +1,119 @@
+#include "bench.h"
+#include "queue.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+// Throughput and latency of the SPSC packet/frame queues. Items are preallocated
+// and only their pointers travel, so the figures are the queue's own cost.
+
+template <typename Queue, typename Item>
+static void stream(BenchRun &run, Queue &q, std::vector<Item *> &items, unsigned spinners)
+{
+    std::atomic<bool> stop{false};
+    std::vector<std::thread> noise;
+    for (unsigned i = 0; i < spinners; i++)
+        noise.emplace_back([&stop]
+                           {
+                               while (!stop.load(std::memory_order_relaxed))
+                               {
+                               } });
+
+    std::thread consumer([&]
+                         {
+                             for (int64_t i = 0; i < run.iterations; i++)
+                                 bench_keep(q.pop()); });
+    for (int64_t i = 0; i < run.iterations; i++)
+        q.push(items[i % items.size()]);
+    consumer.join();
+
+    stop = true;
+    for (std::thread &t : noise)
+        t.join();
+}
+
+template <typename Queue, typename Item, typename Alloc>
+static void register_queue(const std::string &kind, Alloc alloc)
+{
+    auto make_items = [alloc]
+    {
+        auto items = std::make_shared<std::vector<Item *>>();
+        for (int i = 0; i < 2048; i++)
+            items->push_back(alloc());
+        return items;
+    };
+
+    // Producer and consumer on one thread: the ring and accounting without any
+    // cross-core traffic.
+    auto single = make_items();
+    bench_register("queue/" + kind + "/same_thread", [single](BenchRun &run)
+                   {
+                       Queue q;
+                       for (int64_t i = 0; i < run.iterations; i++)
+                       {
+                           q.push((*single)[i % single->size()]);
+                           bench_keep(q.pop());
+                       } });
+
+    // Producer and consumer on two threads, with the queue's own capacity deciding
+    // how often either side parks.
+    auto pair = make_items();
+    bench_register("queue/" + kind + "/two_threads", [pair](BenchRun &run)
+                   {
+                       Queue q;
+                       stream(run, q, *pair, 0); });
+
+    // Same with one spinning thread per core competing for the CPUs, so producer and
+    // consumer get descheduled and the futex fallback is exercised.
+    auto busy = make_items();
+    bench_register("queue/" + kind + "/two_threads_oversubscribed", [busy](BenchRun &run)
+                   {
+                       Queue q;
+                       stream(run, q, *busy, std::max(1u, std::thread::hardware_concurrency())); });
+}
+
+static int64_t clock_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Round trip through two packet queues, halved: the hand-off latency of one push
+// to the pop that returns it, including a wake-up of a parked consumer.
+static void register_latency(const char *name, double quantile)
+{
+    bench_register(name, [quantile](BenchRun &run)
+                   {
+                       PacketQueue there, back;
+                       AVPacket *pkt = av_packet_alloc();
+                       std::vector<int64_t> samples;
+                       samples.reserve(run.iterations);
+                       std::thread echo([&]
+                                        {
+                                            for (int64_t i = 0; i < run.iterations; i++)
+                                                back.push(there.pop()); });
+                       for (int64_t i = 0; i < run.iterations; i++)
+                       {
+                           int64_t start = clock_ns();
+                           there.push(pkt);
+                           bench_keep(back.pop());
+                           samples.push_back((clock_ns() - start) / 2);
+                       }
+                       echo.join();
+                       av_packet_free(&pkt);
+
+                       std::sort(samples.begin(), samples.end());
+                       run.report((double)samples[(size_t)(quantile * (samples.size() - 1))]); },
+                   200000);
+}
+
+void register_queue_benchmarks()
+{
+    register_queue<PacketQueue, AVPacket>("packet", []
+                                          { return av_packet_alloc(); });
+    register_queue<FrameQueue, AVFrame>("frame", []
+                                        { return av_frame_alloc(); });
+    register_latency("queue/packet/handoff_latency_p50", 0.5);
+    register_latency("queue/packet/handoff_latency_p99", 0.99);
+}
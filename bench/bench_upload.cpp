@@ -0,0 +1,190 @@
+#include "bench.h"
+
+#ifdef BENCH_HAVE_EGL
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#define GL_GLEXT_PROTOTYPES
+#include <GL/gl.h>
+#include <GL/glext.h>
+
+// ---- GL texture upload ----
+// The renderer's upload path (VideoPlayer::display_frame) on an offscreen context:
+// copy the planes into the next buffer of a PBO ring, then glTexSubImage2D each plane
+// from it. Needs an EGL driver that can create a GL 3.3 core context without a
+// window, e.g. Mesa's surfaceless platform or llvmpipe. The run ends with glFinish,
+// so the figure includes the transfer, not just queuing it.
+
+#define UPLOAD_PBO_COUNT 3
+
+static bool create_offscreen_context()
+{
+    EGLDisplay display = EGL_NO_DISPLAY;
+    auto get_platform_display = reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(eglGetProcAddress("eglGetPlatformDisplayEXT"));
+    if (get_platform_display)
+        display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+    if (display == EGL_NO_DISPLAY)
+        display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    if (display == EGL_NO_DISPLAY || !eglInitialize(display, nullptr, nullptr) || !eglBindAPI(EGL_OPENGL_API))
+        return false;
+
+    const EGLint config_attribs[] = {EGL_SURFACE_TYPE, EGL_PBUFFER_BIT, EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE};
+    EGLConfig config;
+    EGLint count = 0;
+    if (!eglChooseConfig(display, config_attribs, &config, 1, &count) || count == 0)
+        return false;
+
+    const EGLint context_attribs[] = {EGL_CONTEXT_MAJOR_VERSION, 3, EGL_CONTEXT_MINOR_VERSION, 3,
+                                      EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT, EGL_NONE};
+    EGLContext context = eglCreateContext(display, config, EGL_NO_CONTEXT, context_attribs);
+    if (context == EGL_NO_CONTEXT)
+        return false;
+
+    // Nothing is presented; a tiny pbuffer covers drivers without surfaceless contexts.
+    if (eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context))
+        return true;
+    const EGLint pbuffer_attribs[] = {EGL_WIDTH, 16, EGL_HEIGHT, 16, EGL_NONE};
+    EGLSurface surface = eglCreatePbufferSurface(display, config, pbuffer_attribs);
+    return surface != EGL_NO_SURFACE && eglMakeCurrent(display, surface, surface, context);
+}
+
+struct UploadCase
+{
+    const char *name;
+    int bytes;       // per sample
+    bool semi_planar; // interleaved chroma, like nv12
+};
+
+struct Plane
+{
+    int w, h, comps;
+};
+
+static void register_upload(const UploadCase &c, const char *res_name, int w, int h, bool use_pbo)
+{
+    int cw = (w + 1) / 2, ch = (h + 1) / 2;
+    std::vector<Plane> planes = {{w, h, 1}};
+    if (c.semi_planar)
+        planes.push_back({cw, ch, 2});
+    else
+        planes.insert(planes.end(), {{cw, ch, 1}, {cw, ch, 1}});
+
+    struct State
+    {
+        std::vector<Plane> planes;
+        std::vector<std::vector<uint8_t>> data;
+        std::vector<GLuint> textures;
+        GLuint pbo[UPLOAD_PBO_COUNT] = {};
+        GLsync fence[UPLOAD_PBO_COUNT] = {};
+        size_t total = 0;
+        int bytes = 1;
+    };
+    auto s = std::make_shared<State>();
+    s->planes = planes;
+    s->bytes = c.bytes;
+    s->textures.resize(planes.size());
+    glGenTextures((GLsizei)planes.size(), s->textures.data());
+    for (size_t i = 0; i < planes.size(); i++)
+    {
+        const Plane &p = planes[i];
+        size_t size = (size_t)p.w * p.h * p.comps * c.bytes;
+        s->data.emplace_back(size, (uint8_t)(0x40 + 0x20 * i));
+        s->total += size;
+        GLenum internal = p.comps == 1 ? (c.bytes == 1 ? GL_R8 : GL_R16) : (c.bytes == 1 ? GL_RG8 : GL_RG16);
+        glBindTexture(GL_TEXTURE_2D, s->textures[i]);
+        glTexImage2D(GL_TEXTURE_2D, 0, internal, p.w, p.h, 0, p.comps == 1 ? GL_RED : GL_RG,
+                     c.bytes == 1 ? GL_UNSIGNED_BYTE : GL_UNSIGNED_SHORT, nullptr);
+    }
+    if (use_pbo)
+    {
+        glGenBuffers(UPLOAD_PBO_COUNT, s->pbo);
+        for (GLuint pbo : s->pbo)
+        {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, s->total, nullptr, GL_STREAM_DRAW);
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+
+    std::string name = std::string("upload/") + (use_pbo ? "pbo/" : "direct/") + c.name + "/" + res_name;
+    bench_register(name, [s, use_pbo](BenchRun &run)
+                   {
+                       glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+                       for (int64_t n = 0; n < run.iterations; n++)
+                       {
+                           int slot = (int)(n % UPLOAD_PBO_COUNT);
+                           size_t offset = 0;
+                           uint8_t *dst = nullptr;
+                           if (use_pbo)
+                           {
+                               if (s->fence[slot])
+                               {
+                                   glClientWaitSync(s->fence[slot], GL_SYNC_FLUSH_COMMANDS_BIT, 100000000);
+                                   glDeleteSync(s->fence[slot]);
+                                   s->fence[slot] = nullptr;
+                               }
+                               glBindBuffer(GL_PIXEL_UNPACK_BUFFER, s->pbo[slot]);
+                               dst = static_cast<uint8_t *>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, s->total,
+                                                                             GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT));
+                               if (!dst)
+                                   break;
+                               for (const auto &plane : s->data)
+                               {
+                                   memcpy(dst + offset, plane.data(), plane.size());
+                                   offset += plane.size();
+                               }
+                               glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+                               offset = 0;
+                           }
+                           for (size_t i = 0; i < s->planes.size(); i++)
+                           {
+                               const Plane &p = s->planes[i];
+                               glBindTexture(GL_TEXTURE_2D, s->textures[i]);
+                               const void *src = use_pbo ? reinterpret_cast<const void *>(offset) : s->data[i].data();
+                               glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, p.w, p.h, p.comps == 1 ? GL_RED : GL_RG,
+                                               s->bytes == 1 ? GL_UNSIGNED_BYTE : GL_UNSIGNED_SHORT, src);
+                               offset += s->data[i].size();
+                           }
+                           if (use_pbo)
+                           {
+                               glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+                               s->fence[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+                           }
+                       }
+                       glFinish(); },
+                   10000);
+}
+
+void register_upload_benchmarks()
+{
+    if (!create_offscreen_context())
+    {
+        bench_skip("upload", "no offscreen GL 3.3 core context through EGL");
+        return;
+    }
+
+    static const UploadCase cases[] = {{"yuv420p", 1, false}, {"nv12", 1, true}, {"yuv420p10le", 2, false}};
+    static const struct
+    {
+        const char *name;
+        int w, h;
+    } sizes[] = {{"720p", 1280, 720}, {"1080p", 1920, 1080}, {"2160p", 3840, 2160}};
+    for (const auto &size : sizes)
+        for (const UploadCase &c : cases)
+        {
+            register_upload(c, size.name, size.w, size.h, true);
+            register_upload(c, size.name, size.w, size.h, false);
+        }
+}
+
+#else
+
+void register_upload_benchmarks()
+{
+    bench_skip("upload", "built without EGL");
+}
+
+#endif
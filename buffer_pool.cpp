@@ -0,0 +1,110 @@
+#include "buffer_pool.h"
+#include <cerrno>
+
+extern "C"
+{
+#include <libavcodec/avcodec.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
+}
+
+// Extra bytes FFmpeg's own pool adds to each plane: 16 bytes of overread slack plus
+// room to realign the data pointer to the widest SIMD stride.
+#define PLANE_PADDING (16 + 64 - 1)
+
+FrameBufferPool::~FrameBufferPool()
+{
+    // Uninit is deferred by FFmpeg until every outstanding buffer has been returned.
+    for (auto &bucket : buckets)
+        av_buffer_pool_uninit(&bucket.second);
+}
+
+void FrameBufferPool::attach(AVCodecContext *ctx)
+{
+    if (ctx->codec_type != AVMEDIA_TYPE_VIDEO || !(ctx->codec->capabilities & AV_CODEC_CAP_DR1))
+        return;
+    ctx->opaque = this;
+    ctx->get_buffer2 = &FrameBufferPool::get_buffer2;
+}
+
+size_t FrameBufferPool::bucket_size(size_t size)
+{
+    size_t pow2 = 4096;
+    while (pow2 < size)
+        pow2 <<= 1;
+    size_t step = pow2 / 8;
+    size_t bucket = pow2 / 2;
+    while (bucket < size)
+        bucket += step;
+    return bucket;
+}
+
+AVBufferRef *FrameBufferPool::get(size_t size)
+{
+    size_t bucket = bucket_size(size);
+    AVBufferPool *pool;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = buckets.find(bucket);
+        if (it == buckets.end())
+            it = buckets.emplace(bucket, av_buffer_pool_init(bucket, nullptr)).first;
+        pool = it->second;
+    }
+    return pool ? av_buffer_pool_get(pool) : nullptr;
+}
+
+int FrameBufferPool::get_buffer2(AVCodecContext *ctx, AVFrame *frame, int flags)
+{
+    FrameBufferPool *self = static_cast<FrameBufferPool *>(ctx->opaque);
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(static_cast<AVPixelFormat>(frame->format));
+    if (!self || !desc || (desc->flags & (AV_PIX_FMT_FLAG_HWACCEL | AV_PIX_FMT_FLAG_PAL)))
+        return avcodec_default_get_buffer2(ctx, frame, flags);
+
+    int w = frame->width, h = frame->height;
+    int linesize_align[AV_NUM_DATA_POINTERS];
+    avcodec_align_dimensions2(ctx, &w, &h, linesize_align);
+
+    // Same stride search as libavcodec's default pool: widen until every plane's
+    // linesize meets the decoder's alignment, without aligning planes individually.
+    int linesize[4];
+    int unaligned;
+    do
+    {
+        int ret = av_image_fill_linesizes(linesize, static_cast<AVPixelFormat>(frame->format), w);
+        if (ret < 0)
+            return ret;
+        w += w & ~(w - 1);
+        unaligned = 0;
+        for (int i = 0; i < 4; i++)
+            unaligned |= linesize[i] % linesize_align[i];
+    } while (unaligned);
+
+    ptrdiff_t linesize1[4];
+    for (int i = 0; i < 4; i++)
+        linesize1[i] = linesize[i];
+    size_t size[4];
+    int ret = av_image_fill_plane_sizes(size, static_cast<AVPixelFormat>(frame->format), h, linesize1);
+    if (ret < 0)
+        return ret;
+
+    int i = 0;
+    for (; i < 4 && size[i]; i++)
+    {
+        frame->buf[i] = self->get(size[i] + PLANE_PADDING);
+        if (!frame->buf[i])
+        {
+            for (int j = 0; j < i; j++)
+                av_buffer_unref(&frame->buf[j]);
+            return AVERROR(ENOMEM);
+        }
+        frame->data[i] = frame->buf[i]->data;
+        frame->linesize[i] = linesize[i];
+    }
+    for (; i < AV_NUM_DATA_POINTERS; i++)
+    {
+        frame->data[i] = nullptr;
+        frame->linesize[i] = 0;
+    }
+    frame->extended_data = frame->data;
+    return 0;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <map>
+#include <mutex>
+
+struct AVCodecContext;
+struct AVFrame;
+struct AVBufferPool;
+struct AVBufferRef;
+
+// ---- FrameBufferPool ----
+// get_buffer2 implementation that serves decoder picture planes from size-bucketed
+// AVBufferPools. Buckets are rounded up (quarter steps between powers of two) so a
+// pool keeps being reused across small size changes, and buffers return to their
+// pool when the last frame referencing them is unref'd.
+class FrameBufferPool
+{
+public:
+    FrameBufferPool() = default;
+    ~FrameBufferPool();
+
+    FrameBufferPool(const FrameBufferPool &) = delete;
+    FrameBufferPool &operator=(const FrameBufferPool &) = delete;
+
+    // Installs the pool on a video decoder. Must be called before avcodec_open2;
+    // the pool has to outlive the codec context.
+    void attach(AVCodecContext *ctx);
+
+private:
+    static int get_buffer2(AVCodecContext *ctx, AVFrame *frame, int flags);
+    static size_t bucket_size(size_t size);
+    AVBufferRef *get(size_t size);
+
+    std::mutex mutex;
+    std::map<size_t, AVBufferPool *> buckets;
+};
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// ---- AudioClock ----
+// Seqlock-published master clock. The audio callback is the only writer: after each
+// fill it stores the stream time being heard at the moment the callback ran together
+// with that moment's system time and how fast stream time passes at the current
+// playback speed. Readers never block the writer; they retry if they raced with a
+// publish and extrapolate from the stamp with the elapsed system time times the rate.
+class AudioClock
+{
+public:
+    void publish(double pts, int64_t stamp_us, double rate = 1.0)
+    {
+        uint32_t s = seq.load(std::memory_order_relaxed);
+        seq.store(s + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        pts_at_stamp.store(pts, std::memory_order_relaxed);
+        stamp.store(stamp_us, std::memory_order_relaxed);
+        speed.store(rate, std::memory_order_relaxed);
+        seq.store(s + 2, std::memory_order_release);
+    }
+
+    // Returns false until the first publish.
+    bool read(int64_t now_us, double &pts) const
+    {
+        double p, r;
+        int64_t t;
+        if (!snapshot(p, t, r))
+            return false;
+        pts = p + (now_us - t) / 1000000.0 * r;
+        return true;
+    }
+
+    // Consistent copy of the last published values, without extrapolation.
+    bool snapshot(double &pts, int64_t &stamp_out, double &rate) const
+    {
+        double p, r;
+        int64_t t;
+        uint32_t s1, s2;
+        do
+        {
+            s1 = seq.load(std::memory_order_acquire);
+            p = pts_at_stamp.load(std::memory_order_relaxed);
+            t = stamp.load(std::memory_order_relaxed);
+            r = speed.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            s2 = seq.load(std::memory_order_relaxed);
+        } while ((s1 & 1) || s1 != s2);
+
+        if (t == 0)
+            return false;
+        pts = p;
+        stamp_out = t;
+        rate = r;
+        return true;
+    }
+
+    void reset()
+    {
+        publish(0.0, 0);
+    }
+
+private:
+    std::atomic<uint32_t> seq{0};
+    std::atomic<double> pts_at_stamp{0.0};
+    std::atomic<int64_t> stamp{0};
+    std::atomic<double> speed{1.0};
+};
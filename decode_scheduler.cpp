@@ -0,0 +1,86 @@
+#include "decode_scheduler.h"
+
+DecodeScheduler::~DecodeScheduler()
+{
+    stop();
+}
+
+size_t DecodeScheduler::add(Job job)
+{
+    jobs.push_back(Entry{std::move(job), State::Parked});
+    return jobs.size() - 1;
+}
+
+void DecodeScheduler::start()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    quit = false;
+    for (size_t i = 0; i < jobs.size(); i++)
+    {
+        jobs[i].state = State::Ready;
+        schedule(i);
+    }
+}
+
+void DecodeScheduler::stop()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    quit = true;
+    idle.wait(lock, [this]
+              { return in_flight == 0; });
+}
+
+void DecodeScheduler::wake(size_t job)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    Entry &e = jobs[job];
+    if (e.state == State::Parked && !quit)
+    {
+        e.state = State::Ready;
+        schedule(job);
+    }
+    else if (e.state == State::Running)
+        e.state = State::RunningWoken;
+}
+
+// Called with mutex held, for a job that just became Ready.
+void DecodeScheduler::schedule(size_t job)
+{
+    in_flight++;
+    pool.submit([this, job]
+                { run_quantum(job); });
+}
+
+void DecodeScheduler::run_quantum(size_t job)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    if (quit)
+    {
+        jobs[job].state = State::Parked;
+        if (--in_flight == 0)
+            idle.notify_all();
+        return;
+    }
+    jobs[job].state = State::Running;
+
+    lock.unlock();
+    bool again = jobs[job].run();
+    lock.lock();
+
+    // A wake during the run may have been for data the run did not see.
+    Entry &e = jobs[job];
+    if ((again || e.state == State::RunningWoken) && !quit)
+    {
+        // Resubmitted from a pool worker, so it lands at the back of that worker's
+        // deque, behind the jobs already queued there.
+        e.state = State::Ready;
+        in_flight--;
+        schedule(job);
+    }
+    else
+    {
+        e.state = State::Parked;
+        if (--in_flight == 0)
+            idle.notify_all();
+    }
+}
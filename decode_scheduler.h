@@ -0,0 +1,63 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <vector>
+#include "work_pool.h"
+
+// ---- DecodeScheduler ----
+// Runs many decode jobs on the shared WorkStealingPool, instead of a demux and a
+// decode thread (plus a codec thread pool) per input. A job runs one quantum at a
+// time and never on two workers at once. It returns true to be queued again behind
+// the other ready jobs, or false to park until wake() is called, e.g. once its
+// consumer has made room.
+class DecodeScheduler
+{
+public:
+    using Job = std::function<bool()>;
+
+    explicit DecodeScheduler(WorkStealingPool &pool = WorkStealingPool::shared()) : pool(pool) {}
+    ~DecodeScheduler();
+
+    DecodeScheduler(const DecodeScheduler &) = delete;
+    DecodeScheduler &operator=(const DecodeScheduler &) = delete;
+
+    // Registers a job, parked. Only before start().
+    size_t add(Job job);
+
+    // Queues every job. stop() returns once no quantum is running any more.
+    void start();
+    void stop();
+
+    // Any thread: queue a parked job, or have a running one run once more.
+    void wake(size_t job);
+
+    unsigned worker_count() const { return pool.size(); }
+
+private:
+    enum class State
+    {
+        Parked,
+        Ready,
+        Running,
+        RunningWoken,
+    };
+
+    struct Entry
+    {
+        Job run;
+        State state = State::Parked;
+    };
+
+    void schedule(size_t job);
+    void run_quantum(size_t job);
+
+    WorkStealingPool &pool;
+    std::vector<Entry> jobs;
+    std::mutex mutex;
+    std::condition_variable idle;
+    int in_flight = 0; // jobs Ready or Running, guarded by mutex
+    bool quit = false;
+};
@@ -0,0 +1,39 @@
+#include "decode_slot.h"
+#include <stdexcept>
+
+extern "C"
+{
+#include <libavcodec/avcodec.h>
+#include <libswscale/swscale.h>
+}
+
+DecodeSlot::~DecodeSlot()
+{
+    sws_freeContext(sws_ctx);
+    av_frame_free(&frame);
+    av_packet_free(&packet);
+    input.reset();
+}
+
+void DecodeSlot::open(const std::string &file, const PlayerOptions &options, FrameBufferPool &buffer_pool)
+{
+    input.reset(new MediaInput());
+    input->open(file, options, buffer_pool);
+    packet = av_packet_alloc();
+    frame = av_frame_alloc();
+    if (!packet || !frame)
+        throw std::runtime_error("Could not allocate packet or frame.");
+}
+
+void set_sws_source_colorspace(SwsContext *ctx, const AVFrame *frame, int &colorspace, int &range)
+{
+    int cs = frame->colorspace == AVCOL_SPC_BT709                                                      ? SWS_CS_ITU709
+             : (frame->colorspace == AVCOL_SPC_BT2020_NCL || frame->colorspace == AVCOL_SPC_BT2020_CL) ? SWS_CS_BT2020
+                                                                                                       : SWS_CS_DEFAULT;
+    int full_range = frame->color_range == AVCOL_RANGE_JPEG;
+    if (cs == colorspace && full_range == range)
+        return;
+    sws_setColorspaceDetails(ctx, sws_getCoefficients(cs), full_range, sws_getCoefficients(SWS_CS_DEFAULT), 1, 0, 1 << 16, 1 << 16);
+    colorspace = cs;
+    range = full_range;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include "player_options.h"
+#include "buffer_pool.h"
+#include "media_input.h"
+
+struct AVFrame;
+struct AVPacket;
+struct SwsContext;
+
+// ---- DecodeSlot ----
+// What one pool thread of a batch tool (thumbnails, export) keeps between jobs: its
+// own MediaInput on the file with a single-threaded decoder, a packet and frame to
+// decode into, and a cached SwsContext with the source colourspace it was set up for.
+struct DecodeSlot
+{
+    DecodeSlot() = default;
+    ~DecodeSlot();
+
+    DecodeSlot(const DecodeSlot &) = delete;
+    DecodeSlot &operator=(const DecodeSlot &) = delete;
+
+    // Throws std::runtime_error if the file cannot be opened.
+    void open(const std::string &file, const PlayerOptions &options, FrameBufferPool &buffer_pool);
+
+    std::unique_ptr<MediaInput> input;
+    AVPacket *packet = nullptr;
+    AVFrame *frame = nullptr;
+    SwsContext *sws_ctx = nullptr;
+    int sws_colorspace = -1;
+    int sws_range = -1;
+    int64_t decoded = 0;
+};
+
+// swscale defaults to BT.601 limited range. Tells ctx the matrix and range frame
+// really has, unless colorspace and range say ctx already has them; both are -1
+// for a context that was never set up.
+void set_sws_source_colorspace(SwsContext *ctx, const AVFrame *frame, int &colorspace, int &range);
@@ -0,0 +1,335 @@
+#include "frame_export.h"
+#include "work_pool.h"
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+
+extern "C"
+{
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
+#include <libswscale/swscale.h>
+}
+
+// GOPs shorter than this (intra-only or very short GOPs) are merged into one
+// segment, so seeking and warming up a decoder stays small next to the decoding.
+#define MIN_SEGMENT_FRAMES 30
+
+FrameExporter::FrameExporter(const std::string &file, const PlayerOptions &opts) : filename(file), options(opts) {}
+
+FrameExporter::~FrameExporter()
+{
+    slots.clear();
+    if (out && out != stdout)
+        fclose(out);
+}
+
+FrameExporter::Slot::~Slot()
+{
+    avcodec_free_context(&encoder);
+    av_frame_free(&rgb);
+    av_packet_free(&encoded);
+}
+
+void FrameExporter::open_slot(Slot &slot)
+{
+    slot.open(filename, options, buffer_pool);
+    if (png)
+    {
+        slot.rgb = av_frame_alloc();
+        slot.encoded = av_packet_alloc();
+        if (!slot.rgb || !slot.encoded)
+            throw std::runtime_error("Could not allocate packet or frame.");
+    }
+}
+
+void FrameExporter::run()
+{
+    auto wall_start = std::chrono::steady_clock::now();
+    WorkStealingPool &pool = WorkStealingPool::shared();
+    for (unsigned i = 0; i < std::max(1u, pool.size()); i++)
+        slots.push_back(std::make_unique<Slot>());
+
+    const std::string &path = options.export_path;
+    png = path.size() > 4 && path.compare(path.size() - 4, 4, ".png") == 0;
+    if (png && path.find('%') != std::string::npos && png_path(1).empty())
+        throw std::runtime_error("PNG pattern " + path + " must contain exactly one %d (e.g. %06d); write %% for a literal %.");
+    open_slot(*slots[0]);
+    MediaInput &first = *slots[0]->input;
+    if (!first.keyframe_index.ready())
+    {
+        std::atomic<bool> cancel{false};
+        first.keyframe_index.build(filename, first.video_stream_index, cancel);
+    }
+    plan_segments();
+
+    if (!png)
+    {
+        out = path == "-" ? stdout : fopen(path.c_str(), "wb");
+        if (!out)
+            throw std::runtime_error("Could not open " + path);
+    }
+
+    std::thread writer(&FrameExporter::writer_entry, this);
+    pool.parallel_for((int)segments.size(), (int)slots.size(), [&](int index, int s)
+                      {
+                          Slot &slot = *slots[s];
+                          bool ok = false;
+                          try
+                          {
+                              if (!stop && !slot.input)
+                                  open_slot(slot);
+                              ok = !stop && decode_segment(slot, index);
+                          }
+                          catch (const std::exception &e)
+                          {
+                              std::lock_guard<std::mutex> lock(reorder_mutex);
+                              error = e.what();
+                          }
+                          finish(index, ok); });
+    writer.join();
+
+    if (out)
+    {
+        bool flushed = fflush(out) == 0;
+        if (out != stdout)
+            flushed = fclose(out) == 0 && flushed;
+        out = nullptr;
+        if (!flushed && error.empty())
+            error = "Could not write " + path;
+    }
+
+    int failed = 0;
+    for (const Segment &seg : segments)
+        failed += seg.failed;
+    int64_t decoded = 0;
+    int threads = 0;
+    for (const auto &slot : slots)
+    {
+        decoded += slot->decoded;
+        threads += slot->input != nullptr;
+    }
+    if (written == 0 || stop)
+        throw std::runtime_error(error.empty() ? "No frame could be exported." : error);
+
+    // stdout may carry the frames, so the report goes to stderr.
+    const AVCodecParameters *par = first.video_stream->codecpar;
+    const char *format = av_get_pix_fmt_name(png ? AV_PIX_FMT_RGB24 : static_cast<AVPixelFormat>(par->format));
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+    std::cerr << std::fixed << std::setprecision(2)
+              << "Export: " << written << " frames " << par->width << "x" << par->height << " " << (format ? format : "?")
+              << (png ? " as PNG, " : " raw, ") << written_bytes / 1048576.0 << " MB from " << segments.size()
+              << " segments; " << decoded << " frames decoded by " << threads << " threads in " << wall << " s ("
+              << (wall > 0 ? written / wall : 0.0) << " fps), reorder buffer peak " << peak_buffered / 1048576.0 << " MB"
+              << std::endl;
+    if (failed > 0)
+        std::cerr << failed << " segment(s) could not be decoded completely" << (error.empty() ? "" : ": " + error) << std::endl;
+}
+
+// One segment per GOP, or per run of GOPs up to MIN_SEGMENT_FRAMES. Without an
+// index (a stream that cannot be scanned) the whole file is one segment.
+void FrameExporter::plan_segments()
+{
+    const std::vector<KeyframeEntry> &keys = slots[0]->input->keyframe_index.keyframes();
+    if (keys.empty())
+    {
+        segments.resize(1);
+        return;
+    }
+    for (const KeyframeEntry &key : keys)
+    {
+        if (!segments.empty() && key.frame - segments.back().key->frame < MIN_SEGMENT_FRAMES)
+            continue;
+        if (!segments.empty())
+            segments.back().end_pts = key.pts;
+        segments.emplace_back();
+        segments.back().key = &key;
+        // The first segment also keeps whatever decodes before its keyframe.
+        segments.back().start_pts = segments.size() == 1 ? INT64_MIN : key.pts;
+    }
+}
+
+bool FrameExporter::decode_segment(Slot &slot, int index)
+{
+    const Segment &seg = segments[index];
+    bool ok = true;
+    int64_t decoded = slot.input->decode_until(seg.key, seg.start_pts, seg.end_pts, slot.packet, slot.frame, stop, [&](AVFrame *)
+                                               {
+                                                   std::vector<uint8_t> data;
+                                                   if (convert(slot, data))
+                                                       deliver(index, std::move(data));
+                                                   else
+                                                       ok = false; });
+    if (decoded < 0)
+        return false;
+    slot.decoded += decoded;
+    return ok && !stop;
+}
+
+bool FrameExporter::convert(Slot &slot, std::vector<uint8_t> &data)
+{
+    if (png)
+        return encode_png(slot, data);
+    const AVFrame *frame = slot.frame;
+    AVPixelFormat format = static_cast<AVPixelFormat>(frame->format);
+    int size = av_image_get_buffer_size(format, frame->width, frame->height, 1);
+    if (size < 0)
+        return false;
+    data.resize(size);
+    return av_image_copy_to_buffer(data.data(), size, (const uint8_t *const *)frame->data, frame->linesize,
+                                   format, frame->width, frame->height, 1) >= 0;
+}
+
+bool FrameExporter::encode_png(Slot &slot, std::vector<uint8_t> &data)
+{
+    AVFrame *frame = slot.frame;
+    AVFrame *rgb = slot.rgb;
+    if (rgb->width != frame->width || rgb->height != frame->height)
+    {
+        av_frame_unref(rgb);
+        avcodec_free_context(&slot.encoder);
+        rgb->format = AV_PIX_FMT_RGB24;
+        rgb->width = frame->width;
+        rgb->height = frame->height;
+        if (av_frame_get_buffer(rgb, 0) < 0)
+            return false;
+    }
+    if (!slot.encoder)
+    {
+        const AVCodec *codec = avcodec_find_encoder(AV_CODEC_ID_PNG);
+        slot.encoder = codec ? avcodec_alloc_context3(codec) : nullptr;
+        if (!slot.encoder)
+            return false;
+        slot.encoder->width = rgb->width;
+        slot.encoder->height = rgb->height;
+        slot.encoder->pix_fmt = AV_PIX_FMT_RGB24;
+        slot.encoder->time_base = AVRational{1, 1};
+        slot.encoder->thread_count = 1;
+        if (avcodec_open2(slot.encoder, codec, nullptr) < 0)
+        {
+            avcodec_free_context(&slot.encoder);
+            return false;
+        }
+    }
+
+    SwsContext *prev = slot.sws_ctx;
+    slot.sws_ctx = sws_getCachedContext(slot.sws_ctx, frame->width, frame->height, static_cast<AVPixelFormat>(frame->format),
+                                        rgb->width, rgb->height, AV_PIX_FMT_RGB24, SWS_BILINEAR, nullptr, nullptr, nullptr);
+    if (!slot.sws_ctx)
+        return false;
+    if (slot.sws_ctx != prev)
+        slot.sws_colorspace = slot.sws_range = -1;
+    set_sws_source_colorspace(slot.sws_ctx, frame, slot.sws_colorspace, slot.sws_range);
+    // The encoder may still reference the previous picture.
+    if (av_frame_make_writable(rgb) < 0)
+        return false;
+    sws_scale(slot.sws_ctx, (const uint8_t *const *)frame->data, frame->linesize, 0, frame->height, rgb->data, rgb->linesize);
+
+    if (avcodec_send_frame(slot.encoder, rgb) < 0)
+        return false;
+    bool got = avcodec_receive_packet(slot.encoder, slot.encoded) == 0;
+    if (got)
+    {
+        data.assign(slot.encoded->data, slot.encoded->data + slot.encoded->size);
+        av_packet_unref(slot.encoded);
+    }
+    return got;
+}
+
+void FrameExporter::deliver(int index, std::vector<uint8_t> &&data)
+{
+    int64_t size = (int64_t)data.size();
+    std::unique_lock<std::mutex> lock(reorder_mutex);
+    Segment &seg = segments[index];
+    // The segment being written only waits while the writer still has some of its
+    // frames, so the writer never waits on a stalled decoder.
+    reorder_cond.wait(lock, [&]
+                      { return stop || buffered + size <= options.export_buffer_bytes || (index == head && seg.frames.empty()); });
+    if (stop)
+        return;
+    seg.frames.push_back(std::move(data));
+    buffered += size;
+    peak_buffered = std::max(peak_buffered, buffered);
+    lock.unlock();
+    reorder_cond.notify_all();
+}
+
+void FrameExporter::finish(int index, bool ok)
+{
+    {
+        std::lock_guard<std::mutex> lock(reorder_mutex);
+        segments[index].done = true;
+        segments[index].failed = !ok;
+    }
+    reorder_cond.notify_all();
+}
+
+std::string FrameExporter::png_path(int64_t number) const
+{
+    const std::string &path = options.export_path;
+    char name[4096];
+    // The path is never used as a printf format: libavformat only expands %d, %0Nd
+    // and %%, and fails unless there is exactly one number.
+    if (path.find('%') != std::string::npos)
+        return av_get_frame_filename2(name, sizeof(name), path.c_str(), (int)number, 0) < 0 ? std::string() : name;
+    snprintf(name, sizeof(name), "%s-%06d.png", path.substr(0, path.size() - 4).c_str(), (int)number);
+    return name;
+}
+
+void FrameExporter::writer_entry()
+{
+    for (int index = 0; index < (int)segments.size(); index++)
+    {
+        Segment &seg = segments[index];
+        while (true)
+        {
+            std::vector<uint8_t> data;
+            {
+                std::unique_lock<std::mutex> lock(reorder_mutex);
+                reorder_cond.wait(lock, [&]
+                                  { return stop || seg.done || !seg.frames.empty(); });
+                if (stop)
+                    return;
+                if (seg.frames.empty())
+                {
+                    head = index + 1;
+                    break;
+                }
+                data.swap(seg.frames.front());
+                seg.frames.pop_front();
+                buffered -= (int64_t)data.size();
+            }
+            reorder_cond.notify_all();
+
+            std::string target = png ? png_path(written + 1) : options.export_path;
+            bool ok;
+            if (png)
+            {
+                FILE *file = fopen(target.c_str(), "wb");
+                ok = file && fwrite(data.data(), 1, data.size(), file) == data.size();
+                if (file)
+                    ok = fclose(file) == 0 && ok;
+            }
+            else
+                ok = fwrite(data.data(), 1, data.size(), out) == data.size();
+            if (!ok)
+            {
+                {
+                    std::lock_guard<std::mutex> lock(reorder_mutex);
+                    error = "Could not write " + target;
+                    stop = true;
+                }
+                reorder_cond.notify_all();
+                return;
+            }
+            written++;
+            written_bytes += (int64_t)data.size();
+        }
+        reorder_cond.notify_all();
+    }
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "player_options.h"
+#include "buffer_pool.h"
+#include "decode_slot.h"
+
+struct AVCodecContext;
+struct AVFrame;
+struct AVPacket;
+
+// ---- FrameExporter ----
+// Non-interactive full decode of the first file's video, every frame in pts order,
+// as raw frames in the decoder's pixel format (to a file or "-" for stdout) or as a
+// PNG sequence. The keyframe index cuts the file into segments of whole GOPs, which
+// the shared WorkStealingPool decodes at once, each thread on its own MediaInput
+// with a single-threaded decoder. A segment keeps the frames whose pts lie between
+// its first keyframe and the next segment's; it decodes on past its end until the
+// decoder passes that pts, so the leading frames of an open GOP come from the
+// segment that holds their references. Finished frames are converted on the
+// decoding thread and queued per segment; one writer thread takes them in segment
+// order. At most export_buffer_bytes wait in these queues: a segment other than
+// the one being written stalls when they are full.
+class FrameExporter
+{
+public:
+    FrameExporter(const std::string &file, const PlayerOptions &opts);
+    ~FrameExporter();
+
+    // Throws std::runtime_error if the file cannot be opened or nothing is exported.
+    void run();
+
+private:
+    struct Slot : DecodeSlot
+    {
+        ~Slot();
+
+        // PNG only: the RGB24 picture sws_ctx converts to, and its encoder.
+        AVFrame *rgb = nullptr;
+        AVCodecContext *encoder = nullptr;
+        AVPacket *encoded = nullptr;
+    };
+
+    struct Segment
+    {
+        const KeyframeEntry *key = nullptr; // nullptr: decode from the start as opened
+        int64_t start_pts = INT64_MIN;
+        int64_t end_pts = INT64_MAX;
+        std::deque<std::vector<uint8_t>> frames;
+        bool done = false;
+        bool failed = false;
+    };
+
+    void open_slot(Slot &slot);
+    void plan_segments();
+    bool decode_segment(Slot &slot, int index);
+    bool convert(Slot &slot, std::vector<uint8_t> &data);
+    bool encode_png(Slot &slot, std::vector<uint8_t> &data);
+    void deliver(int index, std::vector<uint8_t> &&data);
+    void finish(int index, bool ok);
+    void writer_entry();
+    // Name of PNG number; empty if the export path is not a valid pattern.
+    std::string png_path(int64_t number) const;
+
+    std::string filename;
+    PlayerOptions options;
+    FrameBufferPool buffer_pool;
+    std::vector<std::unique_ptr<Slot>> slots;
+    std::vector<Segment> segments;
+    bool png = false;
+
+    // Reorder queues, guarded by reorder_mutex.
+    std::mutex reorder_mutex;
+    std::condition_variable reorder_cond;
+    int head = 0; // segment being written
+    int64_t buffered = 0;
+    int64_t peak_buffered = 0;
+
+    FILE *out = nullptr;
+    int64_t written = 0;
+    int64_t written_bytes = 0;
+    std::atomic<bool> stop{false};
+    std::string error;
+};
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+extern "C"
+{
+#include <libavcodec/avcodec.h>
+}
+
+// ---- FrameSkipController ----
+// Degrades video decoding while video falls behind the audio clock, so late frames
+// are never decoded in the first place instead of being decoded and then dropped by
+// the renderer. The render thread reports the lag of each frame it schedules; the
+// video decode thread calls update() between packets and applies the level to its
+// codec context:
+//   1  skip the loop filter on every frame
+//   2  also skip frames no other frame references
+//   3  decode keyframes only
+// A level is raised when video lags by more than ESCALATE_LAG while the frame queue
+// is running dry (so decoding, not presentation, is what is slow), at most once per
+// ESCALATE_HOLD_US to let the previous step take effect. It is lowered one step once
+// the lag has stayed under RECOVER_LAG for RECOVER_HOLD_US.
+//
+// Independently of the level, non-reference frames are skipped while playback is
+// faster than the display can show every frame (set_skip_nonref).
+class FrameSkipController
+{
+public:
+    static constexpr int LEVELS = 4;
+
+    // Render thread: video pts minus audio clock of the frame being scheduled.
+    void report_lag(double diff)
+    {
+        lag.store(diff < 0 ? -diff : 0.0, std::memory_order_relaxed);
+    }
+
+    // Event thread: whether frames no other frame references are decoded at all.
+    void set_skip_nonref(bool skip)
+    {
+        nonref_wanted.store(skip, std::memory_order_relaxed);
+    }
+
+    // Decode thread: back to full decoding, e.g. after a seek.
+    void reset(AVCodecContext *ctx, int64_t now_us)
+    {
+        lag.store(0.0, std::memory_order_relaxed);
+        skip_nonref = nonref_wanted.load(std::memory_order_relaxed);
+        level = 0;
+        last_change_us = now_us;
+        caught_up_since_us = now_us;
+        apply(ctx);
+    }
+
+    // Decode thread: re-evaluates the level and applies it to ctx. Returns true if the
+    // level went up.
+    bool update(AVCodecContext *ctx, size_t queued_frames, size_t queue_capacity, int64_t now_us)
+    {
+        if (nonref_wanted.load(std::memory_order_relaxed) != skip_nonref)
+        {
+            skip_nonref = !skip_nonref;
+            apply(ctx);
+        }
+
+        double behind = lag.load(std::memory_order_relaxed);
+        if (behind < RECOVER_LAG)
+        {
+            if (caught_up_since_us < 0)
+                caught_up_since_us = now_us;
+        }
+        else
+            caught_up_since_us = -1;
+
+        if (behind > ESCALATE_LAG && queued_frames * 4 < queue_capacity && level < LEVELS - 1 &&
+            now_us - last_change_us >= ESCALATE_HOLD_US)
+        {
+            level++;
+            last_change_us = now_us;
+            apply(ctx);
+            return true;
+        }
+        if (level > 0 && caught_up_since_us >= 0 && now_us - caught_up_since_us >= RECOVER_HOLD_US &&
+            now_us - last_change_us >= RECOVER_HOLD_US)
+        {
+            level--;
+            last_change_us = now_us;
+            caught_up_since_us = now_us;
+            apply(ctx);
+        }
+        return false;
+    }
+
+    // Decode thread: puts the current level on a context, e.g. the next playlist entry's.
+    void apply(AVCodecContext *ctx) const
+    {
+        ctx->skip_loop_filter = level >= 1 ? AVDISCARD_ALL : AVDISCARD_DEFAULT;
+        ctx->skip_frame = level >= 3                  ? AVDISCARD_NONKEY
+                          : level >= 2 || skip_nonref ? AVDISCARD_NONREF
+                                                      : AVDISCARD_DEFAULT;
+    }
+
+    int current_level() const { return level; }
+
+private:
+    static constexpr double ESCALATE_LAG = 0.15;
+    static constexpr double RECOVER_LAG = 0.04;
+    static constexpr int64_t ESCALATE_HOLD_US = 500000;
+    static constexpr int64_t RECOVER_HOLD_US = 3000000;
+
+    std::atomic<double> lag{0.0}; // seconds video is behind audio, written by the render thread
+    std::atomic<bool> nonref_wanted{false};
+    int level = 0;
+    bool skip_nonref = false;
+    int64_t last_change_us = 0;
+    int64_t caught_up_since_us = -1;
+};
@@ -0,0 +1,204 @@
+#include "gop_cache.h"
+#include "queue.h"
+#include "trace.h"
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+
+extern "C"
+{
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+}
+
+// Prefetches older than this many requests are dropped; reverse playback only ever
+// needs the next one or two.
+#define MAX_PREFETCHES 2
+
+GopCache::Gop::~Gop()
+{
+    for (AVFrame *&f : frames)
+        av_frame_free(&f);
+}
+
+GopCache::~GopCache()
+{
+    stop();
+}
+
+void GopCache::attach(const std::shared_ptr<MediaInput> &src, const PlayerOptions &opts)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (src != source)
+    {
+        source = src;
+        options = opts;
+        generation++;
+        gops.clear();
+        wanted.clear();
+        prefetches.clear();
+        bytes = 0;
+    }
+    if (!thread.joinable() && !quit)
+        thread = std::thread(&GopCache::decoder_entry, this);
+}
+
+std::shared_ptr<const GopCache::Gop> GopCache::get(int k)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = gops.find(k);
+    if (it != gops.end())
+    {
+        it->second.last_used = ++use_clock;
+        hits.fetch_add(1, std::memory_order_relaxed);
+        return it->second.gop;
+    }
+    if (std::find(wanted.begin(), wanted.end(), k) == wanted.end())
+    {
+        wanted.push_back(k);
+        misses.fetch_add(1, std::memory_order_relaxed);
+        cond.notify_all();
+    }
+    return nullptr;
+}
+
+void GopCache::prefetch(int k)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!source || k < 0 || k >= (int)source->keyframe_index.size() || gops.count(k) ||
+        std::find(wanted.begin(), wanted.end(), k) != wanted.end() ||
+        std::find(prefetches.begin(), prefetches.end(), k) != prefetches.end())
+        return;
+    prefetches.push_back(k);
+    while (prefetches.size() > MAX_PREFETCHES)
+        prefetches.pop_front();
+    cond.notify_all();
+}
+
+void GopCache::wait(int ms)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    cond.wait_for(lock, std::chrono::milliseconds(ms));
+}
+
+void GopCache::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        quit = true;
+    }
+    cond.notify_all();
+    if (thread.joinable())
+        thread.join();
+    std::lock_guard<std::mutex> lock(mutex);
+    gops.clear();
+    bytes = 0;
+    source.reset();
+}
+
+void GopCache::decoder_entry()
+{
+    Tracer::set_thread_name("gop decode");
+    packet = av_packet_alloc();
+    frame = av_frame_alloc();
+    while (packet && frame)
+    {
+        int k, gen;
+        std::shared_ptr<MediaInput> src;
+        PlayerOptions opts;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cond.wait(lock, [this]
+                      { return quit || !wanted.empty() || !prefetches.empty(); });
+            if (quit)
+                break;
+            std::deque<int> &queue = wanted.empty() ? prefetches : wanted;
+            k = queue.front();
+            queue.pop_front();
+            if (gops.count(k))
+                continue;
+            src = source;
+            gen = generation;
+            opts = options;
+        }
+
+        std::shared_ptr<Gop> gop;
+        try
+        {
+            if (!input || input_source != src)
+            {
+                // Video only and single-threaded, like the other decoders that run next
+                // to playback. A fresh pool too: frames the player still holds keep the old one
+                // alive until they are released, then it goes.
+                input.reset();
+                input_pool.reset(new FrameBufferPool());
+                input_source = src;
+                input.reset(new MediaInput());
+                input->open(src->filename, opts, *input_pool, MediaInput::Role::Background);
+            }
+            gop = decode(*src, k);
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "GOP decoder: " << e.what() << std::endl;
+            input.reset();
+            gop = std::make_shared<Gop>();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (gen == generation)
+            {
+                gops[k] = Entry{gop, ++use_clock};
+                bytes += gop->bytes;
+                evict(k);
+            }
+            wanted.erase(std::remove(wanted.begin(), wanted.end(), k), wanted.end());
+        }
+        decoded.fetch_add(1, std::memory_order_relaxed);
+        cond.notify_all();
+    }
+    input.reset();
+    input_pool.reset();
+    input_source.reset();
+    av_frame_free(&frame);
+    av_packet_free(&packet);
+}
+
+// The leading frames of the next GOP, if it is open, belong to this one; decoding
+// runs on until they are out.
+std::shared_ptr<GopCache::Gop> GopCache::decode(MediaInput &src, int k)
+{
+    auto gop = std::make_shared<Gop>();
+    const std::vector<KeyframeEntry> &keys = src.keyframe_index.keyframes();
+    if (k < 0 || k >= (int)keys.size())
+        return gop;
+    int64_t start = k == 0 ? INT64_MIN : keys[k].pts;
+    int64_t end = k + 1 < (int)keys.size() ? keys[k + 1].pts : INT64_MAX;
+    input->decode_until(&keys[k], start, end, packet, frame, quit, [&](AVFrame *out)
+                        {
+                            AVFrame *kept = av_frame_alloc();
+                            if (!kept)
+                                return;
+                            av_frame_move_ref(kept, out);
+                            gop->bytes += FrameTraits::bytes(kept);
+                            gop->frames.push_back(kept); });
+    std::stable_sort(gop->frames.begin(), gop->frames.end(), [](const AVFrame *a, const AVFrame *b)
+                     { return a->best_effort_timestamp < b->best_effort_timestamp; });
+    return gop;
+}
+
+// Over budget, drops the least recently used GOPs other than keep.
+void GopCache::evict(int keep)
+{
+    while (bytes > options.gop_cache_bytes && gops.size() > 1)
+    {
+        auto victim = gops.end();
+        for (auto it = gops.begin(); it != gops.end(); ++it)
+            if (it->first != keep && (victim == gops.end() || it->second.last_used < victim->second.last_used))
+                victim = it;
+        bytes -= victim->second.gop->bytes;
+        gops.erase(victim);
+    }
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "player_options.h"
+#include "buffer_pool.h"
+#include "media_input.h"
+
+struct AVFrame;
+struct AVPacket;
+
+// ---- GopCache ----
+// Decoded GOPs of the input being shown, for paused frame stepping and reverse
+// playback. GOP k is everything from keyframe k of the input's keyframe index up to
+// keyframe k + 1, in pts order. A look-behind decoder thread with its own demuxer
+// and decoder on the same file decodes GOPs on request: those get() is waiting for
+// first, then the ones prefetch() asked for, so GOP k - 1 is ready by the time
+// reverse playback reaches the start of GOP k. At most budget bytes of frames are
+// kept; the least recently used GOPs go first, but never the last one decoded. The
+// decoder allocates from a buffer pool of its own: evicted frames are reused for the
+// next GOP rather than parked in the player's pool, and the pool is torn down when
+// the decoder moves to another source and on stop().
+class GopCache
+{
+public:
+    struct Gop
+    {
+        Gop() = default;
+        ~Gop();
+        Gop(const Gop &) = delete;
+        Gop &operator=(const Gop &) = delete;
+
+        std::vector<AVFrame *> frames; // pts order, stream time base; empty if undecodable
+        int64_t bytes = 0;
+    };
+
+    GopCache() = default;
+    ~GopCache();
+
+    GopCache(const GopCache &) = delete;
+    GopCache &operator=(const GopCache &) = delete;
+
+    // Serves GOPs of source from now on; a different source drops everything cached.
+    void attach(const std::shared_ptr<MediaInput> &source, const PlayerOptions &options);
+
+    // GOP k if it is decoded. Otherwise nullptr, and k is decoded before any prefetch.
+    std::shared_ptr<const Gop> get(int k);
+
+    // Queues k behind the GOPs get() waits for, unless it is cached or out of range.
+    void prefetch(int k);
+
+    // Blocks until the decoder finishes a GOP or ms have passed.
+    void wait(int ms);
+
+    void stop();
+
+    std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> misses{0};
+    std::atomic<uint64_t> decoded{0};
+
+private:
+    struct Entry
+    {
+        std::shared_ptr<const Gop> gop;
+        uint64_t last_used = 0;
+    };
+
+    void decoder_entry();
+    std::shared_ptr<Gop> decode(MediaInput &src, int k);
+    void evict(int keep);
+
+    // Decoder thread only.
+    std::unique_ptr<FrameBufferPool> input_pool; // input's decoder allocates from it
+    std::unique_ptr<MediaInput> input;
+    std::shared_ptr<MediaInput> input_source; // what input was opened for
+    AVPacket *packet = nullptr;
+    AVFrame *frame = nullptr;
+
+    // Guarded by mutex.
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::shared_ptr<MediaInput> source;
+    PlayerOptions options;
+    int generation = 0; // bumped by every new source
+    std::map<int, Entry> gops;
+    std::deque<int> wanted;
+    std::deque<int> prefetches;
+    uint64_t use_clock = 0;
+    int64_t bytes = 0;
+    std::atomic<bool> quit{false};
+    std::thread thread;
+};
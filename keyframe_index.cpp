@@ -0,0 +1,172 @@
+#include "keyframe_index.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sys/stat.h>
+
+extern "C"
+{
+#include <libavformat/avformat.h>
+}
+
+namespace
+{
+const char SIDECAR_MAGIC[8] = {'K', 'F', 'I', 'D', 'X', '0', '1', '\0'};
+
+struct SidecarHeader
+{
+    char magic[8];
+    uint64_t file_size;
+    int64_t file_mtime;
+    int32_t stream_index;
+    int32_t reserved;
+    uint64_t count;
+};
+}
+
+std::string KeyframeIndex::sidecar_path(const std::string &media_path)
+{
+    return media_path + ".kfidx";
+}
+
+bool KeyframeIndex::file_key(const std::string &media_path, uint64_t &size, int64_t &mtime)
+{
+    struct stat st;
+    if (stat(media_path.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+        return false;
+    size = st.st_size;
+    mtime = st.st_mtime;
+    return true;
+}
+
+bool KeyframeIndex::load(const std::string &media_path, int stream_index)
+{
+    uint64_t size;
+    int64_t mtime;
+    if (!file_key(media_path, size, mtime))
+        return false;
+
+    std::string path = sidecar_path(media_path);
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+        return false;
+    std::ifstream in(path, std::ios::binary);
+    SidecarHeader header;
+    if (!in.read(reinterpret_cast<char *>(&header), sizeof(header)))
+        return false;
+    if (memcmp(header.magic, SIDECAR_MAGIC, sizeof(SIDECAR_MAGIC)) != 0 ||
+        header.file_size != size || header.file_mtime != mtime || header.stream_index != stream_index)
+        return false;
+
+    // A truncated or corrupt sidecar must not size the allocation below.
+    uint64_t body = (uint64_t)st.st_size - sizeof(header);
+    if (header.count == 0 || body % sizeof(KeyframeEntry) != 0 || body / sizeof(KeyframeEntry) != header.count)
+        return false;
+
+    std::vector<KeyframeEntry> loaded(header.count);
+    if (!in.read(reinterpret_cast<char *>(loaded.data()), loaded.size() * sizeof(KeyframeEntry)))
+        return false;
+    for (size_t i = 1; i < loaded.size(); i++)
+    {
+        if (loaded[i].pts < loaded[i - 1].pts)
+            return false;
+    }
+
+    entries.swap(loaded);
+    is_ready.store(true, std::memory_order_release);
+    return true;
+}
+
+bool KeyframeIndex::save(const std::string &media_path, int stream_index) const
+{
+    SidecarHeader header;
+    memcpy(header.magic, SIDECAR_MAGIC, sizeof(SIDECAR_MAGIC));
+    if (!file_key(media_path, header.file_size, header.file_mtime))
+        return false;
+    header.stream_index = stream_index;
+    header.reserved = 0;
+    header.count = entries.size();
+
+    // Write-then-rename so a concurrent open never sees a partial index.
+    std::string path = sidecar_path(media_path);
+    std::string tmp = path + ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char *>(entries.data()), entries.size() * sizeof(KeyframeEntry));
+        if (!out)
+        {
+            out.close();
+            std::remove(tmp.c_str());
+            return false;
+        }
+    }
+    return std::rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+bool KeyframeIndex::build(const std::string &media_path, int stream_index, const std::atomic<bool> &cancel)
+{
+    AVFormatContext *ctx = nullptr;
+    if (avformat_open_input(&ctx, media_path.c_str(), nullptr, nullptr) != 0)
+    {
+        has_failed.store(true, std::memory_order_release);
+        return false;
+    }
+    // Streams of some containers only appear while probing.
+    if ((unsigned)stream_index >= ctx->nb_streams)
+        avformat_find_stream_info(ctx, nullptr);
+    if ((unsigned)stream_index >= ctx->nb_streams)
+    {
+        avformat_close_input(&ctx);
+        has_failed.store(true, std::memory_order_release);
+        return false;
+    }
+    for (unsigned int i = 0; i < ctx->nb_streams; i++)
+        ctx->streams[i]->discard = (int)i == stream_index ? AVDISCARD_DEFAULT : AVDISCARD_ALL;
+
+    AVPacket *pkt = av_packet_alloc();
+    std::vector<KeyframeEntry> scanned;
+    int64_t frame = 0;
+    int ret = 0;
+    while (pkt && !cancel && (ret = av_read_frame(ctx, pkt)) >= 0)
+    {
+        if (pkt->stream_index == stream_index)
+        {
+            int64_t pts = pkt->pts != AV_NOPTS_VALUE ? pkt->pts : pkt->dts;
+            if ((pkt->flags & AV_PKT_FLAG_KEY) && pts != AV_NOPTS_VALUE)
+                scanned.push_back(KeyframeEntry{pts, pkt->pos, frame});
+            frame++;
+        }
+        av_packet_unref(pkt);
+    }
+    av_packet_free(&pkt);
+    avformat_close_input(&ctx);
+
+    if (cancel || ret != AVERROR_EOF || scanned.empty())
+    {
+        has_failed.store(true, std::memory_order_release);
+        return false;
+    }
+
+    std::stable_sort(scanned.begin(), scanned.end(), [](const KeyframeEntry &a, const KeyframeEntry &b)
+                     { return a.pts < b.pts; });
+    entries.swap(scanned);
+    is_ready.store(true, std::memory_order_release);
+
+    if (!save(media_path, stream_index))
+        std::cerr << "Could not write keyframe index " << sidecar_path(media_path) << std::endl;
+    return true;
+}
+
+const KeyframeEntry *KeyframeIndex::find(int64_t pts) const
+{
+    if (!ready())
+        return nullptr;
+    auto it = std::upper_bound(entries.begin(), entries.end(), pts, [](int64_t p, const KeyframeEntry &e)
+                               { return p < e.pts; });
+    if (it == entries.begin())
+        return nullptr;
+    return &*(it - 1);
+}
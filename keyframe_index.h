@@ -0,0 +1,54 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct KeyframeEntry
+{
+    int64_t pts;   // in the stream time base
+    int64_t pos;   // byte offset of the packet, -1 if the demuxer does not report it
+    int64_t frame; // packet number within the stream, in decode order
+};
+
+// ---- KeyframeIndex ----
+// Keyframe table of one stream, built by a packet-only scan (nothing is decoded) and
+// cached next to the media file as "<file>.kfidx". The cache is keyed by the file's
+// size and mtime, so a modified file is rescanned.
+class KeyframeIndex
+{
+public:
+    // Loads the sidecar if it matches the file. Call before the index is shared.
+    bool load(const std::string &media_path, int stream_index);
+
+    // Scans the file with its own demuxer and writes the sidecar. Safe to run on a
+    // background thread; readers see the result once ready() turns true, or learn
+    // from failed() that it never will.
+    bool build(const std::string &media_path, int stream_index, const std::atomic<bool> &cancel);
+
+    bool ready() const { return is_ready.load(std::memory_order_acquire); }
+    bool failed() const { return has_failed.load(std::memory_order_acquire); }
+
+    // Last keyframe at or before pts, or nullptr if the index is not ready or pts
+    // precedes the first keyframe.
+    const KeyframeEntry *find(int64_t pts) const;
+
+    size_t size() const { return ready() ? entries.size() : 0; }
+
+    // Every keyframe in pts order; empty until ready().
+    const std::vector<KeyframeEntry> &keyframes() const
+    {
+        static const std::vector<KeyframeEntry> none;
+        return ready() ? entries : none;
+    }
+
+private:
+    static std::string sidecar_path(const std::string &media_path);
+    static bool file_key(const std::string &media_path, uint64_t &size, int64_t &mtime);
+    bool save(const std::string &media_path, int stream_index) const;
+
+    std::vector<KeyframeEntry> entries;
+    std::atomic<bool> is_ready{false};
+    std::atomic<bool> has_failed{false};
+};
@@ -1,18 +1,178 @@
 #include <iostream>
 #include <stdexcept>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <vector>
 #include "VideoPlayer.h"
+#include "frame_export.h"
+#include "thumbnails.h"
+#include "work_pool.h"
+
+static void usage(const char *prog)
+{
+    std::cerr << "Usage: " << prog << " [options] <video_file>...\n"
+              << "  --bench                    decode as fast as possible without window/audio and print stats\n"
+              << "  --no-mmap                  read local files through the read-ahead thread instead of mmap\n"
+              << "  --readahead-mb N           read-ahead buffer for non-mmap inputs in MB, 0 to disable (default 64)\n"
+              << "  --io-throttle-kbps N       cap read-ahead source reads at N KB/s (testing slow storage)\n"
+              << "  --packet-queue-seconds S   demux read-ahead per stream in seconds (default 2)\n"
+              << "  --packet-queue-mb N        demux read-ahead per stream in MB (default 64)\n"
+              << "  --frame-queue-mb N         decoded frame budget per stream in MB (default 256)\n"
+              << "  --memory-cap-mb N          cap on all queued packets and frames in MB (default 512)\n"
+              << "  --audio-buffer-ms N        resampled audio kept ahead of the device (default 200)\n"
+              << "  --playlist FILE            play the files listed in FILE, one per line, after any given directly\n"
+              << "  --loop                     start the playlist over after its last entry\n"
+              << "  --mosaic                   play all files at once in a grid, without audio\n"
+              << "  --decode-workers N         decode threads shared by all decoders (default: one per core)\n"
+              << "  --telemetry PATH           write latency histograms and queue depths to PATH, or serve them on unix:PATH\n"
+              << "  --telemetry-format F       json (default) or prometheus\n"
+              << "  --telemetry-interval-ms N  how often the telemetry file is rewritten (default 1000)\n"
+              << "  --trace FILE               write a Chrome trace of the pipeline threads to FILE at exit\n"
+              << "  --speed X                  initial playback speed, 0.5 to 4 (change with [ and ] while playing)\n"
+              << "  --gop-cache-mb N           decoded GOPs kept for frame stepping and reverse playback (default 512)\n"
+              << "  --thumbnails N             write N keyframe thumbnails of the first file as sprite sheets and exit\n"
+              << "  --thumbnail-interval S     same, one thumbnail every S seconds\n"
+              << "  --thumbnail-out PREFIX     sheets PREFIX-1.jpg, ... and index PREFIX.vtt (default thumbnails)\n"
+              << "  --thumbnail-width N        tile width in pixels (default 160)\n"
+              << "  --thumbnail-grid CxR       tiles per sheet (default 10x10)\n"
+              << "  --export PATH              decode every frame of the first file to PATH and exit: raw frames,\n"
+              << "                             - for stdout, or a PNG sequence if PATH ends in .png (e.g. f%06d.png)\n"
+              << "  --export-buffer-mb N       frames held for in-order output in MB (default 1024)\n";
+}
+
+// One path per line; blank lines and lines starting with '#' are skipped.
+static bool read_playlist(const char *path, std::vector<std::string> &files)
+{
+    std::ifstream in(path);
+    if (!in)
+        return false;
+    std::string line;
+    while (std::getline(in, line))
+    {
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        if (!line.empty() && line[0] != '#')
+            files.push_back(line);
+    }
+    return true;
+}
 
 int main(int argc, char *argv[])
 {
-    if (argc < 2)
+    PlayerOptions opts;
+    std::vector<std::string> files;
+    const char *playlist_file = nullptr;
+    for (int i = 1; i < argc; i++)
     {
-        std::cerr << "Usage: " << argv[0] << " <video_file>\n";
+        bool has_value = i + 1 < argc;
+        if (std::strcmp(argv[i], "--bench") == 0)
+            opts.bench = true;
+        else if (std::strcmp(argv[i], "--no-mmap") == 0)
+            opts.mmap_io = false;
+        else if (std::strcmp(argv[i], "--readahead-mb") == 0 && has_value)
+            opts.readahead_bytes = std::atoll(argv[++i]) << 20;
+        else if (std::strcmp(argv[i], "--io-throttle-kbps") == 0 && has_value)
+            opts.io_throttle = std::atoll(argv[++i]) * 1024;
+        else if (std::strcmp(argv[i], "--packet-queue-seconds") == 0 && has_value)
+            opts.packet_queue_seconds = std::atof(argv[++i]);
+        else if (std::strcmp(argv[i], "--packet-queue-mb") == 0 && has_value)
+            opts.packet_queue_bytes = std::atoll(argv[++i]) << 20;
+        else if (std::strcmp(argv[i], "--frame-queue-mb") == 0 && has_value)
+            opts.frame_queue_bytes = std::atoll(argv[++i]) << 20;
+        else if (std::strcmp(argv[i], "--memory-cap-mb") == 0 && has_value)
+            opts.memory_cap = std::atoll(argv[++i]) << 20;
+        else if (std::strcmp(argv[i], "--audio-buffer-ms") == 0 && has_value)
+            opts.audio_buffer_seconds = std::atof(argv[++i]) / 1000.0;
+        else if (std::strcmp(argv[i], "--playlist") == 0 && has_value)
+            playlist_file = argv[++i];
+        else if (std::strcmp(argv[i], "--loop") == 0)
+            opts.loop = true;
+        else if (std::strcmp(argv[i], "--mosaic") == 0)
+            opts.mosaic = true;
+        else if (std::strcmp(argv[i], "--decode-workers") == 0 && has_value)
+            opts.decode_workers = (unsigned)std::atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--telemetry") == 0 && has_value)
+            opts.telemetry_target = argv[++i];
+        else if (std::strcmp(argv[i], "--telemetry-format") == 0 && has_value)
+        {
+            const char *format = argv[++i];
+            if (std::strcmp(format, "prometheus") != 0 && std::strcmp(format, "json") != 0)
+            {
+                usage(argv[0]);
+                return -1;
+            }
+            opts.telemetry_prometheus = std::strcmp(format, "prometheus") == 0;
+        }
+        else if (std::strcmp(argv[i], "--telemetry-interval-ms") == 0 && has_value)
+            opts.telemetry_interval_ms = std::atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--trace") == 0 && has_value)
+            opts.trace_path = argv[++i];
+        else if (std::strcmp(argv[i], "--speed") == 0 && has_value)
+            opts.speed = std::atof(argv[++i]);
+        else if (std::strcmp(argv[i], "--gop-cache-mb") == 0 && has_value)
+            opts.gop_cache_bytes = std::atoll(argv[++i]) << 20;
+        else if (std::strcmp(argv[i], "--thumbnails") == 0 && has_value)
+            opts.thumbnail_count = std::atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--thumbnail-interval") == 0 && has_value)
+            opts.thumbnail_interval = std::atof(argv[++i]);
+        else if (std::strcmp(argv[i], "--thumbnail-out") == 0 && has_value)
+            opts.thumbnail_output = argv[++i];
+        else if (std::strcmp(argv[i], "--thumbnail-width") == 0 && has_value)
+            opts.thumbnail_width = std::atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--thumbnail-grid") == 0 && has_value)
+        {
+            if (std::sscanf(argv[++i], "%dx%d", &opts.thumbnail_columns, &opts.thumbnail_rows) != 2 ||
+                opts.thumbnail_columns < 1 || opts.thumbnail_rows < 1)
+            {
+                usage(argv[0]);
+                return -1;
+            }
+        }
+        else if (std::strcmp(argv[i], "--export") == 0 && has_value)
+            opts.export_path = argv[++i];
+        else if (std::strcmp(argv[i], "--export-buffer-mb") == 0 && has_value)
+            opts.export_buffer_bytes = std::atoll(argv[++i]) << 20;
+        else if (argv[i][0] == '-' && argv[i][1] == '-')
+        {
+            usage(argv[0]);
+            return -1;
+        }
+        else
+            files.push_back(argv[i]);
+    }
+
+    if (playlist_file && !read_playlist(playlist_file, files))
+    {
+        std::cerr << "Error: could not read playlist " << playlist_file << std::endl;
+        return -1;
+    }
+    if (files.empty())
+    {
+        usage(argv[0]);
         return -1;
     }
 
+    // Sized before any decoder or scheduler takes the shared pool.
+    WorkStealingPool::configure(opts.decode_workers);
+
     try
     {
-        VideoPlayer player(argv[1]);
+        if (!opts.export_path.empty())
+        {
+            FrameExporter exporter(files[0], opts);
+            exporter.run();
+            return 0;
+        }
+        if (opts.thumbnail_count > 0 || opts.thumbnail_interval > 0)
+        {
+            ThumbnailWriter writer(files[0], opts);
+            writer.run();
+            return 0;
+        }
+        VideoPlayer player(files, opts);
         player.open();
         player.start();
     }
@@ -23,4 +183,4 @@ int main(int argc, char *argv[])
     }
 
     return 0;
-}
\ No newline at end of file
+}
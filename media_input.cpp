@@ -0,0 +1,357 @@
+#include "media_input.h"
+#include "work_pool.h"
+#include <stdexcept>
+
+extern "C"
+{
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+}
+
+MediaInput::~MediaInput()
+{
+    close();
+}
+
+void MediaInput::open(const std::string &file, const PlayerOptions &options, FrameBufferPool &buffer_pool, Role role)
+{
+    filename = file;
+    standby = role == Role::Standby;
+    // Local files are read through a memory mapping. Everything else (URLs, network
+    // mounts opened with --no-mmap) is fetched ahead of the demuxer by an I/O thread.
+    AVIOContext *custom_io = nullptr;
+    if (options.mmap_io && options.io_throttle == 0 && file_io.open(filename))
+        custom_io = file_io.context();
+    else if (options.readahead_bytes > 0 && readahead_io.open(filename, options.readahead_bytes, options.io_throttle))
+        custom_io = readahead_io.context();
+    if (custom_io)
+    {
+        format_ctx = avformat_alloc_context();
+        if (!format_ctx)
+            throw std::runtime_error("Could not allocate format context.");
+        format_ctx->pb = custom_io;
+        format_ctx->flags |= AVFMT_FLAG_CUSTOM_IO;
+    }
+    if (avformat_open_input(&format_ctx, filename.c_str(), nullptr, nullptr) != 0)
+    {
+        throw std::runtime_error("Could not open file: " + filename);
+    }
+    if (avformat_find_stream_info(format_ctx, nullptr) < 0)
+    {
+        throw std::runtime_error("Could not find stream info.");
+    }
+
+    // Background inputs (the GOP cache) leave the cores to playback. Mosaic, thumbnail
+    // and export inputs get their parallelism from running many inputs at once. Either
+    // way they are video only, each with a single-threaded decoder.
+    bool video_only = role == Role::Background || options.mosaic || options.thumbnail_count > 0 ||
+                      options.thumbnail_interval > 0 || !options.export_path.empty();
+    for (unsigned int i = 0; i < format_ctx->nb_streams; i++)
+    {
+        auto stream = format_ctx->streams[i];
+        if (stream->codecpar->codec_type == AVMEDIA_TYPE_VIDEO && video_stream_index == -1)
+        {
+            video_stream_index = i;
+            video_stream = stream;
+        }
+        else if (stream->codecpar->codec_type == AVMEDIA_TYPE_AUDIO && audio_stream_index == -1 && !video_only)
+        {
+            audio_stream_index = i;
+            audio_stream = stream;
+        }
+    }
+    if (video_stream_index == -1)
+        throw std::runtime_error("No video stream found.");
+
+    // Let the demuxer skip streams we never decode instead of reading and freeing their packets.
+    for (unsigned int i = 0; i < format_ctx->nb_streams; i++)
+    {
+        if ((int)i == video_stream_index || (int)i == audio_stream_index)
+            continue;
+        AVStream *stream = format_ctx->streams[i];
+        stream->discard = AVDISCARD_ALL;
+        int entries = avformat_index_get_entries_count(stream);
+        for (int e = 0; e < entries; e++)
+        {
+            const AVIndexEntry *entry = avformat_index_get_entry(stream, e);
+            discarded_stream_bytes += entry->size;
+        }
+        discarded_stream_packets += entries;
+    }
+
+    init_codec_context(video_stream_index, &video_codec_ctx, "video", buffer_pool, !video_only && !standby);
+    if (audio_stream_index != -1)
+    {
+        init_codec_context(audio_stream_index, &audio_codec_ctx, "audio", buffer_pool, !video_only);
+    }
+
+    keyframe_index.load(filename, video_stream_index);
+}
+
+void MediaInput::init_codec_context(int stream_index, AVCodecContext **codec_ctx, const std::string &type, FrameBufferPool &buffer_pool, bool pooled)
+{
+    const AVCodec *codec = avcodec_find_decoder(format_ctx->streams[stream_index]->codecpar->codec_id);
+    if (!codec)
+        throw std::runtime_error("Unsupported " + type + " codec.");
+
+    *codec_ctx = avcodec_alloc_context3(codec);
+    if (!*codec_ctx)
+        throw std::runtime_error("Could not allocate " + type + " codec context.");
+
+    avcodec_parameters_to_context(*codec_ctx, format_ctx->streams[stream_index]->codecpar);
+
+    if (pooled)
+        WorkStealingPool::shared().configure_codec(*codec_ctx, codec);
+    else
+        (*codec_ctx)->thread_count = 1;
+
+    if ((*codec_ctx)->codec_type == AVMEDIA_TYPE_VIDEO)
+        buffer_pool.attach(*codec_ctx);
+
+    if (avcodec_open2(*codec_ctx, codec, nullptr) < 0)
+    {
+        throw std::runtime_error("Could not open " + type + " codec.");
+    }
+    if (pooled)
+        WorkStealingPool::shared().attach_codec(*codec_ctx);
+}
+
+void MediaInput::prewarm(int max_frames)
+{
+    AVPacket *packet = av_packet_alloc();
+    AVFrame *frame = av_frame_alloc();
+    int keyframes = 0;
+    while (packet && frame && (int)warm_frames.size() < max_frames && !closing)
+    {
+        if (av_read_frame(format_ctx, packet) < 0)
+            break;
+
+        bool video = packet->stream_index == video_stream_index;
+        if (video && (packet->flags & AV_PKT_FLAG_KEY) && ++keyframes > 1)
+        {
+            // Second GOP: stop here and leave its keyframe to the demuxer.
+            if (AVPacket *p = av_packet_alloc())
+            {
+                av_packet_move_ref(p, packet);
+                warm_packets.push_back(p);
+            }
+            break;
+        }
+        if (!video)
+        {
+            if (packet->stream_index == audio_stream_index)
+            {
+                if (AVPacket *p = av_packet_alloc())
+                {
+                    av_packet_move_ref(p, packet);
+                    warm_packets.push_back(p);
+                }
+            }
+            av_packet_unref(packet);
+            continue;
+        }
+
+        // Frames the decoder still holds back come out once the pipeline feeds it on.
+        if (standby)
+        {
+            if (AVPacket *p = av_packet_clone(packet))
+                replay_packets.push_back(p);
+        }
+        int sent = avcodec_send_packet(video_codec_ctx, packet);
+        av_packet_unref(packet);
+        if (sent < 0)
+            continue;
+        while (avcodec_receive_frame(video_codec_ctx, frame) == 0)
+        {
+            AVFrame *f = av_frame_alloc();
+            if (!f)
+            {
+                av_frame_unref(frame);
+                break;
+            }
+            av_frame_move_ref(f, frame);
+            warm_frames.push_back(f);
+        }
+    }
+    av_frame_free(&frame);
+    av_packet_free(&packet);
+}
+
+void MediaInput::promote(FrameBufferPool &buffer_pool)
+{
+    if (!standby)
+        return;
+    standby = false;
+
+    AVCodecContext *warm_ctx = video_codec_ctx;
+    video_codec_ctx = nullptr;
+    try
+    {
+        init_codec_context(video_stream_index, &video_codec_ctx, "video", buffer_pool, true);
+    }
+    catch (const std::runtime_error &)
+    {
+        free_codec_context(&video_codec_ctx);
+        video_codec_ctx = warm_ctx;
+        for (AVPacket *&p : replay_packets)
+            av_packet_free(&p);
+        replay_packets.clear();
+        return;
+    }
+
+    // Frame threads hold back more frames than the standby decoder did, so some of
+    // the warm frames only come out later, while others it never got to come out now.
+    int64_t shown = warm_frames.empty() ? AV_NOPTS_VALUE : warm_frames.back()->best_effort_timestamp;
+    AVFrame *frame = av_frame_alloc();
+    for (AVPacket *&p : replay_packets)
+    {
+        if (frame && avcodec_send_packet(video_codec_ctx, p) == 0)
+        {
+            while (avcodec_receive_frame(video_codec_ctx, frame) == 0)
+            {
+                AVFrame *f = nullptr;
+                if (shown == AV_NOPTS_VALUE || frame->best_effort_timestamp == AV_NOPTS_VALUE ||
+                    frame->best_effort_timestamp > shown)
+                    f = av_frame_alloc();
+                if (!f)
+                {
+                    av_frame_unref(frame);
+                    continue;
+                }
+                av_frame_move_ref(f, frame);
+                warm_frames.push_back(f);
+            }
+        }
+        av_packet_free(&p);
+    }
+    replay_packets.clear();
+    av_frame_free(&frame);
+    replayed_pts = shown;
+    free_codec_context(&warm_ctx);
+}
+
+void MediaInput::release_video_decoder()
+{
+    free_codec_context(&video_codec_ctx);
+}
+
+void MediaInput::start_index_build()
+{
+    if (keyframe_index.ready() || index_thread.joinable())
+        return;
+    index_thread = std::thread([this]
+                               { keyframe_index.build(filename, video_stream_index, closing); });
+}
+
+bool MediaInput::seek_keyframe(const KeyframeEntry &key, AVPacket *packet)
+{
+    for (int attempt = 0; attempt < 2; attempt++)
+    {
+        bool sought = attempt == 0 ? avformat_seek_file(format_ctx, video_stream_index, INT64_MIN, key.pts, key.pts, 0) >= 0 ||
+                                         av_seek_frame(format_ctx, video_stream_index, key.pts, AVSEEK_FLAG_BACKWARD) >= 0
+                                   : key.pos >= 0 && !(format_ctx->iformat->flags & AVFMT_NO_BYTE_SEEK) &&
+                                         av_seek_frame(format_ctx, video_stream_index, key.pos, AVSEEK_FLAG_BYTE) >= 0;
+        if (!sought)
+            continue;
+        while (av_read_frame(format_ctx, packet) >= 0)
+        {
+            if (packet->stream_index == video_stream_index && (packet->flags & AV_PKT_FLAG_KEY))
+            {
+                int64_t pts = packet->pts != AV_NOPTS_VALUE ? packet->pts : packet->dts;
+                if (pts <= key.pts)
+                    return true;
+                av_packet_unref(packet);
+                break;
+            }
+            av_packet_unref(packet);
+        }
+    }
+    return false;
+}
+
+int64_t MediaInput::decode_until(const KeyframeEntry *key, int64_t start_pts, int64_t end_pts, AVPacket *packet, AVFrame *frame,
+                                 const std::atomic<bool> &cancel, const std::function<void(AVFrame *)> &sink)
+{
+    // The seek leaves the keyframe in packet.
+    bool pending = key != nullptr;
+    if (pending && !seek_keyframe(*key, packet))
+        return -1;
+
+    // Frames leave the decoder in pts order, so the first one at or past end_pts
+    // means every frame before it is out.
+    AVCodecContext *ctx = video_codec_ctx;
+    int64_t decoded = 0;
+    bool past_end = false, eof = false;
+    while (!past_end && !eof && !cancel)
+    {
+        if (!pending)
+        {
+            if (av_read_frame(format_ctx, packet) < 0)
+                eof = true;
+            else if (packet->stream_index != video_stream_index)
+            {
+                av_packet_unref(packet);
+                continue;
+            }
+        }
+        pending = false;
+        avcodec_send_packet(ctx, eof ? nullptr : packet);
+        av_packet_unref(packet);
+        while (avcodec_receive_frame(ctx, frame) == 0)
+        {
+            decoded++;
+            int64_t pts = frame->best_effort_timestamp;
+            if (pts != AV_NOPTS_VALUE && pts >= end_pts)
+                past_end = true;
+            if (!past_end && (pts == AV_NOPTS_VALUE || pts >= start_pts))
+                sink(frame);
+            av_frame_unref(frame);
+        }
+    }
+    avcodec_flush_buffers(ctx);
+    return decoded;
+}
+
+double MediaInput::start_time() const
+{
+    if (!video_stream || video_stream->start_time == AV_NOPTS_VALUE)
+        return 0.0;
+    return video_stream->start_time * av_q2d(video_stream->time_base);
+}
+
+double MediaInput::duration() const
+{
+    return format_ctx && format_ctx->duration > 0 ? (double)format_ctx->duration / AV_TIME_BASE : 0.0;
+}
+
+void MediaInput::close()
+{
+    closing = true;
+    if (index_thread.joinable())
+        index_thread.join();
+
+    for (AVFrame *&f : warm_frames)
+        av_frame_free(&f);
+    warm_frames.clear();
+    for (AVPacket *&p : warm_packets)
+        av_packet_free(&p);
+    warm_packets.clear();
+    for (AVPacket *&p : replay_packets)
+        av_packet_free(&p);
+    replay_packets.clear();
+
+    free_codec_context(&video_codec_ctx);
+    free_codec_context(&audio_codec_ctx);
+    if (format_ctx)
+        avformat_close_input(&format_ctx);
+    file_io.close();
+    readahead_io.close();
+}
+
+void MediaInput::free_codec_context(AVCodecContext **codec_ctx)
+{
+    if (!*codec_ctx)
+        return;
+    WorkStealingPool::shared().release_codec(*codec_ctx);
+    avcodec_free_context(codec_ctx);
+}
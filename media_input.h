@@ -0,0 +1,123 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+#include "player_options.h"
+#include "buffer_pool.h"
+#include "keyframe_index.h"
+#include "mmap_io.h"
+#include "readahead_io.h"
+
+struct AVFormatContext;
+struct AVCodecContext;
+struct AVStream;
+struct AVFrame;
+struct AVPacket;
+
+// ---- MediaInput ----
+// Everything that belongs to one opened file: I/O layer, demuxer, decoders and the
+// keyframe index. The player plays one input at a time; in playlist mode the next
+// entry is opened and pre-warmed on a background thread while the current one plays,
+// then handed to the pipeline threads, which drop the old input when they move on.
+struct MediaInput
+{
+    MediaInput() = default;
+    ~MediaInput();
+
+    MediaInput(const MediaInput &) = delete;
+    MediaInput &operator=(const MediaInput &) = delete;
+
+    enum class Role
+    {
+        Playback,   // audio and video; video frame threads come out of the pool's budget
+        Standby,    // opened ahead of playback: single-threaded video until promote()
+        Background, // video only, single-threaded, next to the input being played
+    };
+
+    // Opens file and its decoders. Video decoders allocate from buffer_pool, which
+    // must outlive the input. Throws std::runtime_error if the file cannot be played.
+    // Mosaic, thumbnail and export runs open every input as Background.
+    void open(const std::string &file, const PlayerOptions &options, FrameBufferPool &buffer_pool, Role role = Role::Playback);
+
+    // Reads up to the start of the second GOP and decodes the first one, at most
+    // max_frames frames. Decoded frames land in warm_frames; every packet read on
+    // the way that was not decoded (audio, the next keyframe) in warm_packets, in
+    // read order, for the demuxer to queue first.
+    void prewarm(int max_frames);
+
+    // When a standby input starts playing: reopens its video decoder with frame
+    // threads and replays the pre-warmed packets into it. Frames it produces past
+    // the warm ones join warm_frames; those up to replayed_pts are left to drop.
+    // Keeps the standby decoder if the new one cannot be opened.
+    void promote(FrameBufferPool &buffer_pool);
+
+    // Frees the video decoder once playback has moved past this input, so its
+    // frame threads go back to the budget for the next one.
+    void release_video_decoder();
+
+    // Scans for keyframes on a background thread unless a cached index was loaded.
+    void start_index_build();
+
+    // Positions the demuxer on key, or an earlier keyframe, and reads up to that
+    // keyframe, whose packet is left in packet. Demuxers without a precise timestamp
+    // index get a byte seek to the packet the index scan found.
+    bool seek_keyframe(const KeyframeEntry &key, AVPacket *packet);
+
+    // Decodes video from key (nullptr: from where the demuxer stands) and on past the
+    // next keyframe until the decoder's output reaches end_pts, so the leading frames
+    // of an open GOP come out with their references. Every frame with a pts in
+    // [start_pts, end_pts), or none, goes to sink, which may move it out. Stops early
+    // once cancel is set and flushes the decoder either way. Returns the number of
+    // frames decoded, or -1 if key could not be reached.
+    int64_t decode_until(const KeyframeEntry *key, int64_t start_pts, int64_t end_pts, AVPacket *packet, AVFrame *frame,
+                         const std::atomic<bool> &cancel, const std::function<void(AVFrame *)> &sink);
+
+    // Video stream start and container duration in seconds of this file's own time.
+    double start_time() const;
+    double duration() const;
+
+    std::string filename;
+    AVFormatContext *format_ctx = nullptr;
+    AVCodecContext *video_codec_ctx = nullptr;
+    AVCodecContext *audio_codec_ctx = nullptr;
+    AVStream *video_stream = nullptr;
+    AVStream *audio_stream = nullptr;
+    int video_stream_index = -1;
+    int audio_stream_index = -1;
+    KeyframeIndex keyframe_index;
+
+    // Added to this file's timestamps to place it on the playback timeline, so pts
+    // keep increasing across playlist entries. Set by the demuxer before handoff.
+    double timeline_offset = 0.0;
+
+    std::vector<AVFrame *> warm_frames;
+    std::vector<AVPacket *> warm_packets;
+
+    // After promote(): the last pre-warmed frame's pts. Frames the replayed decoder
+    // still owes up to it were shown already. INT64_MIN (AV_NOPTS_VALUE) once passed.
+    int64_t replayed_pts = INT64_MIN;
+
+    // Index-based estimate of what AVDISCARD_ALL on unused streams saves.
+    uint64_t discarded_stream_packets = 0;
+    uint64_t discarded_stream_bytes = 0;
+
+    bool uses_readahead() const { return readahead_io.context() != nullptr; }
+    ReadAheadStats readahead_stats() { return readahead_io.stats(); }
+
+private:
+    void init_codec_context(int stream_index, AVCodecContext **codec_ctx, const std::string &type, FrameBufferPool &buffer_pool, bool pooled);
+    void close();
+    void free_codec_context(AVCodecContext **codec_ctx);
+
+    bool standby = false;
+    // Video packets a standby decoder was pre-warmed with, for promote() to replay.
+    std::vector<AVPacket *> replay_packets;
+    MappedFileIO file_io;
+    ReadAheadIO readahead_io;
+    std::thread index_thread;
+    std::atomic<bool> closing{false};
+};
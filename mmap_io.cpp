@@ -0,0 +1,136 @@
+#include "mmap_io.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+extern "C"
+{
+#include <libavformat/avio.h>
+#include <libavutil/error.h>
+#include <libavutil/mem.h>
+}
+
+// AVIO buffer for small reads. Larger reads (packet payloads) bypass it and are copied
+// straight from the mapping into the packet.
+#define MMAP_IO_BUFFER_SIZE (64 * 1024)
+// Prefetch window ahead of the read position.
+#define MMAP_READAHEAD (16 << 20)
+
+MappedFileIO::~MappedFileIO()
+{
+    close();
+}
+
+bool MappedFileIO::open(const std::string &path)
+{
+    close();
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0)
+    {
+        ::close(fd);
+        return false;
+    }
+    // The mapping stays valid after the descriptor is closed.
+    void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED)
+        return false;
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    unsigned char *buffer = static_cast<unsigned char *>(av_malloc(MMAP_IO_BUFFER_SIZE));
+    if (buffer)
+        avio = avio_alloc_context(buffer, MMAP_IO_BUFFER_SIZE, 0, this, &MappedFileIO::read_packet, nullptr, &MappedFileIO::seek);
+    if (!avio)
+    {
+        av_free(buffer);
+        munmap(map, st.st_size);
+        return false;
+    }
+
+    data = static_cast<const uint8_t *>(map);
+    size = st.st_size;
+    pos = 0;
+    advised_begin = advised_end = 0;
+    advise();
+    return true;
+}
+
+void MappedFileIO::close()
+{
+    if (avio)
+    {
+        av_freep(&avio->buffer);
+        avio_context_free(&avio);
+    }
+    if (data)
+    {
+        munmap(const_cast<uint8_t *>(data), size);
+        data = nullptr;
+    }
+    size = pos = 0;
+}
+
+// Prefetches the next window once the reader is halfway through the previous one,
+// or anew after a seek out of it. A window that already reaches the end of the
+// file is never renewed while the reader stays inside it.
+void MappedFileIO::advise()
+{
+    size_t renew_at = pos + MMAP_READAHEAD / 2 < size ? pos + MMAP_READAHEAD / 2 : size - 1;
+    if (pos >= advised_begin && renew_at < advised_end)
+        return;
+    static const size_t page = sysconf(_SC_PAGESIZE);
+    size_t begin = pos & ~(page - 1);
+    size_t end = pos + MMAP_READAHEAD < size ? pos + MMAP_READAHEAD : size;
+    if (end > begin)
+        madvise(const_cast<uint8_t *>(data) + begin, end - begin, MADV_WILLNEED);
+    advised_begin = begin;
+    advised_end = end;
+}
+
+int MappedFileIO::read_packet(void *opaque, uint8_t *buf, int buf_size)
+{
+    MappedFileIO *self = static_cast<MappedFileIO *>(opaque);
+    if (self->pos >= self->size)
+        return AVERROR_EOF;
+    size_t n = self->size - self->pos;
+    if (n > (size_t)buf_size)
+        n = buf_size;
+    self->advise();
+    memcpy(buf, self->data + self->pos, n);
+    self->pos += n;
+    return (int)n;
+}
+
+int64_t MappedFileIO::seek(void *opaque, int64_t offset, int whence)
+{
+    MappedFileIO *self = static_cast<MappedFileIO *>(opaque);
+    int64_t target;
+    switch (whence & ~AVSEEK_FORCE)
+    {
+    case AVSEEK_SIZE:
+        return self->size;
+    case SEEK_SET:
+        target = offset;
+        break;
+    case SEEK_CUR:
+        target = (int64_t)self->pos + offset;
+        break;
+    case SEEK_END:
+        target = (int64_t)self->size + offset;
+        break;
+    default:
+        return AVERROR(EINVAL);
+    }
+    if (target < 0)
+        return AVERROR(EINVAL);
+    // Positions past the end are allowed, as with lseek; reads there return EOF.
+    self->pos = target;
+    return target;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+struct AVIOContext;
+
+// ---- MappedFileIO ----
+// AVIOContext over a read-only mmap of a local file. Reads are a memcpy out of the
+// mapping instead of a read() syscall each, and seeks only move the position. The
+// kernel gets MADV_SEQUENTIAL for the whole mapping and MADV_WILLNEED for a window
+// ahead of wherever the demuxer is reading, re-issued as it advances or seeks.
+class MappedFileIO
+{
+public:
+    MappedFileIO() = default;
+    ~MappedFileIO();
+
+    MappedFileIO(const MappedFileIO &) = delete;
+    MappedFileIO &operator=(const MappedFileIO &) = delete;
+
+    // Maps path and creates the AVIOContext. Returns false (and leaves nothing open)
+    // for anything that is not a non-empty regular local file.
+    bool open(const std::string &path);
+    void close();
+
+    // Install as AVFormatContext::pb together with AVFMT_FLAG_CUSTOM_IO.
+    AVIOContext *context() const { return avio; }
+
+private:
+    static int read_packet(void *opaque, uint8_t *buf, int buf_size);
+    static int64_t seek(void *opaque, int64_t offset, int whence);
+    void advise();
+
+    const uint8_t *data = nullptr;
+    size_t size = 0;
+    size_t pos = 0;
+    size_t advised_begin = 0;
+    size_t advised_end = 0;
+    AVIOContext *avio = nullptr;
+};
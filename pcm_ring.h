@@ -0,0 +1,249 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "queue.h"
+
+// ---- PcmRing ----
+// Single-producer/single-consumer byte ring carrying output-format PCM from the audio
+// decode thread to the audio callback. The producer blocks while the ring is full;
+// the consumer never blocks, it takes what is there and reports short reads.
+//
+// Data is written under a serial. invalidate() marks everything written under older
+// serials stale: the consumer skips it and the producer stops blocking on it, so a
+// seek never waits for the ring to play out.
+//
+// Each write is followed by a span telling which stream time the written bytes hold.
+// Spans travel through their own SPSC ring so the consumer can tell the stream time
+// at any byte it plays, even when bytes of different playback speeds are queued.
+struct PcmSpan
+{
+    uint64_t begin, end; // byte positions
+    double begin_pts, end_pts;
+    int serial;
+};
+
+class PcmRing
+{
+public:
+    // Sizes the ring to at least capacity_bytes. Only call while no thread uses it.
+    void reset(size_t capacity_bytes)
+    {
+        size_t n = 4096;
+        while (n < capacity_bytes)
+            n <<= 1;
+        buffer.assign(n, 0);
+        mask = n - 1;
+        read_pos.store(0);
+        write_pos.store(0);
+        start_pos.store(0);
+        wanted_serial.store(0);
+        data_serial.store(0);
+        eof.store(false);
+        quit.store(false);
+
+        size_t spans_needed = 64;
+        while (spans_needed < n / 512)
+            spans_needed <<= 1;
+        spans.assign(spans_needed, PcmSpan{});
+        span_mask = spans_needed - 1;
+        span_read.store(0);
+        span_write.store(0);
+        last_span.serial = -1;
+    }
+
+    size_t capacity() const { return buffer.size(); }
+
+    // Any thread: data written under serials other than this one is stale.
+    void invalidate(int serial)
+    {
+        wanted_serial.store(serial, std::memory_order_release);
+        not_full.notify_all();
+    }
+
+    // Producer: the following writes belong to serial.
+    void begin_serial(int serial)
+    {
+        start_pos.store(write_pos.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        eof = false;
+        data_serial.store(serial, std::memory_order_release);
+    }
+
+    bool stale() const
+    {
+        return data_serial.load(std::memory_order_acquire) != wanted_serial.load(std::memory_order_acquire);
+    }
+
+    // Blocks until all n bytes are in the ring. Returns false if aborted; stale data is
+    // dropped without blocking.
+    bool write(const uint8_t *data, size_t n)
+    {
+        while (n > 0)
+        {
+            if (stale())
+                return !quit.load();
+            uint64_t w = write_pos.load(std::memory_order_relaxed);
+            size_t space = buffer.size() - (size_t)(w - read_pos.load(std::memory_order_acquire));
+            if (space == 0)
+            {
+                uint32_t key = not_full.prepare();
+                space = buffer.size() - (size_t)(w - read_pos.load(std::memory_order_seq_cst));
+                if (space == 0 && !quit.load() && !stale())
+                {
+                    not_full.wait(key);
+                    continue;
+                }
+                not_full.cancel();
+            }
+            if (quit.load(std::memory_order_acquire))
+                return false;
+            if (space == 0)
+                continue;
+
+            size_t chunk = n < space ? n : space;
+            copy_in(w, data, chunk);
+            write_pos.store(w + chunk, std::memory_order_release);
+            not_empty.notify();
+            data += chunk;
+            n -= chunk;
+        }
+        return true;
+    }
+
+    // Copies up to n bytes of current data out; returns how many were available.
+    size_t read(uint8_t *dst, size_t n)
+    {
+        uint64_t r = read_pos.load(std::memory_order_relaxed);
+        int ds = data_serial.load(std::memory_order_acquire);
+        if (ds != wanted_serial.load(std::memory_order_acquire))
+        {
+            // Everything queued is stale. Drop it so a producer blocked on a full ring moves
+            // on, unless it began the new serial meanwhile (then w may include fresh data).
+            uint64_t w = write_pos.load(std::memory_order_acquire);
+            if (data_serial.load(std::memory_order_acquire) == ds && w != r)
+            {
+                read_pos.store(w, std::memory_order_release);
+                not_full.notify();
+            }
+            return 0;
+        }
+        uint64_t start = start_pos.load(std::memory_order_relaxed);
+        if (r < start)
+            r = start;
+        size_t avail = (size_t)(write_pos.load(std::memory_order_acquire) - r);
+        size_t chunk = n < avail ? n : avail;
+        if (chunk == 0)
+        {
+            if (r != read_pos.load(std::memory_order_relaxed))
+                read_pos.store(r, std::memory_order_release);
+            return 0;
+        }
+        size_t off = r & mask;
+        size_t first = chunk < buffer.size() - off ? chunk : buffer.size() - off;
+        memcpy(dst, buffer.data() + off, first);
+        memcpy(dst + first, buffer.data(), chunk - first);
+        read_pos.store(r + chunk, std::memory_order_release);
+        not_full.notify();
+        return chunk;
+    }
+
+    // Blocks a non-real-time consumer until data, EOF or abort.
+    void wait_readable()
+    {
+        uint32_t key = not_empty.prepare();
+        if (write_pos.load(std::memory_order_seq_cst) != read_pos.load(std::memory_order_relaxed) || eof || quit)
+        {
+            not_empty.cancel();
+            return;
+        }
+        not_empty.wait(key);
+    }
+
+    void set_eof()
+    {
+        eof = true;
+        not_empty.notify_all();
+    }
+
+    void abort()
+    {
+        quit = true;
+        not_full.notify_all();
+        not_empty.notify_all();
+    }
+
+    // Producer: the bytes from begin up to the write position hold stream time
+    // [begin_pts, end_pts). Dropped if the consumer is that far behind; it then
+    // extrapolates over the gap.
+    void add_span(uint64_t begin, double begin_pts, double end_pts)
+    {
+        uint64_t w = span_write.load(std::memory_order_relaxed);
+        if (w - span_read.load(std::memory_order_acquire) == spans.size())
+            return;
+        spans[w & span_mask] = PcmSpan{begin, write_pos.load(std::memory_order_relaxed), begin_pts, end_pts,
+                                       data_serial.load(std::memory_order_relaxed)};
+        span_write.store(w + 1, std::memory_order_release);
+    }
+
+    // Consumer: stream time at byte position pos of the current serial, and how many
+    // seconds of it pass per second of output there. pos must not decrease between
+    // calls. Returns false until a span of the current serial arrived.
+    bool pts_at(int64_t pos, double bytes_per_sec, double &pts, double &rate)
+    {
+        int serial = wanted_serial.load(std::memory_order_acquire);
+        uint64_t r = span_read.load(std::memory_order_relaxed);
+        uint64_t w = span_write.load(std::memory_order_acquire);
+        while (r != w && (spans[r & span_mask].serial != serial || (int64_t)spans[r & span_mask].end <= pos))
+        {
+            if (spans[r & span_mask].serial == serial)
+                last_span = spans[r & span_mask];
+            r++;
+        }
+        span_read.store(r, std::memory_order_release);
+
+        // The span holding pos, the next one (pos is in a gap or before the serial's
+        // first byte) or the last one played (pos is past the last span).
+        const PcmSpan *span = r != w ? &spans[r & span_mask] : last_span.serial == serial ? &last_span
+                                                                                          : nullptr;
+        if (!span)
+            return false;
+        rate = span->end > span->begin ? (span->end_pts - span->begin_pts) * bytes_per_sec / (double)(span->end - span->begin) : 1.0;
+        pts = span->begin_pts + (double)(pos - (int64_t)span->begin) / bytes_per_sec * rate;
+        return true;
+    }
+
+    uint64_t read_position() const { return read_pos.load(std::memory_order_acquire); }
+    uint64_t write_position() const { return write_pos.load(std::memory_order_acquire); }
+    size_t fill() const { return (size_t)(write_position() - read_position()); }
+
+    std::atomic<bool> eof{false};
+    std::atomic<bool> quit{false};
+
+private:
+    void copy_in(uint64_t w, const uint8_t *src, size_t n)
+    {
+        size_t off = w & mask;
+        size_t first = n < buffer.size() - off ? n : buffer.size() - off;
+        memcpy(buffer.data() + off, src, first);
+        memcpy(buffer.data(), src + first, n - first);
+    }
+
+    std::vector<uint8_t> buffer;
+    size_t mask = 0;
+
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> write_pos{0};
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> read_pos{0};
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> start_pos{0}; // first byte of data_serial
+    std::atomic<int> data_serial{0};
+    std::atomic<int> wanted_serial{0};
+    alignas(CACHE_LINE_SIZE) WaitEvent not_full;
+    alignas(CACHE_LINE_SIZE) WaitEvent not_empty;
+
+    std::vector<PcmSpan> spans;
+    size_t span_mask = 0;
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> span_write{0};
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> span_read{0};
+    PcmSpan last_span{0, 0, 0.0, 0.0, -1}; // consumer only
+};
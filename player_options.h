@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+struct PlayerOptions
+{
+    // Decode as fast as possible without a window or audio device and print throughput stats.
+    bool bench = false;
+
+    // Read local files through mmap instead of FFmpeg's file protocol.
+    bool mmap_io = true;
+
+    // Read-ahead window of the I/O thread for inputs not read through mmap; 0 disables
+    // it. io_throttle caps its source read rate in bytes/s to imitate slow storage and
+    // also bypasses mmap.
+    int64_t readahead_bytes = 64LL << 20;
+    int64_t io_throttle = 0;
+
+    // Queue budgets. The demuxer stops reading once every packet queue holds
+    // packet_queue_seconds or packet_queue_bytes, or once all queues together hold
+    // memory_cap bytes. Decoders block once their frame queue holds frame_queue_bytes.
+    double packet_queue_seconds = 2.0;
+    int64_t packet_queue_bytes = 64LL << 20;
+    int64_t frame_queue_bytes = 256LL << 20;
+    int64_t memory_cap = 512LL << 20;
+
+    // Resampled audio kept ahead of the device. Bounds both underrun headroom and
+    // how far the audio decoder can run ahead of playback.
+    double audio_buffer_seconds = 0.2;
+
+    // Playlist: start over after the last entry, and how many frames of the next
+    // entry's first GOP are decoded ahead while the current one still plays.
+    bool loop = false;
+    int prewarm_frames = 8;
+
+    // Mosaic: play every input at once, each in its own cell of a grid, without audio.
+    // All inputs are decoded with single-threaded codecs on the shared decode pool.
+    bool mosaic = false;
+
+    // Size of the process-wide WorkStealingPool that every decoder shares (0: one per core).
+    unsigned decode_workers = 0;
+
+    // Latency histograms and queue depths are written to telemetry_target every
+    // telemetry_interval_ms, as JSON or Prometheus text; "unix:PATH" serves them on a
+    // Unix socket instead. Empty disables the export.
+    std::string telemetry_target;
+    bool telemetry_prometheus = false;
+    int telemetry_interval_ms = 1000;
+
+    // Initial playback speed, 0.5-4; changed with [ and ] while playing.
+    double speed = 1.0;
+
+    // Decoded GOPs kept for frame stepping and reverse playback.
+    int64_t gop_cache_bytes = 512LL << 20;
+
+    // Thumbnail mode: instead of playing, write thumbnail_count thumbnails of the first
+    // file, or one per thumbnail_interval seconds, as JPEG sprite sheets
+    // "<thumbnail_output>-N.jpg" of thumbnail_columns x thumbnail_rows tiles
+    // thumbnail_width wide, with a WebVTT index "<thumbnail_output>.vtt".
+    int thumbnail_count = 0;
+    double thumbnail_interval = 0.0;
+    std::string thumbnail_output = "thumbnails";
+    int thumbnail_width = 160;
+    int thumbnail_columns = 10;
+    int thumbnail_rows = 10;
+
+    // Export mode: instead of playing, decode every video frame of the first file in pts
+    // order to export_path: raw frames in the decoder's pixel format ("-" for stdout),
+    // or a PNG sequence if it ends in ".png" (a printf pattern such as "f%06d.png", or
+    // "<name>-000001.png", ...). Segments of whole GOPs are decoded in parallel;
+    // export_buffer_bytes caps the frames waiting for their turn to be written.
+    std::string export_path;
+    int64_t export_buffer_bytes = 1LL << 30;
+
+    // Chrome trace-event JSON of every pipeline thread's recent activity, written at exit.
+    std::string trace_path;
+};
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include "queue.h"
+
+// ---- RecyclePool ----
+// Free list of FFmpeg objects handed from one thread (the consumer that is done
+// with an object) back to another (the producer that fills the next one). Both
+// sides are single threads, so the free list is an SpscQueue and neither acquire()
+// nor release() takes a lock. Objects are unref'd on release, so a pooled object
+// only keeps its struct allocation, never its payload.
+template <typename T, typename Traits>
+class RecyclePool
+{
+public:
+    explicit RecyclePool(size_t capacity) : free_list(capacity) {}
+    ~RecyclePool() { free_list.flush(); }
+
+    T acquire()
+    {
+        T obj;
+        if (free_list.try_pop(obj))
+        {
+            reused.fetch_add(1, std::memory_order_relaxed);
+            return obj;
+        }
+        allocated.fetch_add(1, std::memory_order_relaxed);
+        return Traits::alloc();
+    }
+
+    void release(T obj)
+    {
+        if (!obj)
+            return;
+        Traits::reset(obj);
+        if (!free_list.try_push(obj))
+            Traits::release(obj);
+    }
+
+    std::atomic<uint64_t> allocated{0};
+    std::atomic<uint64_t> reused{0};
+
+private:
+    SpscQueue<T, Traits> free_list;
+};
+
+using FramePool = RecyclePool<AVFrame *, FrameTraits>;
+using PacketPool = RecyclePool<AVPacket *, PacketTraits>;
@@ -1,135 +1,422 @@
 #pragma once
 
-#include <queue>
+#include <atomic>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "telemetry.h"
+
+#ifdef __linux__
+#include <ctime>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#else
+#include <chrono>
 #include <mutex>
 #include <condition_variable>
-#include <atomic>
+#endif
 
 extern "C"
 {
 #include <libavcodec/avcodec.h>
 }
 
-// ---- PacketQueue ----
-struct PacketQueue
+#define CACHE_LINE_SIZE 64
+
+// ---- WaitEvent ----
+// Event count used as the blocking fallback of the lock-free queues: a thread only
+// parks here after it has seen the ring empty (or full), and the other side only
+// pays for a syscall when somebody is actually parked.
+struct WaitEvent
 {
-    std::queue<AVPacket *> queue;
+    std::atomic<uint32_t> seq{0};
+    std::atomic<bool> waiting{false};
+#ifndef __linux__
     std::mutex mutex;
     std::condition_variable cond;
-    int max_size = 300;
-    std::atomic<bool> quit{false};
+#endif
 
-    void push(AVPacket *pkt)
+    // Announce the intent to wait. The caller must re-check its condition after this
+    // and then either wait(key) or cancel().
+    uint32_t prepare()
     {
-        std::unique_lock<std::mutex> lock(mutex);
-        cond.wait(lock, [this]
-                  { return queue.size() < max_size || quit; });
-        if (quit)
-        {
-            if (pkt)
-                av_packet_free(&pkt);
-            return;
-        }
-        queue.push(pkt);
-        lock.unlock();
-        cond.notify_one();
+        waiting.store(true, std::memory_order_seq_cst);
+        return seq.load(std::memory_order_seq_cst);
     }
 
-    AVPacket *pop()
+    void cancel()
     {
+        waiting.store(false, std::memory_order_relaxed);
+    }
+
+    void wait(uint32_t key)
+    {
+#ifdef __linux__
+        syscall(SYS_futex, reinterpret_cast<uint32_t *>(&seq), FUTEX_WAIT_PRIVATE, key, nullptr, nullptr, 0);
+#else
         std::unique_lock<std::mutex> lock(mutex);
-        cond.wait(lock, [this]
-                  { return !queue.empty() || quit; });
-        if (quit && queue.empty())
-        {
-            return nullptr;
-        }
-        AVPacket *pkt = queue.front();
-        queue.pop();
-        lock.unlock();
-        cond.notify_one();
-        return pkt;
+        cond.wait(lock, [this, key]
+                  { return seq.load() != key; });
+#endif
+        waiting.store(false, std::memory_order_relaxed);
     }
 
-    size_t size()
+    // As wait(), but returns after timeout_us at the latest.
+    void wait_for(uint32_t key, int64_t timeout_us)
     {
-        std::lock_guard<std::mutex> lock(mutex);
-        return queue.size();
+#ifdef __linux__
+        struct timespec timeout = {(time_t)(timeout_us / 1000000), (long)(timeout_us % 1000000) * 1000};
+        syscall(SYS_futex, reinterpret_cast<uint32_t *>(&seq), FUTEX_WAIT_PRIVATE, key, &timeout, nullptr, 0);
+#else
+        std::unique_lock<std::mutex> lock(mutex);
+        cond.wait_for(lock, std::chrono::microseconds(timeout_us), [this, key]
+                      { return seq.load() != key; });
+#endif
+        waiting.store(false, std::memory_order_relaxed);
     }
 
-    void abort()
+    // Wake the waiter if there is one. Must follow the state change the waiter re-checks.
+    void notify()
     {
-        quit = true;
-        cond.notify_all();
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiting.load(std::memory_order_relaxed))
+            notify_all();
     }
 
-    void flush()
+    void notify_all()
     {
-        std::lock_guard<std::mutex> lock(mutex);
-        while (!queue.empty())
+        seq.fetch_add(1, std::memory_order_seq_cst);
+#ifdef __linux__
+        syscall(SYS_futex, reinterpret_cast<uint32_t *>(&seq), FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+#else
         {
-            AVPacket *pkt = queue.front();
-            queue.pop();
-            av_packet_free(&pkt);
+            std::lock_guard<std::mutex> lock(mutex);
         }
+        cond.notify_all();
+#endif
     }
 };
 
-// ---- FrameQueue ----
-struct FrameQueue
+// ---- MemoryBudget ----
+// Global byte cap shared by every queue of a player. Consumers release bytes as they
+// pop; the demuxer parks on `space` while the cap is exceeded.
+struct MemoryBudget
 {
-    std::queue<AVFrame *> queue;
-    std::mutex mutex;
-    std::condition_variable cond;
-    int max_size = 30;
-    std::atomic<bool> quit{false};
+    std::atomic<int64_t> bytes{0};
+    int64_t cap = 0;
+    WaitEvent space;
 
-    void push(AVFrame *frame)
+    bool exceeded() const { return cap > 0 && bytes.load(std::memory_order_relaxed) >= cap; }
+
+    void charge(int64_t n) { bytes.fetch_add(n, std::memory_order_relaxed); }
+
+    void release(int64_t n)
     {
-        std::unique_lock<std::mutex> lock(mutex);
-        cond.wait(lock, [this]
-                  { return queue.size() < max_size || quit; });
-        if (quit)
+        bytes.fetch_sub(n, std::memory_order_relaxed);
+        space.notify();
+    }
+};
+
+// ---- SpscQueue ----
+// Bounded single-producer/single-consumer ring. push() blocks while the ring holds
+// max_size items, pop() blocks while it is empty. After abort() pushes release their
+// item and pop() drains what is left before returning a null item.
+//
+// Each item is also accounted in bytes and seconds. With a hard budget push() also
+// blocks once either limit is reached (the ring always accepts one item, however
+// large); otherwise the limits are only reported through over_budget() and the
+// producer decides.
+template <typename T, typename Traits>
+class SpscQueue
+{
+public:
+    explicit SpscQueue(size_t capacity) : max_size(capacity)
+    {
+        size_t n = 1;
+        while (n < capacity)
+            n <<= 1;
+        slots.resize(n);
+        mask = static_cast<uint32_t>(n - 1);
+    }
+
+    SpscQueue(const SpscQueue &) = delete;
+    SpscQueue &operator=(const SpscQueue &) = delete;
+
+    // Limits of 0 disable that budget. time_base converts item durations to seconds.
+    void set_budget(MemoryBudget *global, int64_t bytes_limit, double seconds_limit, AVRational tb, bool hard)
+    {
+        budget = global;
+        max_bytes = bytes_limit;
+        max_duration_us = static_cast<int64_t>(seconds_limit * 1e6);
+        time_base = av_q2d(tb);
+        hard_budget = hard;
+    }
+
+    // Records how long each item sat in the queue. Only before the queue is in use.
+    void set_wait_histogram(LatencyHistogram *h) { wait_histogram = h; }
+
+    void push(T item)
+    {
+        uint32_t t = tail.load(std::memory_order_relaxed);
+        while (!quit.load(std::memory_order_acquire) && !has_space(t))
+        {
+            cached_head = head.load(std::memory_order_acquire);
+            if (has_space(t))
+                break;
+            uint32_t key = not_full.prepare();
+            cached_head = head.load(std::memory_order_seq_cst);
+            if (has_space(t) || quit.load())
+            {
+                not_full.cancel();
+                break;
+            }
+            not_full.wait(key);
+        }
+        if (quit.load(std::memory_order_acquire))
         {
-            if (frame)
-                av_frame_free(&frame);
+            Traits::release(item);
             return;
         }
-        queue.push(frame);
-        lock.unlock();
-        cond.notify_one();
+
+        Slot &slot = slots[t & mask];
+        slot.item = item;
+        slot.bytes = item ? Traits::bytes(item) : 0;
+        slot.duration_us = item ? static_cast<int64_t>(Traits::duration(item, time_base) * 1e6) : 0;
+        slot.pushed_us = wait_histogram ? telemetry_now_us() : 0;
+        int64_t queued_bytes = bytes.fetch_add(slot.bytes, std::memory_order_relaxed) + slot.bytes;
+        duration_us.fetch_add(slot.duration_us, std::memory_order_relaxed);
+        if (budget)
+            budget->charge(slot.bytes);
+        tail.store(t + 1, std::memory_order_release);
+
+        if (t + 1 - cached_head > peak)
+        {
+            cached_head = head.load(std::memory_order_acquire);
+            if (t + 1 - cached_head > peak)
+                peak = t + 1 - cached_head;
+        }
+        if (queued_bytes > peak_bytes)
+            peak_bytes = queued_bytes;
+        not_empty.notify();
     }
 
-    AVFrame *pop()
+    // Non-blocking variants used by the recycling pools; they bypass the budgets.
+    bool try_push(T item)
     {
-        std::unique_lock<std::mutex> lock(mutex);
-        cond.wait(lock, [this]
-                  { return !queue.empty() || quit; });
-        if (quit && queue.empty())
+        uint32_t t = tail.load(std::memory_order_relaxed);
+        if (t - cached_head >= max_size)
+        {
+            cached_head = head.load(std::memory_order_acquire);
+            if (t - cached_head >= max_size)
+                return false;
+        }
+        slots[t & mask] = Slot{item, 0, 0, 0};
+        tail.store(t + 1, std::memory_order_release);
+        not_empty.notify();
+        return true;
+    }
+
+    bool try_pop(T &item)
+    {
+        uint32_t h = head.load(std::memory_order_relaxed);
+        if (h == cached_tail)
         {
-            return nullptr;
+            cached_tail = tail.load(std::memory_order_acquire);
+            if (h == cached_tail)
+                return false;
         }
-        AVFrame *frame = queue.front();
-        queue.pop();
-        lock.unlock();
-        cond.notify_one();
-        return frame;
+        item = take(h);
+        return true;
+    }
+
+    T pop()
+    {
+        uint32_t h = head.load(std::memory_order_relaxed);
+        while (h == cached_tail)
+        {
+            cached_tail = tail.load(std::memory_order_acquire);
+            if (h != cached_tail)
+                break;
+            if (quit.load(std::memory_order_acquire))
+                return T();
+            uint32_t key = not_empty.prepare();
+            cached_tail = tail.load(std::memory_order_seq_cst);
+            if (h != cached_tail || quit.load())
+            {
+                not_empty.cancel();
+                continue;
+            }
+            not_empty.wait(key);
+        }
+        return take(h);
+    }
+
+    size_t size() const
+    {
+        return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+    }
+
+    int64_t queued_bytes() const { return bytes.load(std::memory_order_relaxed); }
+    double queued_seconds() const { return duration_us.load(std::memory_order_relaxed) / 1e6; }
+
+    // True once the queue holds its item, byte or duration limit.
+    bool over_budget() const
+    {
+        return size() >= max_size ||
+               (max_bytes > 0 && bytes.load(std::memory_order_relaxed) >= max_bytes) ||
+               (max_duration_us > 0 && duration_us.load(std::memory_order_relaxed) >= max_duration_us);
     }
 
     void abort()
     {
         quit = true;
-        cond.notify_all();
+        not_empty.notify_all();
+        not_full.notify_all();
     }
 
+    // Releases everything still queued. Only valid once the producer has stopped.
     void flush()
     {
-        std::lock_guard<std::mutex> lock(mutex);
-        while (!queue.empty())
+        uint32_t h = head.load(std::memory_order_relaxed);
+        uint32_t t = tail.load(std::memory_order_acquire);
+        for (; h != t; h++)
         {
-            AVFrame *frame = queue.front();
-            queue.pop();
-            av_frame_free(&frame);
+            Slot &slot = slots[h & mask];
+            Traits::release(slot.item);
+            unaccount(slot);
+            slot = Slot();
         }
+        head.store(h, std::memory_order_release);
+        cached_tail = t;
     }
-};
\ No newline at end of file
+
+    const size_t max_size;
+    size_t peak = 0;
+    int64_t peak_bytes = 0;
+    std::atomic<bool> quit{false};
+
+private:
+    struct Slot
+    {
+        T item = T();
+        int64_t bytes = 0;
+        int64_t duration_us = 0;
+        int64_t pushed_us = 0;
+    };
+
+    bool has_space(uint32_t t) const
+    {
+        uint32_t n = t - cached_head;
+        if (n >= max_size)
+            return false;
+        if (n == 0 || !hard_budget)
+            return true;
+        return (max_bytes <= 0 || bytes.load(std::memory_order_relaxed) < max_bytes) &&
+               (max_duration_us <= 0 || duration_us.load(std::memory_order_relaxed) < max_duration_us);
+    }
+
+    T take(uint32_t h)
+    {
+        Slot &slot = slots[h & mask];
+        T item = slot.item;
+        if (wait_histogram && slot.pushed_us)
+            wait_histogram->record_since(slot.pushed_us);
+        unaccount(slot);
+        slot = Slot();
+        head.store(h + 1, std::memory_order_release);
+        not_full.notify();
+        return item;
+    }
+
+    void unaccount(const Slot &slot)
+    {
+        if (!slot.bytes && !slot.duration_us)
+            return;
+        bytes.fetch_sub(slot.bytes, std::memory_order_relaxed);
+        duration_us.fetch_sub(slot.duration_us, std::memory_order_relaxed);
+        if (budget)
+            budget->release(slot.bytes);
+    }
+
+    std::vector<Slot> slots;
+    uint32_t mask = 0;
+
+    MemoryBudget *budget = nullptr;
+    int64_t max_bytes = 0;
+    int64_t max_duration_us = 0;
+    double time_base = 0.0;
+    bool hard_budget = false;
+    LatencyHistogram *wait_histogram = nullptr;
+
+    // Producer side
+    alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> tail{0};
+    uint32_t cached_head = 0;
+
+    // Consumer side
+    alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> head{0};
+    uint32_t cached_tail = 0;
+
+    // Shared accounting
+    alignas(CACHE_LINE_SIZE) std::atomic<int64_t> bytes{0};
+    std::atomic<int64_t> duration_us{0};
+
+    alignas(CACHE_LINE_SIZE) WaitEvent not_empty;
+    alignas(CACHE_LINE_SIZE) WaitEvent not_full;
+};
+
+struct PacketTraits
+{
+    static AVPacket *alloc() { return av_packet_alloc(); }
+    static void reset(AVPacket *pkt) { av_packet_unref(pkt); }
+    static int64_t bytes(const AVPacket *pkt) { return pkt->size + (int64_t)sizeof(*pkt); }
+    // Packets of a playlist may come from inputs with different time bases.
+    static double duration(const AVPacket *pkt, double tb)
+    {
+        return pkt->duration * (pkt->time_base.num ? av_q2d(pkt->time_base) : tb);
+    }
+    static void release(AVPacket *pkt)
+    {
+        if (pkt)
+            av_packet_free(&pkt);
+    }
+};
+
+struct FrameTraits
+{
+    static AVFrame *alloc() { return av_frame_alloc(); }
+    static void reset(AVFrame *frame) { av_frame_unref(frame); }
+    static int64_t bytes(const AVFrame *frame)
+    {
+        int64_t n = sizeof(*frame);
+        for (int i = 0; i < AV_NUM_DATA_POINTERS && frame->buf[i]; i++)
+            n += frame->buf[i]->size;
+        return n;
+    }
+    static double duration(const AVFrame *frame, double tb)
+    {
+        if (frame->duration > 0)
+            return frame->duration * (frame->time_base.num ? av_q2d(frame->time_base) : tb);
+        if (frame->nb_samples > 0 && frame->sample_rate > 0)
+            return (double)frame->nb_samples / frame->sample_rate;
+        return 0.0;
+    }
+    static void release(AVFrame *frame)
+    {
+        if (frame)
+            av_frame_free(&frame);
+    }
+};
+
+// ---- PacketQueue ----
+struct PacketQueue : SpscQueue<AVPacket *, PacketTraits>
+{
+    PacketQueue() : SpscQueue(1024) {}
+};
+
+// ---- FrameQueue ----
+struct FrameQueue : SpscQueue<AVFrame *, FrameTraits>
+{
+    FrameQueue() : SpscQueue(30) {}
+};
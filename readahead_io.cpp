@@ -0,0 +1,236 @@
+#include "readahead_io.h"
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+
+extern "C"
+{
+#include <libavformat/avio.h>
+#include <libavutil/error.h>
+#include <libavutil/mem.h>
+}
+
+// Largest single source read, so a refetch or close never waits long behind one.
+#define READAHEAD_CHUNK (256 * 1024)
+#define READAHEAD_IO_BUFFER_SIZE (64 * 1024)
+
+ReadAheadIO::~ReadAheadIO()
+{
+    close();
+}
+
+bool ReadAheadIO::open(const std::string &url, size_t capacity, int64_t throttle_bytes_per_sec)
+{
+    close();
+    quit = false;
+
+    AVIOInterruptCB cb = {&ReadAheadIO::interrupt, this};
+    if (avio_open2(&source, url.c_str(), AVIO_FLAG_READ, &cb, nullptr) < 0)
+        return false;
+    source_size = avio_size(source);
+    source_seekable = source->seekable & AVIO_SEEKABLE_NORMAL;
+
+    unsigned char *buffer = static_cast<unsigned char *>(av_malloc(READAHEAD_IO_BUFFER_SIZE));
+    if (buffer)
+        avio = avio_alloc_context(buffer, READAHEAD_IO_BUFFER_SIZE, 0, this, &ReadAheadIO::read_packet, nullptr, &ReadAheadIO::seek);
+    if (!avio)
+    {
+        av_free(buffer);
+        avio_closep(&source);
+        return false;
+    }
+    // Backward seeks out of the AVIO buffer still reach seek() and may hit the ring.
+    avio->seekable = source_seekable ? AVIO_SEEKABLE_NORMAL : 0;
+
+    // Left uninitialized so untouched parts of a large ring cost no memory.
+    ring.reset(new uint8_t[capacity]);
+    ring_size = capacity;
+    ring_start = fill_end = read_pos = 0;
+    refetch = false;
+    eof = false;
+    error = 0;
+    counters = ReadAheadStats();
+    throttle = throttle_bytes_per_sec;
+
+    io_thread = std::thread(&ReadAheadIO::io_thread_entry, this);
+    return true;
+}
+
+void ReadAheadIO::close()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        quit = true;
+    }
+    data_cond.notify_all();
+    space_cond.notify_all();
+    if (io_thread.joinable())
+        io_thread.join();
+
+    if (avio)
+    {
+        av_freep(&avio->buffer);
+        avio_context_free(&avio);
+    }
+    if (source)
+        avio_closep(&source);
+    ring.reset();
+    ring_size = 0;
+}
+
+ReadAheadStats ReadAheadIO::stats()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    ReadAheadStats s = counters;
+    s.capacity = ring_size;
+    s.fill = fill_end - read_pos;
+    return s;
+}
+
+int ReadAheadIO::interrupt(void *opaque)
+{
+    return static_cast<ReadAheadIO *>(opaque)->quit.load();
+}
+
+void ReadAheadIO::io_thread_entry()
+{
+    // Read ahead until everything but the look-behind quarter holds unread data.
+    const int64_t ahead_limit = ring_size - ring_size / 4;
+
+    while (true)
+    {
+        int64_t offset;
+        size_t n;
+        int gen;
+        bool reposition;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            space_cond.wait(lock, [&]
+                            { return quit || refetch || (!eof && !error && fill_end - read_pos < ahead_limit); });
+            if (quit)
+                break;
+            reposition = refetch;
+            refetch = false;
+            offset = fill_end;
+            gen = generation;
+
+            n = ahead_limit - (fill_end - read_pos);
+            size_t contiguous = ring_size - offset % ring_size;
+            if (n > contiguous)
+                n = contiguous;
+            if (n > READAHEAD_CHUNK)
+                n = READAHEAD_CHUNK;
+            // Give up the oldest bytes before overwriting them, so a seek cannot land there.
+            if (offset + (int64_t)n - (int64_t)ring_size > ring_start)
+                ring_start = offset + n - ring_size;
+        }
+
+        auto t0 = std::chrono::steady_clock::now();
+        int ret = 0;
+        if (reposition && avio_seek(source, offset, SEEK_SET) < 0)
+            ret = AVERROR(EIO);
+        else
+            ret = avio_read(source, ring.get() + offset % ring_size, (int)n);
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+        if (throttle > 0 && ret > 0)
+        {
+            double budget = (double)ret / throttle;
+            if (budget > elapsed)
+                std::this_thread::sleep_for(std::chrono::duration<double>(budget - elapsed));
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        counters.fetch_seconds += elapsed;
+        if (gen != generation)
+            continue; // the demuxer seeked elsewhere meanwhile
+        if (ret > 0)
+        {
+            fill_end += ret;
+            counters.bytes_fetched += ret;
+        }
+        else if (ret == 0 || ret == AVERROR_EOF)
+            eof = true;
+        else if (!quit)
+            error = ret;
+        data_cond.notify_all();
+    }
+}
+
+int ReadAheadIO::read_packet(void *opaque, uint8_t *buf, int buf_size)
+{
+    ReadAheadIO *self = static_cast<ReadAheadIO *>(opaque);
+    std::unique_lock<std::mutex> lock(self->mutex);
+    if (self->read_pos >= self->fill_end && !self->eof && !self->error && !self->quit)
+    {
+        auto t0 = std::chrono::steady_clock::now();
+        self->counters.stalls++;
+        self->data_cond.wait(lock, [self]
+                             { return self->quit || self->read_pos < self->fill_end || self->eof || self->error; });
+        self->counters.stall_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    }
+
+    if (self->read_pos < self->fill_end)
+    {
+        size_t n = self->fill_end - self->read_pos;
+        if (n > (size_t)buf_size)
+            n = buf_size;
+        size_t off = self->read_pos % self->ring_size;
+        size_t first = n < self->ring_size - off ? n : self->ring_size - off;
+        memcpy(buf, self->ring.get() + off, first);
+        memcpy(buf + first, self->ring.get(), n - first);
+        self->read_pos += n;
+        self->space_cond.notify_one();
+        return (int)n;
+    }
+    if (self->quit)
+        return AVERROR_EXIT;
+    return self->error ? self->error : AVERROR_EOF;
+}
+
+int64_t ReadAheadIO::seek(void *opaque, int64_t offset, int whence)
+{
+    ReadAheadIO *self = static_cast<ReadAheadIO *>(opaque);
+    std::lock_guard<std::mutex> lock(self->mutex);
+    int64_t target;
+    switch (whence & ~AVSEEK_FORCE)
+    {
+    case AVSEEK_SIZE:
+        return self->source_size >= 0 ? self->source_size : AVERROR(ENOSYS);
+    case SEEK_SET:
+        target = offset;
+        break;
+    case SEEK_CUR:
+        target = self->read_pos + offset;
+        break;
+    case SEEK_END:
+        if (self->source_size < 0)
+            return AVERROR(ENOSYS);
+        target = self->source_size + offset;
+        break;
+    default:
+        return AVERROR(EINVAL);
+    }
+    if (target < 0)
+        return AVERROR(EINVAL);
+
+    if (target >= self->ring_start && target <= self->fill_end)
+    {
+        self->read_pos = target;
+        self->counters.seeks_in_buffer++;
+        self->space_cond.notify_one();
+        return target;
+    }
+    if (!self->source_seekable)
+        return AVERROR(ESPIPE);
+
+    // Out of the buffer: drop it and have the I/O thread restart at the target.
+    self->ring_start = self->fill_end = self->read_pos = target;
+    self->refetch = true;
+    self->generation++;
+    self->eof = false;
+    self->error = 0;
+    self->counters.seeks_refetch++;
+    self->space_cond.notify_one();
+    return target;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+struct AVIOContext;
+
+struct ReadAheadStats
+{
+    size_t capacity = 0;
+    size_t fill = 0;              // bytes buffered ahead of the demuxer
+    uint64_t bytes_fetched = 0;   // read from the source by the I/O thread
+    double fetch_seconds = 0.0;   // I/O thread time spent inside source reads
+    uint64_t stalls = 0;          // demuxer reads that found the buffer empty
+    double stall_seconds = 0.0;
+    uint64_t seeks_in_buffer = 0; // seeks served without touching the source
+    uint64_t seeks_refetch = 0;
+};
+
+// ---- ReadAheadIO ----
+// AVIOContext that decouples the demuxer from slow storage. A dedicated I/O thread
+// reads the source (any URL FFmpeg can open) into a large ring ahead of the demuxer,
+// keeping the most recent quarter of the ring behind the read position so short
+// backward seeks are served from memory as well. The demuxer only blocks when the
+// ring runs dry.
+class ReadAheadIO
+{
+public:
+    ReadAheadIO() = default;
+    ~ReadAheadIO();
+
+    ReadAheadIO(const ReadAheadIO &) = delete;
+    ReadAheadIO &operator=(const ReadAheadIO &) = delete;
+
+    // throttle_bytes_per_sec > 0 caps the source read rate, to reproduce slow storage.
+    bool open(const std::string &url, size_t capacity, int64_t throttle_bytes_per_sec = 0);
+    void close();
+
+    // Install as AVFormatContext::pb together with AVFMT_FLAG_CUSTOM_IO.
+    AVIOContext *context() const { return avio; }
+
+    ReadAheadStats stats();
+
+private:
+    void io_thread_entry();
+    static int read_packet(void *opaque, uint8_t *buf, int buf_size);
+    static int64_t seek(void *opaque, int64_t offset, int whence);
+    static int interrupt(void *opaque);
+
+    AVIOContext *source = nullptr;
+    AVIOContext *avio = nullptr;
+    int64_t source_size = -1;
+    bool source_seekable = false;
+    int64_t throttle = 0;
+    std::thread io_thread;
+    std::atomic<bool> quit{false};
+
+    // Ring holding file bytes [ring_start, fill_end); the byte at offset o lives at
+    // ring[o % ring_size]. All fields below are guarded by mutex. The I/O thread writes past
+    // fill_end without holding it, after moving ring_start past the bytes it will overwrite.
+    std::mutex mutex;
+    std::condition_variable data_cond;  // fill_end moved, EOF or error
+    std::condition_variable space_cond; // read_pos moved or seek requested
+    std::unique_ptr<uint8_t[]> ring;
+    size_t ring_size = 0;
+    int64_t ring_start = 0;
+    int64_t fill_end = 0;
+    int64_t read_pos = 0;
+    bool refetch = false; // I/O thread must reposition the source at fill_end
+    int generation = 0;   // bumped by every refetch; stale reads are discarded
+    bool eof = false;
+    int error = 0;
+    ReadAheadStats counters;
+};
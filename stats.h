@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+
+// ---- Stage timing ----
+struct StageStats
+{
+    double wall_seconds = 0.0;
+    double cpu_seconds = 0.0;
+};
+
+inline double thread_cpu_seconds()
+{
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Measures the wall and CPU time the current thread spends inside its scope.
+class ScopedStageTimer
+{
+public:
+    explicit ScopedStageTimer(StageStats &s)
+        : stats(s), wall_start(std::chrono::steady_clock::now()), cpu_start(thread_cpu_seconds()) {}
+
+    ~ScopedStageTimer()
+    {
+        stats.wall_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+        stats.cpu_seconds = thread_cpu_seconds() - cpu_start;
+    }
+
+private:
+    StageStats &stats;
+    std::chrono::steady_clock::time_point wall_start;
+    double cpu_start;
+};
+
+// ---- Pipeline counters ----
+struct PipelineStats
+{
+    StageStats demux;
+    StageStats video_decode;
+    StageStats audio_decode;
+    StageStats video_sink;
+    StageStats audio_sink;
+
+    std::atomic<uint64_t> packets_read{0};
+    std::atomic<uint64_t> packets_dropped{0};
+    // Index-based estimate of what AVDISCARD_ALL on unused streams saves.
+    uint64_t discarded_stream_packets = 0;
+    uint64_t discarded_stream_bytes = 0;
+    std::atomic<uint64_t> video_frames{0};
+    std::atomic<uint64_t> audio_samples{0};
+    // Audio callbacks that found fewer bytes in the PCM ring than the device asked for.
+    std::atomic<uint64_t> audio_underruns{0};
+
+    // Seek request to first displayed frame of its serial.
+    std::atomic<uint64_t> seeks{0};
+    std::atomic<uint64_t> seek_latency_total_us{0};
+    std::atomic<uint64_t> seek_latency_max_us{0};
+    std::atomic<uint64_t> stale_packets{0};
+    std::atomic<uint64_t> stale_frames{0};
+
+    // Decoder-side frame skipping (FrameSkipController): how often each level was
+    // entered and how many frames came out of the decoder at it.
+    std::atomic<uint64_t> skip_level_entries[4]{};
+    std::atomic<uint64_t> skip_level_frames[4]{};
+};
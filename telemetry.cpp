@@ -0,0 +1,255 @@
+#include "telemetry.h"
+#include <cstdio>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define TELEMETRY_PREFIX "video_player_"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+TelemetryExporter::~TelemetryExporter()
+{
+    stop();
+}
+
+void TelemetryExporter::add_histogram(const char *name, const char *help, const LatencyHistogram &h)
+{
+    histograms.push_back(Histogram{name, help, &h});
+}
+
+void TelemetryExporter::add_counter(const char *name, const char *help, const std::atomic<uint64_t> &c)
+{
+    counters.push_back(Counter{name, help, &c});
+}
+
+void TelemetryExporter::add_gauge(const char *name, const char *help, std::function<double()> read)
+{
+    gauges.push_back(Gauge{name, help, std::move(read)});
+}
+
+void TelemetryExporter::start(const std::string &target, Format fmt, int interval)
+{
+    format = fmt;
+    interval_ms = interval > 0 ? interval : 1000;
+    socket_mode = target.compare(0, 5, "unix:") == 0;
+    path = socket_mode ? target.substr(5) : target;
+
+    if (socket_mode)
+    {
+        sockaddr_un addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (path.empty() || path.size() >= sizeof(addr.sun_path))
+            throw std::runtime_error("Invalid telemetry socket path: " + path);
+        std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+
+        listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listen_fd < 0)
+            throw std::runtime_error("Could not create telemetry socket.");
+        unlink(path.c_str());
+        if (bind(listen_fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 || listen(listen_fd, 4) != 0)
+        {
+            close(listen_fd);
+            listen_fd = -1;
+            throw std::runtime_error("Could not listen on telemetry socket " + path);
+        }
+    }
+
+    quit = false;
+    thread = std::thread(&TelemetryExporter::thread_entry, this);
+}
+
+void TelemetryExporter::stop()
+{
+    if (!thread.joinable())
+        return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        quit = true;
+    }
+    cond.notify_all();
+    thread.join();
+
+    if (socket_mode)
+    {
+        close(listen_fd);
+        listen_fd = -1;
+        unlink(path.c_str());
+    }
+    else
+        write_file();
+}
+
+void TelemetryExporter::thread_entry()
+{
+    if (!socket_mode)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!cond.wait_for(lock, std::chrono::milliseconds(interval_ms), [this]
+                              { return quit; }))
+        {
+            lock.unlock();
+            write_file();
+            lock.lock();
+        }
+        return;
+    }
+
+    // Each client gets the snapshot of the moment it connected, then end of stream:
+    //   socat - UNIX-CONNECT:PATH
+    while (true)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (quit)
+                break;
+        }
+        pollfd pfd = {listen_fd, POLLIN, 0};
+        if (poll(&pfd, 1, 100) <= 0)
+            continue;
+        int client = accept(listen_fd, nullptr, nullptr);
+        if (client < 0)
+            continue;
+        std::string text = snapshot();
+        const char *p = text.data();
+        size_t left = text.size();
+        while (left > 0)
+        {
+            ssize_t n = send(client, p, left, MSG_NOSIGNAL);
+            if (n <= 0)
+                break;
+            p += n;
+            left -= (size_t)n;
+        }
+        close(client);
+    }
+}
+
+// Written next to the target and renamed over it, so readers never see half a file.
+void TelemetryExporter::write_file() const
+{
+    std::string tmp = path + ".tmp";
+    FILE *f = std::fopen(tmp.c_str(), "w");
+    if (!f)
+        return;
+    std::string text = snapshot();
+    bool ok = std::fwrite(text.data(), 1, text.size(), f) == text.size();
+    ok = std::fclose(f) == 0 && ok;
+    if (ok)
+        std::rename(tmp.c_str(), path.c_str());
+    else
+        std::remove(tmp.c_str());
+}
+
+std::string TelemetryExporter::snapshot() const
+{
+    return format == Format::Prometheus ? prometheus() : json();
+}
+
+// Upper bound in seconds of the bucket holding the q-quantile.
+static double quantile_seconds(const uint64_t *counts, uint64_t total, double q)
+{
+    if (total == 0)
+        return 0.0;
+    uint64_t rank = (uint64_t)(q * total);
+    uint64_t seen = 0;
+    for (int b = 0; b < LatencyHistogram::BUCKETS - 1; b++)
+    {
+        seen += counts[b];
+        if (seen > rank)
+            return LatencyHistogram::bucket_limit_us(b) / 1e6;
+    }
+    return LatencyHistogram::bucket_limit_us(LatencyHistogram::BUCKETS - 2) / 1e6;
+}
+
+std::string TelemetryExporter::json() const
+{
+    std::ostringstream out;
+    out << std::setprecision(12);
+    out << "{\"timestamp\":" << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count() / 1000.0;
+
+    out << ",\"histograms\":{";
+    for (size_t i = 0; i < histograms.size(); i++)
+    {
+        const LatencyHistogram &h = *histograms[i].h;
+        uint64_t counts[LatencyHistogram::BUCKETS];
+        uint64_t total = 0;
+        for (int b = 0; b < LatencyHistogram::BUCKETS; b++)
+            total += counts[b] = h.bucket_count(b);
+
+        out << (i ? "," : "") << "\"" << histograms[i].name << "\":{\"count\":" << total
+            << ",\"sum\":" << h.total_us() / 1e6 << ",\"max\":" << h.max() / 1e6
+            << ",\"p50\":" << quantile_seconds(counts, total, 0.5)
+            << ",\"p90\":" << quantile_seconds(counts, total, 0.9)
+            << ",\"p99\":" << quantile_seconds(counts, total, 0.99) << ",\"buckets\":[";
+        // Only non-empty buckets, as [upper bound in seconds or null for overflow, count].
+        bool first = true;
+        for (int b = 0; b < LatencyHistogram::BUCKETS; b++)
+        {
+            if (!counts[b])
+                continue;
+            out << (first ? "" : ",") << "[";
+            if (b < LatencyHistogram::BUCKETS - 1)
+                out << LatencyHistogram::bucket_limit_us(b) / 1e6;
+            else
+                out << "null";
+            out << "," << counts[b] << "]";
+            first = false;
+        }
+        out << "]}";
+    }
+
+    out << "},\"counters\":{";
+    for (size_t i = 0; i < counters.size(); i++)
+        out << (i ? "," : "") << "\"" << counters[i].name << "\":" << counters[i].c->load(std::memory_order_relaxed);
+
+    out << "},\"gauges\":{";
+    for (size_t i = 0; i < gauges.size(); i++)
+        out << (i ? "," : "") << "\"" << gauges[i].name << "\":" << gauges[i].read();
+    out << "}}\n";
+    return out.str();
+}
+
+std::string TelemetryExporter::prometheus() const
+{
+    std::ostringstream out;
+    out << std::setprecision(12);
+    for (const Histogram &entry : histograms)
+    {
+        const LatencyHistogram &h = *entry.h;
+        std::string name = std::string(TELEMETRY_PREFIX) + entry.name;
+        out << "# HELP " << name << " " << entry.help << "\n# TYPE " << name << " histogram\n";
+        uint64_t cumulative = 0;
+        for (int b = 0; b < LatencyHistogram::BUCKETS - 1; b++)
+        {
+            cumulative += h.bucket_count(b);
+            out << name << "_bucket{le=\"" << LatencyHistogram::bucket_limit_us(b) / 1e6 << "\"} " << cumulative << "\n";
+        }
+        cumulative += h.bucket_count(LatencyHistogram::BUCKETS - 1);
+        out << name << "_bucket{le=\"+Inf\"} " << cumulative << "\n"
+            << name << "_sum " << h.total_us() / 1e6 << "\n"
+            << name << "_count " << cumulative << "\n";
+    }
+    for (const Counter &entry : counters)
+    {
+        std::string name = std::string(TELEMETRY_PREFIX) + entry.name;
+        out << "# HELP " << name << " " << entry.help << "\n# TYPE " << name << " counter\n"
+            << name << " " << entry.c->load(std::memory_order_relaxed) << "\n";
+    }
+    for (const Gauge &entry : gauges)
+    {
+        std::string name = std::string(TELEMETRY_PREFIX) + entry.name;
+        out << "# HELP " << name << " " << entry.help << "\n# TYPE " << name << " gauge\n"
+            << name << " " << entry.read() << "\n";
+    }
+    return out.str();
+}
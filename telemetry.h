@@ -0,0 +1,159 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+inline int64_t telemetry_now_us()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// ---- LatencyHistogram ----
+// Lock-free histogram of durations in microseconds with power-of-two buckets: bucket
+// b counts values up to 2^b us, the last one everything above. Recording is a couple
+// of relaxed atomic adds, so it can sit on the render path and in the audio callback.
+// Readers see counts that only ever grow, like a Prometheus histogram.
+class LatencyHistogram
+{
+public:
+    static constexpr int BUCKETS = 28; // up to 2^26 us (67 s), then overflow
+
+    void record(int64_t us)
+    {
+        if (us < 0)
+            us = 0;
+        counts[bucket(us)].fetch_add(1, std::memory_order_relaxed);
+        sum_us.fetch_add((uint64_t)us, std::memory_order_relaxed);
+        uint64_t m = max_us.load(std::memory_order_relaxed);
+        while ((uint64_t)us > m && !max_us.compare_exchange_weak(m, (uint64_t)us, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    void record_since(int64_t start_us) { record(telemetry_now_us() - start_us); }
+
+    // Upper bound of bucket b in microseconds; the last bucket has none.
+    static int64_t bucket_limit_us(int b) { return (int64_t)1 << b; }
+
+    uint64_t bucket_count(int b) const { return counts[b].load(std::memory_order_relaxed); }
+    uint64_t total_us() const { return sum_us.load(std::memory_order_relaxed); }
+    uint64_t max() const { return max_us.load(std::memory_order_relaxed); }
+
+private:
+    static int bucket(int64_t us)
+    {
+        if (us <= 1)
+            return 0;
+        int b = 64 - __builtin_clzll((uint64_t)(us - 1));
+        return b < BUCKETS - 1 ? b : BUCKETS - 1;
+    }
+
+    std::atomic<uint64_t> counts[BUCKETS]{};
+    std::atomic<uint64_t> sum_us{0};
+    std::atomic<uint64_t> max_us{0};
+};
+
+// ---- Telemetry ----
+// Per-stage latency of the playback pipeline. Every histogram is written by a single
+// pipeline thread; the exporter only reads.
+struct Telemetry
+{
+    LatencyHistogram demux_read;        // av_read_frame
+    LatencyHistogram video_packet_wait; // time in video_q
+    LatencyHistogram audio_packet_wait; // time in audio_q
+    LatencyHistogram video_decode;      // send_packet plus the frames it releases
+    LatencyHistogram video_frame_wait;  // time in video_frame_q
+    LatencyHistogram display_convert;   // sws fallback for formats the shaders cannot sample
+    LatencyHistogram display_upload;    // PBO staging and texture upload
+    LatencyHistogram display_draw;
+    LatencyHistogram display_swap;
+    LatencyHistogram audio_callback;
+    // A/V difference of each scheduled frame, split by sign.
+    LatencyHistogram av_video_behind;
+    LatencyHistogram av_video_ahead;
+    std::atomic<uint64_t> late_frames_dropped{0};
+
+    void record_av_diff(double diff)
+    {
+        if (diff < 0)
+            av_video_behind.record((int64_t)(-diff * 1e6));
+        else
+            av_video_ahead.record((int64_t)(diff * 1e6));
+    }
+};
+
+// ---- TelemetryExporter ----
+// Writes a snapshot of registered histograms, gauges and counters every interval,
+// as JSON or in the Prometheus text format. The target is a file, replaced
+// atomically on each write, or "unix:PATH" to serve the current snapshot to every
+// client that connects to a Unix socket at PATH.
+class TelemetryExporter
+{
+public:
+    enum class Format
+    {
+        Json,
+        Prometheus,
+    };
+
+    ~TelemetryExporter();
+
+    // Registration happens before start(). Names are Prometheus-style, without prefix.
+    void add_histogram(const char *name, const char *help, const LatencyHistogram &h);
+    void add_counter(const char *name, const char *help, const std::atomic<uint64_t> &c);
+    void add_gauge(const char *name, const char *help, std::function<double()> read);
+
+    // Throws std::runtime_error if the socket cannot be set up.
+    void start(const std::string &target, Format format, int interval_ms);
+    // Writes a last snapshot to a file target.
+    void stop();
+
+    std::string snapshot() const;
+
+private:
+    struct Histogram
+    {
+        const char *name;
+        const char *help;
+        const LatencyHistogram *h;
+    };
+    struct Counter
+    {
+        const char *name;
+        const char *help;
+        const std::atomic<uint64_t> *c;
+    };
+    struct Gauge
+    {
+        const char *name;
+        const char *help;
+        std::function<double()> read;
+    };
+
+    void thread_entry();
+    void write_file() const;
+    std::string json() const;
+    std::string prometheus() const;
+
+    std::vector<Histogram> histograms;
+    std::vector<Counter> counters;
+    std::vector<Gauge> gauges;
+
+    std::string path;
+    bool socket_mode = false;
+    int listen_fd = -1;
+    Format format = Format::Json;
+    int interval_ms = 1000;
+
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable cond;
+    bool quit = false;
+};
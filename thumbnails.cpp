@@ -0,0 +1,336 @@
+#include "thumbnails.h"
+#include "work_pool.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+extern "C"
+{
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+#include <libavutil/imgutils.h>
+#include <libswscale/swscale.h>
+}
+
+#define JPEG_QSCALE 4
+#define MAX_THUMBNAILS 100000
+
+ThumbnailWriter::ThumbnailWriter(const std::string &file, const PlayerOptions &opts) : filename(file), options(opts) {}
+
+ThumbnailWriter::~ThumbnailWriter()
+{
+    slots.clear();
+    for (AVFrame *&sheet : sheets)
+        av_frame_free(&sheet);
+}
+
+void ThumbnailWriter::open_slot(Slot &slot)
+{
+    slot.open(filename, options, buffer_pool);
+    // Only keyframes are ever sent; anything else would be dropped undecoded anyway.
+    slot.input->video_codec_ctx->skip_frame = AVDISCARD_NONKEY;
+}
+
+void ThumbnailWriter::run()
+{
+    auto wall_start = std::chrono::steady_clock::now();
+    WorkStealingPool &pool = WorkStealingPool::shared();
+    for (unsigned i = 0; i < std::max(1u, pool.size()); i++)
+        slots.push_back(std::make_unique<Slot>());
+
+    // The caller's input tells the duration and picture size up front.
+    open_slot(*slots[0]);
+    const MediaInput &first = *slots[0]->input;
+    duration = first.duration();
+    if (duration <= 0)
+        throw std::runtime_error("Thumbnails need a file with a known duration.");
+    start = first.start_time();
+    if (options.thumbnail_interval > 0)
+        count = (int)std::min<double>(MAX_THUMBNAILS, std::ceil(duration / options.thumbnail_interval));
+    else
+        count = std::min(MAX_THUMBNAILS, options.thumbnail_count);
+    if (count <= 0)
+        throw std::runtime_error("No thumbnails requested.");
+    step = options.thumbnail_interval > 0 ? options.thumbnail_interval : duration / count;
+
+    const AVCodecContext *ctx = first.video_codec_ctx;
+    double sar = ctx->sample_aspect_ratio.num > 0 ? av_q2d(ctx->sample_aspect_ratio) : 1.0;
+    tile_w = std::max(16, options.thumbnail_width) & ~1;
+    tile_h = std::max(2, (int)std::lrint(tile_w * ctx->height / (ctx->width * sar))) & ~1;
+    columns = std::max(1, std::min(options.thumbnail_columns, count));
+    per_sheet = columns * std::max(1, options.thumbnail_rows);
+    allocate_sheets();
+
+    // Runs of neighbouring slots keep each thread's seeks short and let a slot reuse
+    // the keyframe of the one before it; several runs per thread even out the load.
+    int runs = std::min(count, (int)slots.size() * 4);
+    pool.parallel_for(runs, (int)slots.size(), [&](int run, int s)
+                      {
+                          Slot &slot = *slots[s];
+                          int begin = (int)((int64_t)count * run / runs);
+                          int end = (int)((int64_t)count * (run + 1) / runs);
+                          try
+                          {
+                              if (!slot.input)
+                                  open_slot(slot);
+                          }
+                          catch (const std::exception &e)
+                          {
+                              std::lock_guard<std::mutex> lock(error_mutex);
+                              error = e.what();
+                              failed += end - begin;
+                              return;
+                          }
+                          for (int tile = begin; tile < end; tile++)
+                              extract(slot, tile); });
+    if (failed == count)
+        throw std::runtime_error(error.empty() ? "No keyframe could be decoded." : error);
+
+    pool.parallel_for((int)sheets.size(), (int)slots.size(), [&](int sheet, int)
+                      {
+                          try
+                          {
+                              write_sheet(sheet);
+                          }
+                          catch (const std::exception &e)
+                          {
+                              std::lock_guard<std::mutex> lock(error_mutex);
+                              error = e.what();
+                              failed = count;
+                          } });
+    if (failed == count)
+        throw std::runtime_error(error);
+    write_vtt();
+
+    int64_t decoded = 0;
+    int threads = 0;
+    for (const auto &slot : slots)
+    {
+        decoded += slot->decoded;
+        threads += slot->input != nullptr;
+    }
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+    std::cout << std::fixed << std::setprecision(2)
+              << "Thumbnails: " << count << " of " << tile_w << "x" << tile_h << " in " << sheets.size() << " sheet(s) and "
+              << options.thumbnail_output << ".vtt; " << decoded << " keyframes decoded by " << threads
+              << " threads in " << wall << " s" << std::endl;
+    if (failed > 0)
+        std::cerr << failed << " thumbnail(s) could not be decoded" << (error.empty() ? "" : ": " + error) << std::endl;
+}
+
+void ThumbnailWriter::extract(Slot &slot, int tile)
+{
+    MediaInput &in = *slot.input;
+    int64_t ts = std::llrint((start + (tile + 0.5) * step) / av_q2d(in.video_stream->time_base));
+
+    // With a cached keyframe index a repeat of the last keyframe is known before seeking.
+    const KeyframeEntry *kf = in.keyframe_index.find(ts);
+    if (kf && kf->pts == slot.last_key_pts)
+    {
+        copy_tile(slot.last_tile, tile);
+        return;
+    }
+    if (!grab(slot, tile, ts))
+    {
+        std::lock_guard<std::mutex> lock(error_mutex);
+        failed++;
+    }
+}
+
+// Decodes the keyframe at or before ts into tile.
+bool ThumbnailWriter::grab(Slot &slot, int tile, int64_t ts)
+{
+    MediaInput &in = *slot.input;
+    AVFormatContext *fmt = in.format_ctx;
+    if (avformat_seek_file(fmt, in.video_stream_index, INT64_MIN, ts, ts, 0) < 0 &&
+        av_seek_frame(fmt, in.video_stream_index, ts, AVSEEK_FLAG_BACKWARD) < 0)
+        return false;
+
+    AVPacket *packet = slot.packet;
+    while (true)
+    {
+        if (av_read_frame(fmt, packet) < 0)
+            return false;
+        if (packet->stream_index == in.video_stream_index && (packet->flags & AV_PKT_FLAG_KEY))
+            break;
+        av_packet_unref(packet);
+    }
+    int64_t key_pts = packet->pts != AV_NOPTS_VALUE ? packet->pts : packet->dts;
+    if (key_pts == slot.last_key_pts && slot.last_tile >= 0)
+    {
+        av_packet_unref(packet);
+        copy_tile(slot.last_tile, tile);
+        return true;
+    }
+
+    // Draining right away gets the keyframe out without feeding the packets after it;
+    // the flush readies the decoder for the next seek.
+    AVCodecContext *ctx = in.video_codec_ctx;
+    int sent = avcodec_send_packet(ctx, packet);
+    av_packet_unref(packet);
+    bool got = false;
+    if (sent == 0)
+    {
+        avcodec_send_packet(ctx, nullptr);
+        while (avcodec_receive_frame(ctx, slot.frame) == 0)
+        {
+            if (!got)
+                got = scale_into(slot, tile);
+            av_frame_unref(slot.frame);
+        }
+    }
+    avcodec_flush_buffers(ctx);
+    if (got)
+    {
+        slot.last_key_pts = key_pts;
+        slot.last_tile = tile;
+        slot.decoded++;
+    }
+    return got;
+}
+
+bool ThumbnailWriter::scale_into(Slot &slot, int tile)
+{
+    AVFrame *frame = slot.frame;
+    SwsContext *prev = slot.sws_ctx;
+    slot.sws_ctx = sws_getCachedContext(slot.sws_ctx, frame->width, frame->height, static_cast<AVPixelFormat>(frame->format),
+                                        tile_w, tile_h, AV_PIX_FMT_YUVJ420P, SWS_AREA, nullptr, nullptr, nullptr);
+    if (!slot.sws_ctx)
+        return false;
+    if (slot.sws_ctx != prev)
+        slot.sws_colorspace = slot.sws_range = -1;
+    set_sws_source_colorspace(slot.sws_ctx, frame, slot.sws_colorspace, slot.sws_range);
+
+    uint8_t *planes[4] = {};
+    int linesize[4] = {};
+    tile_planes(tile, planes, linesize);
+    sws_scale(slot.sws_ctx, (const uint8_t *const *)frame->data, frame->linesize, 0, frame->height, planes, linesize);
+    return true;
+}
+
+void ThumbnailWriter::tile_planes(int tile, uint8_t *planes[4], int linesize[4])
+{
+    AVFrame *sheet = sheets[tile / per_sheet];
+    int k = tile % per_sheet;
+    int x = (k % columns) * tile_w;
+    int y = (k / columns) * tile_h;
+    planes[0] = sheet->data[0] + (size_t)y * sheet->linesize[0] + x;
+    planes[1] = sheet->data[1] + (size_t)(y / 2) * sheet->linesize[1] + x / 2;
+    planes[2] = sheet->data[2] + (size_t)(y / 2) * sheet->linesize[2] + x / 2;
+    for (int p = 0; p < 3; p++)
+        linesize[p] = sheet->linesize[p];
+}
+
+void ThumbnailWriter::copy_tile(int from, int to)
+{
+    uint8_t *src[4], *dst[4];
+    int src_linesize[4], dst_linesize[4];
+    tile_planes(from, src, src_linesize);
+    tile_planes(to, dst, dst_linesize);
+    for (int p = 0; p < 3; p++)
+        av_image_copy_plane(dst[p], dst_linesize[p], src[p], src_linesize[p], p ? tile_w / 2 : tile_w, p ? tile_h / 2 : tile_h);
+}
+
+void ThumbnailWriter::allocate_sheets()
+{
+    int rows = per_sheet / columns;
+    for (int first = 0; first < count; first += per_sheet)
+    {
+        int tiles = std::min(per_sheet, count - first);
+        AVFrame *sheet = av_frame_alloc();
+        if (!sheet)
+            throw std::runtime_error("Could not allocate sprite sheet.");
+        sheets.push_back(sheet);
+        sheet->format = AV_PIX_FMT_YUVJ420P;
+        sheet->width = columns * tile_w;
+        sheet->height = std::min(rows, (tiles + columns - 1) / columns) * tile_h;
+        sheet->color_range = AVCOL_RANGE_JPEG;
+        if (av_frame_get_buffer(sheet, 0) < 0)
+            throw std::runtime_error("Could not allocate sprite sheet.");
+        // Black, for tiles that fail to decode.
+        memset(sheet->data[0], 0, (size_t)sheet->linesize[0] * sheet->height);
+        memset(sheet->data[1], 128, (size_t)sheet->linesize[1] * (sheet->height / 2));
+        memset(sheet->data[2], 128, (size_t)sheet->linesize[2] * (sheet->height / 2));
+    }
+}
+
+static std::string sheet_path(const std::string &output, int sheet)
+{
+    return output + "-" + std::to_string(sheet + 1) + ".jpg";
+}
+
+void ThumbnailWriter::write_sheet(int index)
+{
+    AVFrame *sheet = sheets[index];
+    const AVCodec *codec = avcodec_find_encoder(AV_CODEC_ID_MJPEG);
+    if (!codec)
+        throw std::runtime_error("No JPEG encoder.");
+    AVCodecContext *enc = avcodec_alloc_context3(codec);
+    if (!enc)
+        throw std::runtime_error("Could not allocate JPEG encoder.");
+    enc->width = sheet->width;
+    enc->height = sheet->height;
+    enc->pix_fmt = AV_PIX_FMT_YUVJ420P;
+    enc->color_range = AVCOL_RANGE_JPEG;
+    enc->time_base = AVRational{1, 1};
+    enc->flags |= AV_CODEC_FLAG_QSCALE;
+    enc->global_quality = FF_QP2LAMBDA * JPEG_QSCALE;
+    enc->thread_count = 1;
+
+    std::string path = sheet_path(options.thumbnail_output, index);
+    std::ofstream out(path, std::ios::binary);
+    AVPacket *packet = av_packet_alloc();
+    bool ok = out && packet && avcodec_open2(enc, codec, nullptr) == 0;
+    if (ok)
+    {
+        sheet->quality = enc->global_quality;
+        sheet->pts = 0;
+        ok = avcodec_send_frame(enc, sheet) == 0 && avcodec_send_frame(enc, nullptr) == 0;
+        while (ok && avcodec_receive_packet(enc, packet) == 0)
+        {
+            out.write(reinterpret_cast<const char *>(packet->data), packet->size);
+            av_packet_unref(packet);
+        }
+        ok = ok && out.good();
+    }
+    av_packet_free(&packet);
+    avcodec_free_context(&enc);
+    if (!ok)
+        throw std::runtime_error("Could not write " + path);
+}
+
+static std::string vtt_time(double seconds)
+{
+    int64_t ms = std::llrint(std::max(0.0, seconds) * 1000.0);
+    std::ostringstream s;
+    s << std::setfill('0') << std::setw(2) << ms / 3600000 << ":" << std::setw(2) << ms / 60000 % 60 << ":"
+      << std::setw(2) << ms / 1000 % 60 << "." << std::setw(3) << ms % 1000;
+    return s.str();
+}
+
+void ThumbnailWriter::write_vtt()
+{
+    // Cues name the sheets relative to the .vtt, which sits next to them.
+    std::string path = options.thumbnail_output + ".vtt";
+    std::ofstream out(path);
+    out << "WEBVTT\n";
+    for (int tile = 0; tile < count; tile++)
+    {
+        std::string sheet = sheet_path(options.thumbnail_output, tile / per_sheet);
+        size_t slash = sheet.find_last_of('/');
+        if (slash != std::string::npos)
+            sheet = sheet.substr(slash + 1);
+        int k = tile % per_sheet;
+        out << "\n"
+            << vtt_time(tile * step) << " --> " << vtt_time(std::min((tile + 1) * step, duration)) << "\n"
+            << sheet << "#xywh=" << (k % columns) * tile_w << "," << (k / columns) * tile_h << "," << tile_w << "," << tile_h << "\n";
+    }
+    if (!out)
+        throw std::runtime_error("Could not write " + path);
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "player_options.h"
+#include "buffer_pool.h"
+#include "decode_slot.h"
+
+struct AVFrame;
+
+// ---- ThumbnailWriter ----
+// Non-interactive scrub-preview generator. The timeline is cut into equal slots,
+// thumbnail_count of them or one per thumbnail_interval seconds, and each slot gets
+// the keyframe at or before its middle. Slots are handed out in runs of neighbours
+// to the shared WorkStealingPool; every thread opens its own MediaInput with a
+// single-threaded decoder that only decodes keyframes (AVDISCARD_NONKEY), seeks to
+// each slot's keyframe, decodes that one packet and scales it straight into its
+// tile with a cached SwsContext. Slots that land on the keyframe of the previous
+// slot copy its tile instead. The tiles go into JPEG sprite sheets
+// "<output>-N.jpg" of thumbnail_columns x thumbnail_rows, indexed by a WebVTT file
+// "<output>.vtt" with one #xywh cue per slot.
+class ThumbnailWriter
+{
+public:
+    ThumbnailWriter(const std::string &file, const PlayerOptions &opts);
+    ~ThumbnailWriter();
+
+    // Throws std::runtime_error if the file cannot be opened or nothing is written.
+    void run();
+
+private:
+    struct Slot : DecodeSlot
+    {
+        int64_t last_key_pts = INT64_MIN; // keyframe of last_tile
+        int last_tile = -1;
+    };
+
+    void open_slot(Slot &slot);
+    void extract(Slot &slot, int tile);
+    bool grab(Slot &slot, int tile, int64_t ts);
+    bool scale_into(Slot &slot, int tile);
+    void copy_tile(int from, int to);
+    void tile_planes(int tile, uint8_t *planes[4], int linesize[4]);
+    void allocate_sheets();
+    void write_sheet(int sheet);
+    void write_vtt();
+
+    std::string filename;
+    PlayerOptions options;
+    FrameBufferPool buffer_pool;
+    std::vector<std::unique_ptr<Slot>> slots;
+
+    double start = 0.0;    // file seconds of the first slot
+    double step = 0.0;     // slot length in seconds
+    double duration = 0.0;
+    int count = 0;
+    int tile_w = 0, tile_h = 0;
+    int columns = 0;
+    int per_sheet = 0;
+    std::vector<AVFrame *> sheets; // yuvj420p
+
+    std::mutex error_mutex;
+    std::string error;
+    int failed = 0;
+};
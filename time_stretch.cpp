@@ -0,0 +1,145 @@
+#include "time_stretch.h"
+#include <algorithm>
+#include <cmath>
+
+#define CHANNELS 2
+
+static inline int16_t to_s16(float v)
+{
+    long s = std::lrintf(v);
+    return (int16_t)std::min(32767L, std::max(-32768L, s));
+}
+
+void TimeStretch::reset(int sample_rate)
+{
+    rate = sample_rate;
+    window = sample_rate > 0 ? std::max(64, sample_rate * WINDOW_MS / 1000) & ~1 : 0;
+    hop = window / 2;
+    search = sample_rate * SEARCH_MS / 1000;
+    // Periodic Hann: two copies half a window apart sum to exactly 1.
+    hann.resize(window);
+    for (int i = 0; i < window; i++)
+        hann[i] = (float)(0.5 - 0.5 * std::cos(2.0 * M_PI * i / window));
+
+    input.clear();
+    base = 0;
+    received = 0;
+    // A silent segment before the start, so the first real one fades in.
+    prev_pos = -hop;
+    next_pos = 0.0;
+    tail.assign((size_t)hop * CHANNELS, 0.0f);
+    output.clear();
+}
+
+void TimeStretch::set_tempo(double t)
+{
+    ratio = std::min(MAX_TEMPO, std::max(MIN_TEMPO, t));
+}
+
+// At tempo 1 the next segment is the natural continuation of the previous one.
+int64_t TimeStretch::next_start() const
+{
+    return ratio == 1.0 ? prev_pos + hop : std::llround(next_pos);
+}
+
+const int16_t *TimeStretch::process(const int16_t *in, int frames, int &out_frames)
+{
+    output.clear();
+    if (window > 0 && frames > 0)
+    {
+        size_t old = input.size();
+        input.resize(old + (size_t)frames * CHANNELS);
+        for (size_t i = 0; i < (size_t)frames * CHANNELS; i++)
+            input[old + i] = in[i];
+        received += frames;
+
+        while (next_start() + search + window <= received)
+            step();
+        compact();
+    }
+    out_frames = (int)(output.size() / CHANNELS);
+    return output.data();
+}
+
+const int16_t *TimeStretch::drain(int &out_frames)
+{
+    // The tail plus the same input faded in is that input unchanged, so the rest
+    // goes out as it is from where the tail starts.
+    std::vector<int16_t> rest;
+    for (int64_t pos = std::max(prev_pos + hop, base); pos < received; pos++)
+        for (int c = 0; c < CHANNELS; c++)
+            rest.push_back(to_s16(input[(size_t)(pos - base) * CHANNELS + c]));
+    reset(rate);
+    output.swap(rest);
+    out_frames = (int)(output.size() / CHANNELS);
+    return output.data();
+}
+
+// The shift from nominal within [-search, search] whose segment start best matches
+// the input that followed the previous segment's first half, by normalized
+// cross-correlation of the channel sum: coarse on every other shift and frame,
+// then refined around the best.
+int TimeStretch::best_offset(int64_t nominal) const
+{
+    const float *ref = &input[(size_t)(prev_pos + hop - base) * CHANNELS];
+    int lo = (int)std::max<int64_t>(-search, base - nominal);
+    auto score = [&](int d)
+    {
+        const float *cand = &input[(size_t)(nominal + d - base) * CHANNELS];
+        double dot = 0.0, energy = 0.0;
+        for (int i = 0; i < hop; i += 2)
+        {
+            float r = ref[i * CHANNELS] + ref[i * CHANNELS + 1];
+            float x = cand[i * CHANNELS] + cand[i * CHANNELS + 1];
+            dot += r * x;
+            energy += x * x;
+        }
+        return energy > 0.0 ? dot / std::sqrt(energy) : 0.0;
+    };
+
+    int best = std::max(lo, 0);
+    double best_score = score(best);
+    for (int d = lo; d <= search; d += 2)
+    {
+        double s = score(d);
+        if (s > best_score)
+            best_score = s, best = d;
+    }
+    int coarse = best;
+    for (int d = std::max(lo, coarse - 1); d <= std::min(search, coarse + 1); d++)
+    {
+        double s = score(d);
+        if (s > best_score)
+            best_score = s, best = d;
+    }
+    return best;
+}
+
+void TimeStretch::step()
+{
+    int64_t nominal = next_start();
+    int64_t pos = nominal;
+    if (ratio != 1.0 && prev_pos >= 0)
+        pos += best_offset(nominal);
+
+    const float *seg = &input[(size_t)(pos - base) * CHANNELS];
+    for (int i = 0; i < hop; i++)
+        for (int c = 0; c < CHANNELS; c++)
+        {
+            output.push_back(to_s16(tail[i * CHANNELS + c] + seg[i * CHANNELS + c] * hann[i]));
+            tail[i * CHANNELS + c] = seg[(hop + i) * CHANNELS + c] * hann[hop + i];
+        }
+
+    prev_pos = pos;
+    next_pos = (ratio == 1.0 ? (double)pos : next_pos) + hop * ratio;
+}
+
+// Drops input no later segment or search can reach.
+void TimeStretch::compact()
+{
+    int64_t keep = std::min(prev_pos + hop, next_start() - search);
+    if (keep - base < window * 4)
+        return;
+    input.erase(input.begin(), input.begin() + (size_t)(keep - base) * CHANNELS);
+    base = keep;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// ---- TimeStretch ----
+// Changes the speed of interleaved s16 stereo without changing its pitch, by
+// waveform-similarity overlap-add (WSOLA, the method of FFmpeg's atempo filter).
+// The input is cut into Hann-windowed segments of WINDOW_MS that are overlap-added
+// half a window apart. The next segment is taken tempo times that hop further into
+// the input, moved by up to SEARCH_MS to where it best continues the previous one,
+// so the overlap does not cancel out. At tempo 1 segments follow each other exactly
+// and the output is the input, delayed.
+class TimeStretch
+{
+public:
+    static constexpr double MIN_TEMPO = 0.5;
+    static constexpr double MAX_TEMPO = 4.0;
+
+    // Drops all buffered audio, e.g. after a seek.
+    void reset(int sample_rate);
+
+    // Takes effect from the next segment; clamped to [MIN_TEMPO, MAX_TEMPO].
+    void set_tempo(double t);
+    double tempo() const { return ratio; }
+
+    // Appends frames of input and returns the output completed since the last call,
+    // valid until the next one.
+    const int16_t *process(const int16_t *in, int frames, int &out_frames);
+
+    // Returns everything still buffered, unstretched, and starts over; for the end
+    // of the stream.
+    const int16_t *drain(int &out_frames);
+
+    // Input frames taken in that are not in the output yet.
+    int64_t pending() const { return received - (prev_pos + hop); }
+
+private:
+    static constexpr int WINDOW_MS = 20;
+    static constexpr int SEARCH_MS = 5;
+
+    int64_t next_start() const;
+    int best_offset(int64_t nominal) const;
+    void step();
+    void compact();
+
+    int rate = 0;
+    int window = 0; // segment length in frames
+    int hop = 0;    // window / 2
+    int search = 0; // frames a segment may move either way
+    double ratio = 1.0;
+    std::vector<float> hann;
+
+    // Input frames from absolute position base on, interleaved.
+    std::vector<float> input;
+    int64_t base = 0;
+    int64_t received = 0;
+
+    double next_pos = 0.0; // nominal input position of the next segment
+    int64_t prev_pos = 0;  // where the previous segment was actually taken
+    std::vector<float> tail; // its windowed second half, not output yet
+    std::vector<int16_t> output;
+};
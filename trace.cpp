@@ -0,0 +1,122 @@
+#include "trace.h"
+#include <algorithm>
+#include <cstdio>
+#include <map>
+#include <utility>
+#include <vector>
+
+std::atomic<bool> Tracer::on{false};
+size_t Tracer::capacity = 0;
+Tracer::ThreadBuffer Tracer::buffers[Tracer::MAX_THREADS];
+std::atomic<int> Tracer::claimed{0};
+thread_local int Tracer::slot = -1;
+
+void Tracer::enable(size_t events_per_thread)
+{
+    size_t n = 1024;
+    while (n < events_per_thread)
+        n <<= 1;
+    capacity = n;
+    // Left uninitialized: the pages of a ring no thread claims are never touched.
+    for (int i = 0; i < MAX_THREADS; i++)
+    {
+        buffers[i].events.reset(new Event[n]);
+        buffers[i].tid = i + 1;
+    }
+    on = true;
+}
+
+Tracer::ThreadBuffer *Tracer::thread_buffer()
+{
+    if (slot < 0)
+        slot = claimed.fetch_add(1, std::memory_order_relaxed);
+    return slot < MAX_THREADS ? &buffers[slot] : nullptr;
+}
+
+void Tracer::set_thread_name(const char *name)
+{
+    if (!enabled())
+        return;
+    if (ThreadBuffer *b = thread_buffer())
+        b->name = name;
+}
+
+void Tracer::record(const char *cat, const char *name, int64_t start_us, int64_t end_us, int64_t flow)
+{
+    if (!enabled())
+        return;
+    ThreadBuffer *b = thread_buffer();
+    if (!b)
+        return;
+    b->events[b->written & (capacity - 1)] = Event{cat, name, start_us, end_us - start_us, flow};
+    b->written++;
+}
+
+bool Tracer::write_chrome_json(const std::string &path)
+{
+    FILE *f = std::fopen(path.c_str(), "w");
+    if (!f)
+        return false;
+
+    struct Placed
+    {
+        const Event *e;
+        int tid;
+    };
+    std::vector<Placed> events;
+    int used = std::min(claimed.load(std::memory_order_acquire), MAX_THREADS);
+    for (int t = 0; t < used; t++)
+    {
+        const ThreadBuffer &b = buffers[t];
+        uint64_t first = b.written > capacity ? b.written - capacity : 0;
+        for (uint64_t i = first; i < b.written; i++)
+            events.push_back(Placed{&b.events[i & (capacity - 1)], b.tid});
+    }
+    std::stable_sort(events.begin(), events.end(), [](const Placed &a, const Placed &b)
+                     { return a.e->start_us < b.e->start_us; });
+
+    // Flow steps in time order; the last one of each flow ends it.
+    std::map<std::pair<std::string, int64_t>, size_t> last_step;
+    for (size_t i = 0; i < events.size(); i++)
+        if (events[i].e->flow >= 0)
+            last_step[{std::string(events[i].e->cat), events[i].e->flow}] = i;
+
+    int64_t origin = events.empty() ? 0 : events.front().e->start_us;
+    std::fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    bool first = true;
+    for (int t = 0; t < used; t++)
+    {
+        const ThreadBuffer &b = buffers[t];
+        std::fprintf(f, "%s{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                     first ? "" : ",\n", b.tid, b.name ? b.name : "thread");
+        first = false;
+    }
+
+    std::map<std::pair<std::string, int64_t>, bool> started;
+    for (size_t i = 0; i < events.size(); i++)
+    {
+        const Event &e = *events[i].e;
+        int tid = events[i].tid;
+        std::fprintf(f, "%s{\"ph\":\"X\",\"cat\":\"%s\",\"name\":\"%s\",\"pid\":1,\"tid\":%d,\"ts\":%lld,\"dur\":%lld",
+                     first ? "" : ",\n", e.cat, e.name, tid, (long long)(e.start_us - origin), (long long)e.dur_us);
+        first = false;
+        if (e.flow < 0)
+        {
+            std::fprintf(f, "}");
+            continue;
+        }
+        std::fprintf(f, ",\"args\":{\"flow\":%lld}}", (long long)e.flow);
+
+        auto key = std::make_pair(std::string(e.cat), e.flow);
+        bool is_first = !started[key];
+        bool is_last = last_step[key] == i;
+        if (is_first && is_last)
+            continue;
+        started[key] = true;
+        const char *ph = is_first ? "s" : is_last ? "f" : "t";
+        std::fprintf(f, ",\n{\"ph\":\"%s\",\"cat\":\"%s\",\"name\":\"%s\",\"id\":%lld,\"pid\":1,\"tid\":%d,\"ts\":%lld%s}",
+                     ph, e.cat, e.cat, (long long)e.flow, tid, (long long)(e.start_us - origin), is_last ? ",\"bp\":\"e\"" : "");
+    }
+    std::fprintf(f, "\n]}\n");
+    return std::fclose(f) == 0;
+}
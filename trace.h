@@ -0,0 +1,90 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include "telemetry.h"
+
+// ---- Tracer ----
+// Opt-in timeline of what every pipeline thread did, written as a Chrome trace-event
+// JSON file at exit (chrome://tracing, ui.perfetto.dev). Each thread records complete
+// (begin + duration) events into a ring of its own, so recording takes no lock and
+// only the newest events_per_thread events of each thread survive. Events carrying a
+// flow id are linked across threads in timestamp order: a packet read by the demuxer,
+// decoded and displayed shows up as one arrow through all three threads. The rings
+// are allocated by enable() and a thread claims one with an atomic increment on its
+// first event, so even SDL's audio callback records without allocating or locking;
+// threads beyond MAX_THREADS are not traced.
+class Tracer
+{
+public:
+    static const int MAX_THREADS = 32;
+
+    // Before any thread records. Allocates MAX_THREADS rings.
+    static void enable(size_t events_per_thread);
+    static bool enabled() { return on.load(std::memory_order_relaxed); }
+
+    // Labels the calling thread in the trace.
+    static void set_thread_name(const char *name);
+
+    // cat and name must be string literals. flow < 0: not part of a flow.
+    static void record(const char *cat, const char *name, int64_t start_us, int64_t end_us, int64_t flow = -1);
+
+    // Once every recording thread has stopped. Returns false if the file cannot be written.
+    static bool write_chrome_json(const std::string &path);
+
+private:
+    struct Event
+    {
+        const char *cat;
+        const char *name;
+        int64_t start_us;
+        int64_t dur_us;
+        int64_t flow;
+    };
+
+    struct ThreadBuffer
+    {
+        std::unique_ptr<Event[]> events; // ring of capacity events
+        uint64_t written = 0;
+        const char *name = nullptr;
+        int tid = 0;
+    };
+
+    // The calling thread's ring, or nullptr if every ring is taken.
+    static ThreadBuffer *thread_buffer();
+
+    static std::atomic<bool> on;
+    static size_t capacity; // power of two
+    static ThreadBuffer buffers[MAX_THREADS];
+    static std::atomic<int> claimed;
+    static thread_local int slot;
+};
+
+// Records the enclosing scope as one event when tracing is on.
+class TraceScope
+{
+public:
+    TraceScope(const char *cat, const char *name, int64_t flow = -1)
+        : cat(cat), name(name), flow(flow), start(Tracer::enabled() ? telemetry_now_us() : 0) {}
+
+    ~TraceScope()
+    {
+        if (start)
+            Tracer::record(cat, name, start, telemetry_now_us(), flow);
+    }
+
+    // For ids only known once the traced work is done, e.g. the pts of a received frame.
+    void set_flow(int64_t id) { flow = id; }
+
+    TraceScope(const TraceScope &) = delete;
+    TraceScope &operator=(const TraceScope &) = delete;
+
+private:
+    const char *cat;
+    const char *name;
+    int64_t flow;
+    int64_t start;
+};
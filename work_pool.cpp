@@ -0,0 +1,232 @@
+#include "work_pool.h"
+
+extern "C"
+{
+#include <libavcodec/avcodec.h>
+}
+
+static unsigned shared_workers = 0;
+
+// Pool and deque the current thread works for, if it is a pool worker.
+static thread_local WorkStealingPool *current_pool = nullptr;
+static thread_local unsigned current_worker = 0;
+
+void WorkStealingPool::configure(unsigned workers)
+{
+    shared_workers = workers;
+}
+
+WorkStealingPool &WorkStealingPool::shared()
+{
+    static WorkStealingPool pool(shared_workers);
+    return pool;
+}
+
+WorkStealingPool::WorkStealingPool(unsigned count)
+{
+    if (count == 0)
+        count = std::thread::hardware_concurrency();
+    if (count == 0)
+        count = 1;
+    for (unsigned i = 0; i < count; i++)
+        workers.push_back(std::make_unique<Worker>());
+    for (unsigned i = 0; i < count; i++)
+        threads.emplace_back(&WorkStealingPool::worker_entry, this, i);
+}
+
+WorkStealingPool::~WorkStealingPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(idle_mutex);
+        quit = true;
+    }
+    idle_cond.notify_all();
+    for (std::thread &t : threads)
+        t.join();
+}
+
+void WorkStealingPool::submit(Task task)
+{
+    unsigned index = current_pool == this ? current_worker : next_worker.fetch_add(1, std::memory_order_relaxed) % workers.size();
+    {
+        std::lock_guard<std::mutex> lock(workers[index]->mutex);
+        workers[index]->tasks.push_back(std::move(task));
+    }
+    {
+        std::lock_guard<std::mutex> lock(idle_mutex);
+        queued.fetch_add(1, std::memory_order_relaxed);
+    }
+    idle_cond.notify_one();
+}
+
+bool WorkStealingPool::run_one(unsigned index)
+{
+    Task task;
+    {
+        Worker &own = *workers[index];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty())
+        {
+            task = std::move(own.tasks.front());
+            own.tasks.pop_front();
+        }
+    }
+    for (size_t i = 1; !task && i < workers.size(); i++)
+    {
+        Worker &victim = *workers[(index + i) % workers.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty())
+        {
+            task = std::move(victim.tasks.back());
+            victim.tasks.pop_back();
+        }
+    }
+    if (!task)
+        return false;
+    queued.fetch_sub(1, std::memory_order_relaxed);
+    task();
+    return true;
+}
+
+void WorkStealingPool::worker_entry(unsigned index)
+{
+    current_pool = this;
+    current_worker = index;
+    while (true)
+    {
+        if (run_one(index))
+            continue;
+        std::unique_lock<std::mutex> lock(idle_mutex);
+        idle_cond.wait(lock, [this]
+                       { return quit || queued.load(std::memory_order_relaxed) > 0; });
+        if (quit)
+            break;
+    }
+}
+
+void WorkStealingPool::parallel_for(int count, int max_slots, const std::function<void(int job, int slot)> &fn)
+{
+    if (count <= 0)
+        return;
+
+    struct Batch
+    {
+        const std::function<void(int, int)> *fn;
+        int count;
+        int max_slots;
+        std::atomic<int> next_job{0};
+        std::atomic<int> next_slot{1}; // slot 0 is the caller's
+        std::atomic<int> done{0};
+        std::mutex mutex;
+        std::condition_variable finished;
+    };
+    auto batch = std::make_shared<Batch>();
+    batch->fn = &fn;
+    batch->count = count;
+    batch->max_slots = max_slots < 1 ? 1 : max_slots;
+
+    // Late helpers find no job left and never touch fn, which only lives until return.
+    auto work = [](Batch &b, int slot)
+    {
+        int job;
+        while ((job = b.next_job.fetch_add(1)) < b.count)
+        {
+            (*b.fn)(job, slot);
+            if (b.done.fetch_add(1) + 1 == b.count)
+            {
+                std::lock_guard<std::mutex> lock(b.mutex);
+                b.finished.notify_all();
+            }
+        }
+    };
+
+    int helpers = std::min(std::min(count, batch->max_slots), (int)workers.size() + 1) - 1;
+    for (int i = 0; i < helpers; i++)
+        submit([batch, work]
+               {
+                   int slot = batch->next_slot.fetch_add(1);
+                   if (slot < batch->max_slots)
+                       work(*batch, slot); });
+
+    work(*batch, 0);
+    std::unique_lock<std::mutex> lock(batch->mutex);
+    batch->finished.wait(lock, [&]
+                         { return batch->done.load() == count; });
+}
+
+// ---- libavcodec hooks ----
+
+static int pool_execute(AVCodecContext *c, int (*func)(AVCodecContext *c2, void *arg), void *arg, int *ret, int count, int size)
+{
+    WorkStealingPool::shared().parallel_for(count, c->thread_count, [&](int job, int)
+                                            {
+                                                int r = func(c, static_cast<char *>(arg) + (size_t)job * size);
+                                                if (ret)
+                                                    ret[job] = r; });
+    return 0;
+}
+
+static int pool_execute2(AVCodecContext *c, int (*func)(AVCodecContext *c2, void *arg, int jobnr, int threadnr), void *arg, int *ret, int count)
+{
+    WorkStealingPool::shared().parallel_for(count, c->thread_count, [&](int job, int slot)
+                                            {
+                                                int r = func(c, arg, job, slot);
+                                                if (ret)
+                                                    ret[job] = r; });
+    return 0;
+}
+
+void WorkStealingPool::configure_codec(AVCodecContext *ctx, const AVCodec *codec)
+{
+    int cores = (int)size();
+    if (ctx->codec_type != AVMEDIA_TYPE_VIDEO)
+    {
+        ctx->thread_count = 1;
+        return;
+    }
+    if (codec->capabilities & AV_CODEC_CAP_FRAME_THREADS)
+    {
+        // Whatever the contexts still open leave of the budget, held until
+        // release_codec(). With nothing left, slice threads on the pool add none.
+        std::lock_guard<std::mutex> lock(codec_mutex);
+        int budget = cores - frame_threads_held;
+        if (budget > 1)
+        {
+            ctx->thread_type = FF_THREAD_FRAME;
+            ctx->thread_count = budget;
+            frame_threads[ctx] = budget;
+            frame_threads_held += budget;
+            return;
+        }
+    }
+    if (codec->capabilities & AV_CODEC_CAP_SLICE_THREADS)
+    {
+        // One slice context per pool slot; the jobs themselves run on the pool.
+        ctx->thread_type = FF_THREAD_SLICE;
+        ctx->thread_count = cores;
+    }
+    else
+    {
+        ctx->thread_count = 1;
+    }
+}
+
+void WorkStealingPool::attach_codec(AVCodecContext *ctx)
+{
+    // libavcodec's own slice threads stay parked: nothing is submitted to them.
+    if (ctx->active_thread_type & FF_THREAD_SLICE)
+    {
+        ctx->execute = pool_execute;
+        ctx->execute2 = pool_execute2;
+    }
+}
+
+void WorkStealingPool::release_codec(AVCodecContext *ctx)
+{
+    std::lock_guard<std::mutex> lock(codec_mutex);
+    auto it = frame_threads.find(ctx);
+    if (it == frame_threads.end())
+        return;
+    frame_threads_held -= it->second;
+    frame_threads.erase(it);
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+struct AVCodec;
+struct AVCodecContext;
+
+// ---- WorkStealingPool ----
+// Process-wide worker pool that every decoder shares, so the number of busy threads
+// tracks the core count instead of the number of open codec contexts. Each worker
+// owns a task deque. It runs its own tasks oldest first and, once they run out,
+// steals the newest task of another worker.
+//
+// Codec contexts plug into it through configure_codec()/attach_codec(): slice jobs
+// (AVCodecContext::execute/execute2) run as parallel_for() batches on the pool.
+// Frame threads belong to libavcodec; they come out of a process-wide budget of one
+// per core, which each context holds until release_codec(), so open contexts never
+// add up to more frame threads than there are cores.
+class WorkStealingPool
+{
+public:
+    using Task = std::function<void()>;
+
+    // Worker count of the shared pool (0: one per core). Only before its first use.
+    static void configure(unsigned workers);
+    static WorkStealingPool &shared();
+
+    explicit WorkStealingPool(unsigned workers);
+    ~WorkStealingPool();
+
+    WorkStealingPool(const WorkStealingPool &) = delete;
+    WorkStealingPool &operator=(const WorkStealingPool &) = delete;
+
+    // Queues on the calling worker's own deque, or round-robin from other threads.
+    void submit(Task task);
+
+    // Runs fn(job, slot) for every job in [0, count) and returns once all are done.
+    // At most max_slots threads take part, the caller included as slot 0, and each
+    // has its own slot number below max_slots. Jobs start in increasing order, so a
+    // job may wait on the progress of a lower one.
+    void parallel_for(int count, int max_slots, const std::function<void(int job, int slot)> &fn);
+
+    unsigned size() const { return (unsigned)threads.size(); }
+
+    // Before avcodec_open2: threading mode and thread count for ctx. Frame threads
+    // are taken from what other contexts leave of the budget.
+    void configure_codec(AVCodecContext *ctx, const AVCodec *codec);
+    // After avcodec_open2: routes ctx's slice jobs through the pool.
+    void attach_codec(AVCodecContext *ctx);
+    // Before avcodec_free_context: returns ctx's frame threads to the budget.
+    void release_codec(AVCodecContext *ctx);
+
+private:
+    struct Worker
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    void worker_entry(unsigned index);
+    bool run_one(unsigned index);
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<std::thread> threads;
+    std::atomic<unsigned> next_worker{0};
+    std::atomic<int> queued{0};
+    std::mutex idle_mutex;
+    std::condition_variable idle_cond;
+    bool quit = false;
+
+    std::mutex codec_mutex;
+    std::unordered_map<AVCodecContext *, int> frame_threads;
+    int frame_threads_held = 0;
+};